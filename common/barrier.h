@@ -0,0 +1,48 @@
+/**
+ *  \file  barrier.h
+ *  \brief reusable barrier of a fixed group of threads
+ */
+
+#ifndef COMMON_BARRIER_H_
+#define COMMON_BARRIER_H_
+
+#include <condition_variable>
+#include <mutex>
+#include "utils.h"
+
+namespace snoopy {
+
+class Barrier {
+    public:
+        explicit Barrier(size_t count) :
+            count_(count), waiting_(0), generation_(0) {}
+
+        /**
+         * block until all the threads of the group have called wait(), the
+         * barrier can be used again right after
+         */
+        void wait() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            const size_t generation = generation_;
+            if (++waiting_ == count_) {
+                waiting_ = 0;
+                ++generation_;
+                cond_.notify_all();
+                return;
+            }
+            cond_.wait(lock, [this, generation] { return generation != generation_; });
+        }
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        const size_t count_;
+        size_t waiting_;
+        size_t generation_;
+
+        DISALLOW_COPY_AND_ASSIGN(Barrier)
+};
+
+}
+
+#endif
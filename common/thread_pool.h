@@ -0,0 +1,171 @@
+/**
+ *  \file  thread_pool.h
+ *  \brief work stealing pool of a fixed number of threads
+ *
+ *  Every worker has its own deque of tasks. A task scheduled from a worker
+ *  goes to the back of that worker's deque and the worker takes its tasks
+ *  from the back, so a chain of dependent tasks stays on one thread and in
+ *  its cache. A worker whose deque is empty steals from the front of the
+ *  deques of the others. Tasks scheduled from other threads are spread
+ *  over the deques round robin.
+ */
+
+#ifndef COMMON_THREAD_POOL_H_
+#define COMMON_THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "utils.h"
+
+namespace snoopy {
+
+class ThreadPool {
+    public:
+        explicit ThreadPool(size_t thread_num) :
+            queued_(0), pending_(0), next_queue_(0), stop_(false) {
+            for (size_t i = 0; i < thread_num; ++i) {
+                queues_.push_back(std::unique_ptr<WorkQueue>(new WorkQueue));
+            }
+            for (size_t i = 0; i < thread_num; ++i) {
+                threads_.push_back(std::thread(&ThreadPool::work, this, i));
+            }
+        }
+
+        /**
+         * the tasks already scheduled are run first
+         */
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            work_cond_.notify_all();
+            for (size_t i = 0; i < threads_.size(); ++i) {
+                threads_[i].join();
+            }
+        }
+
+        size_t size() const { return threads_.size(); }
+
+        /**
+         * run `task` on a worker, tasks may schedule other tasks
+         */
+        void schedule(std::function<void()> task) {
+            const size_t q = (current_pool() == this) ?
+                current_index() : next_queue_++ % queues_.size();
+            ++pending_;
+            {
+                std::lock_guard<std::mutex> lock(queues_[q]->mutex);
+                queues_[q]->tasks.push_back(std::move(task));
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ++queued_;
+            }
+            work_cond_.notify_one();
+        }
+
+        /**
+         * block until every task scheduled, and every task they scheduled,
+         * has run; not to be called from a task
+         */
+        void wait() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_cond_.wait(lock, [this] { return pending_ == 0; });
+        }
+
+    private:
+        struct WorkQueue {
+            std::mutex mutex;
+            std::deque<std::function<void()> > tasks;
+        };
+
+        static ThreadPool *& current_pool() {
+            static thread_local ThreadPool * pool = nullptr;
+            return pool;
+        }
+
+        static size_t & current_index() {
+            static thread_local size_t index = 0;
+            return index;
+        }
+
+        /**
+         * the newest task of worker `index`, or else the oldest task of
+         * another worker
+         */
+        bool pop(size_t index, std::function<void()> & task) {
+            {
+                WorkQueue & own = *queues_[index];
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (!own.tasks.empty()) {
+                    task = std::move(own.tasks.back());
+                    own.tasks.pop_back();
+                    return true;
+                }
+            }
+            for (size_t k = 1; k < queues_.size(); ++k) {
+                WorkQueue & other = *queues_[(index + k) % queues_.size()];
+                std::lock_guard<std::mutex> lock(other.mutex);
+                if (!other.tasks.empty()) {
+                    task = std::move(other.tasks.front());
+                    other.tasks.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void work(size_t index) {
+#ifdef _OPENMP
+            //the parallelism is across the tasks
+            omp_set_num_threads(1);
+#endif
+            current_pool() = this;
+            current_index() = index;
+            std::function<void()> task;
+            while (true) {
+                if (pop(index, task)) {
+                    --queued_;
+                    task();
+                    task = nullptr;
+                    if (--pending_ == 0) {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        done_cond_.notify_all();
+                    }
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(mutex_);
+                work_cond_.wait(lock, [this] { return stop_ || queued_ > 0; });
+                if (stop_ && queued_ == 0) {
+                    return;
+                }
+            }
+        }
+
+    private:
+        std::vector<std::unique_ptr<WorkQueue> > queues_;
+        std::vector<std::thread> threads_;
+        std::mutex mutex_;
+        std::condition_variable work_cond_;
+        std::condition_variable done_cond_;
+        std::atomic<size_t> queued_; //!< tasks in the deques
+        std::atomic<size_t> pending_; //!< tasks scheduled and not done
+        std::atomic<size_t> next_queue_;
+        bool stop_;
+
+        DISALLOW_COPY_AND_ASSIGN(ThreadPool)
+};
+
+}
+
+#endif
@@ -11,6 +11,7 @@
 #include <fstream>
 #include <iostream>
 #include "../matrix/matrix_blob.h"
+#include "model_file.h"
 
 using std::string;
 using std::shared_ptr;
@@ -54,20 +55,36 @@ inline int read_solve_proto_from_text_file(const string & f_name,
     return snoopy::SUCCESS;
 }
 
+/**
+ * copy the parameter blobs from a model file, both the versioned format of
+ * model_file.h and the legacy raw dump are accepted
+ *
+ * @param names: the names to look the blobs up by in a versioned file, by
+ *        position when empty
+ */
 template <typename DataType>
 inline int load_model_from_binary_file(const string & file_name,
-                      const vector<shared_ptr<matrix::Blob<DataType> > > & para_blobs) {
+                      const vector<shared_ptr<matrix::Blob<DataType> > > & para_blobs,
+                      const vector<string> & names = vector<string>()) {
     size_t file_offset = 0;
     size_t blob_data_size = 0;
     ifstream file (file_name, ios::in|ios::binary);
     if (!file.is_open()) {
         LOG_FATAL << "open file : " << file_name << " failed!" << endl;
     }
-    //file.seekg (0, ios::beg);
+    char magic[sizeof(kModelMagic)] = {0};
+    file.read(magic, sizeof(magic));
+    if (file.gcount() == sizeof(magic) && is_versioned_model(magic, sizeof(magic))) {
+        file.close();
+        return read_model_file(file_name, para_blobs, names, false);
+    }
+    //legacy file, the raw blobs back to back
+    file.clear();
+    file.seekg (0, ios::beg);
 
     for (int i = 0; i < para_blobs.size(); ++i) {
        blob_data_size = para_blobs[i]->get_count() * sizeof(DataType);
-       if(!(file.read(para_blobs[i]->get_raw_data(), blob_data_size))) {
+       if(!(file.read(static_cast<char *>(para_blobs[i]->get_raw_data()), blob_data_size))) {
             LOG_FATAL << "read model failed!" << endl;         
        }
     }
@@ -77,27 +94,30 @@ inline int load_model_from_binary_file(const string & file_name,
     return snoopy::SUCCESS;
 }
 
+/**
+ * map the parameter blobs from a versioned model file without copying, the
+ * blobs become read-only and share the page cache with every process that
+ * maps the same file
+ *
+ * @param names: the names to look the blobs up by, by position when empty
+ */
 template <typename DataType>
-inline int write_model_to_binary_file(const string & file_name,
-                      const vector<shared_ptr<matrix::Blob<DataType> > > & para_blobs) {
-    size_t file_offset = 0;
-    size_t blob_data_size = 0;
-    ofstream file (file_name, ios::out|ios::binary);
-    if (!file.is_open()) {
-        LOG_FATAL << "open file : " << file_name << " failed!" << endl;
-    }
-    for (int i = 0; i < para_blobs.size(); ++i) {
-       blob_data_size = para_blobs[i]->get_count() * sizeof(DataType);
-       std::cerr << "index: " << i << " blob_data_size: " << blob_data_size << endl;
-       std::cerr << "dim0: " << para_blobs[i]->dim_at(0) << " dim1: " << 
-           para_blobs[i]->dim_at(1) << endl;
-      // write_matrix_to_binary_file(file, file_offset, para_blobs[i], blob_data_size); 
-       file.write(static_cast<char *>(para_blobs[i]->get_raw_data()), blob_data_size);
-       file_offset += blob_data_size;
-    }
-    file.close();
+inline int map_model_from_binary_file(const string & file_name,
+                      const vector<shared_ptr<matrix::Blob<DataType> > > & para_blobs,
+                      const vector<string> & names = vector<string>()) {
+    return read_model_file(file_name, para_blobs, names, true);
+}
 
-    return snoopy::SUCCESS;
+/**
+ * write the parameter blobs in the versioned format of model_file.h
+ *
+ * @param names: the name of each blob, "blob_<index>" when empty
+ */
+template <typename DataType>
+inline int write_model_to_binary_file(const string & file_name,
+                      const vector<shared_ptr<matrix::Blob<DataType> > > & para_blobs,
+                      const vector<string> & names = vector<string>()) {
+    return write_model_file(file_name, para_blobs, names);
 }
                                   
 }
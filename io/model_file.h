@@ -0,0 +1,316 @@
+/**
+ *  \file  model_file.h
+ *  \brief versioned, aligned on-disk format of the model parameters
+ *
+ *  Layout, all integers little endian:
+ *      char[8]   magic "SNPYMODL"
+ *      uint32    version
+ *      uint32    number of blobs
+ *      uint64    offset of the data section, a multiple of the page size
+ *      per blob:
+ *          uint32    name length, followed by the name
+ *          uint32    dtype (ModelDType)
+ *          uint32    number of dims, followed by uint64 dims
+ *          uint64    offset of the data from the start of the file
+ *          uint64    number of bytes
+ *      padding up to the data section
+ *      blob data, each blob starts on a kModelAlign boundary
+ *
+ *  Since every blob is aligned inside the file, a blob can be used in place
+ *  from a read-only mapping of the file (see storage::MmapBuffer) and the
+ *  load costs no copy at all. Files written before this format, the raw
+ *  blobs back to back, are still read by the copying loader.
+ */
+
+#ifndef SNOOPY_IO_MODEL_FILE_H_
+#define SNOOPY_IO_MODEL_FILE_H_
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include "../common/com_def.h"
+#include "../common/logging.h"
+#include "../matrix/matrix_blob.h"
+#include "../storage/mmap_buffer.h"
+
+namespace snoopy {
+namespace io {
+
+const char kModelMagic[8] = {'S', 'N', 'P', 'Y', 'M', 'O', 'D', 'L'};
+const uint32_t kModelVersion = 1;
+const size_t kModelAlign = 64;
+const size_t kModelPageAlign = 4096;
+
+enum ModelDType {
+    MODEL_FLOAT32 = 0,
+    MODEL_FLOAT64 = 1,
+    MODEL_FP16 = 2,
+    MODEL_BF16 = 3
+};
+
+template <typename DataType>
+struct ModelDTypeOf;
+
+template <>
+struct ModelDTypeOf<float> { static const uint32_t value = MODEL_FLOAT32; };
+template <>
+struct ModelDTypeOf<double> { static const uint32_t value = MODEL_FLOAT64; };
+template <>
+struct ModelDTypeOf<matrix::fp16> { static const uint32_t value = MODEL_FP16; };
+template <>
+struct ModelDTypeOf<matrix::bf16> { static const uint32_t value = MODEL_BF16; };
+
+/**
+ * description of one blob in the header
+ */
+struct ModelBlobInfo {
+    std::string name;
+    uint32_t dtype;
+    std::vector<size_t> shape;
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+inline size_t align_up(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
+}
+
+inline bool is_versioned_model(const char * p, size_t n) {
+    return n >= sizeof(kModelMagic) && memcmp(p, kModelMagic, sizeof(kModelMagic)) == 0;
+}
+
+namespace model_impl {
+
+template <typename T>
+inline void put(std::string & s, T v) {
+    s.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+/**
+ * reads a T at `pos` of [p, p + n), false if it runs past the end
+ */
+template <typename T>
+inline bool get(const char * p, size_t n, size_t & pos, T & v) {
+    if (pos + sizeof(T) > n) {
+        return false;
+    }
+    memcpy(&v, p + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+}  //namespace model_impl
+
+/**
+ * parse the header of a versioned model file
+ *
+ * @param p: the content of the file
+ * @param n: the size of the file
+ * @param blobs: the blob descriptions
+ *
+ * @return SUCCESS, or FAILURE when the header is malformed
+ */
+inline int parse_model_header(const char * p, size_t n, std::vector<ModelBlobInfo> & blobs) {
+    using model_impl::get;
+    if (!is_versioned_model(p, n)) {
+        LOG_ERROR << "not a versioned model file";
+        return snoopy::FAILURE;
+    }
+    size_t pos = sizeof(kModelMagic);
+    uint32_t version = 0;
+    uint32_t count = 0;
+    uint64_t data_offset = 0;
+    if (!get(p, n, pos, version) || !get(p, n, pos, count) || !get(p, n, pos, data_offset)) {
+        LOG_ERROR << "truncated model header";
+        return snoopy::FAILURE;
+    }
+    if (version > kModelVersion) {
+        LOG_ERROR << "model version " << version << " is newer than " << kModelVersion;
+        return snoopy::FAILURE;
+    }
+    blobs.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        ModelBlobInfo & info = blobs[i];
+        uint32_t name_len = 0;
+        uint32_t dims = 0;
+        if (!get(p, n, pos, name_len) || pos + name_len > n) {
+            LOG_ERROR << "truncated model header";
+            return snoopy::FAILURE;
+        }
+        info.name.assign(p + pos, name_len);
+        pos += name_len;
+        if (!get(p, n, pos, info.dtype) || !get(p, n, pos, dims)) {
+            LOG_ERROR << "truncated model header";
+            return snoopy::FAILURE;
+        }
+        info.shape.resize(dims);
+        for (uint32_t d = 0; d < dims; ++d) {
+            uint64_t dim = 0;
+            if (!get(p, n, pos, dim)) {
+                LOG_ERROR << "truncated model header";
+                return snoopy::FAILURE;
+            }
+            info.shape[d] = dim;
+        }
+        if (!get(p, n, pos, info.offset) || !get(p, n, pos, info.bytes)) {
+            LOG_ERROR << "truncated model header";
+            return snoopy::FAILURE;
+        }
+        if (info.offset < data_offset || info.offset + info.bytes > n) {
+            LOG_ERROR << "blob " << info.name << " lies outside the model file";
+            return snoopy::FAILURE;
+        }
+    }
+    return snoopy::SUCCESS;
+}
+
+/**
+ * write the parameter blobs in the versioned format
+ *
+ * @param file_name: the model file
+ * @param para_blobs: the blobs
+ * @param names: the name of each blob, "blob_<index>" when empty
+ */
+template <typename DataType>
+inline int write_model_file(const std::string & file_name,
+                      const std::vector<std::shared_ptr<matrix::Blob<DataType> > > & para_blobs,
+                      const std::vector<std::string> & names) {
+    using model_impl::put;
+    SN_CHECK((names.empty() || names.size() == para_blobs.size()));
+    std::vector<std::string> blob_names(names);
+    for (size_t i = blob_names.size(); i < para_blobs.size(); ++i) {
+        blob_names.push_back("blob_" + std::to_string(i));
+    }
+
+    //the header size is known before the offsets are
+    size_t header_bytes = sizeof(kModelMagic) + 2 * sizeof(uint32_t) + sizeof(uint64_t);
+    for (size_t i = 0; i < para_blobs.size(); ++i) {
+        header_bytes += 3 * sizeof(uint32_t) + blob_names[i].size() +
+            para_blobs[i]->get_blobshape().dims() * sizeof(uint64_t) + 2 * sizeof(uint64_t);
+    }
+    const uint64_t data_offset = align_up(header_bytes, kModelPageAlign);
+
+    std::string header(kModelMagic, sizeof(kModelMagic));
+    put<uint32_t>(header, kModelVersion);
+    put<uint32_t>(header, para_blobs.size());
+    put<uint64_t>(header, data_offset);
+    std::vector<uint64_t> offsets;
+    uint64_t offset = data_offset;
+    for (size_t i = 0; i < para_blobs.size(); ++i) {
+        matrix::BlobShape bs = para_blobs[i]->get_blobshape();
+        const uint64_t bytes = para_blobs[i]->get_count() * sizeof(DataType);
+        put<uint32_t>(header, blob_names[i].size());
+        header.append(blob_names[i]);
+        put<uint32_t>(header, ModelDTypeOf<DataType>::value);
+        put<uint32_t>(header, bs.dims());
+        for (size_t d = 0; d < bs.dims(); ++d) {
+            put<uint64_t>(header, bs[d]);
+        }
+        put<uint64_t>(header, offset);
+        put<uint64_t>(header, bytes);
+        offsets.push_back(offset);
+        offset = align_up(offset + bytes, kModelAlign);
+    }
+    CHECK_EQ(header.size(), header_bytes);
+
+    std::ofstream file(file_name, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        LOG_ERROR << "open file : " << file_name << " failed!";
+        return snoopy::FAILURE;
+    }
+    header.resize(data_offset, '\0');
+    file.write(header.data(), header.size());
+    const char zeros[kModelAlign] = {0};
+    uint64_t pos = data_offset;
+    for (size_t i = 0; i < para_blobs.size(); ++i) {
+        file.write(zeros, offsets[i] - pos);
+        const uint64_t bytes = para_blobs[i]->get_count() * sizeof(DataType);
+        file.write(static_cast<const char *>(para_blobs[i]->get_raw_data()), bytes);
+        pos = offsets[i] + bytes;
+    }
+    if (!file.good()) {
+        LOG_ERROR << "write model file : " << file_name << " failed!";
+        return snoopy::FAILURE;
+    }
+    return snoopy::SUCCESS;
+}
+
+/**
+ * load the parameter blobs from a versioned model file
+ *
+ * @param file_name: the model file
+ * @param para_blobs: the blobs to fill, their shapes must match the file
+ * @param names: the names to look the blobs up by, by position when empty
+ * @param is_mmap: true to back the blobs by a read-only mapping of the file
+ *        instead of copying, the blobs must not be written afterwards
+ */
+template <typename DataType>
+inline int read_model_file(const std::string & file_name,
+                      const std::vector<std::shared_ptr<matrix::Blob<DataType> > > & para_blobs,
+                      const std::vector<std::string> & names,
+                      bool is_mmap) {
+    storage::MappedFile * file = new storage::MappedFile(file_name);
+    if (!file->is_open()) {
+        LOG_ERROR << "open file : " << file_name << " failed!";
+        file->unref();
+        return snoopy::FAILURE;
+    }
+    std::vector<ModelBlobInfo> infos;
+    if (parse_model_header(file->data(), file->size(), infos) != snoopy::SUCCESS) {
+        file->unref();
+        return snoopy::FAILURE;
+    }
+    std::map<std::string, size_t> name_index;
+    for (size_t i = 0; i < infos.size(); ++i) {
+        name_index[infos[i].name] = i;
+    }
+
+    int status = snoopy::SUCCESS;
+    for (size_t i = 0; i < para_blobs.size() && status == snoopy::SUCCESS; ++i) {
+        size_t index = i;
+        if (!names.empty()) {
+            std::map<std::string, size_t>::const_iterator it = name_index.find(names[i]);
+            if (it == name_index.end()) {
+                LOG_ERROR << "blob " << names[i] << " is not in " << file_name;
+                status = snoopy::FAILURE;
+                break;
+            }
+            index = it->second;
+        }
+        if (index >= infos.size()) {
+            LOG_ERROR << file_name << " has only " << infos.size() << " blobs";
+            status = snoopy::FAILURE;
+            break;
+        }
+        const ModelBlobInfo & info = infos[index];
+        matrix::BlobShape bs = para_blobs[i]->get_blobshape();
+        bool same_shape = (info.shape.size() == bs.dims());
+        for (size_t d = 0; same_shape && d < info.shape.size(); ++d) {
+            same_shape = (info.shape[d] == bs[d]);
+        }
+        if (!same_shape || info.dtype != ModelDTypeOf<DataType>::value ||
+                info.bytes != para_blobs[i]->get_count() * sizeof(DataType)) {
+            LOG_ERROR << "blob " << info.name << " does not match the net";
+            status = snoopy::FAILURE;
+            break;
+        }
+        if (is_mmap) {
+            storage::MmapBuffer<DataType> * buffer = new storage::MmapBuffer<DataType>(
+                    file, info.offset, para_blobs[i]->get_count());
+            para_blobs[i]->set_data(new matrix::MBlob<DataType>(buffer, bs));
+            buffer->unref();  //the MBlob holds it now
+        } else {
+            memcpy(para_blobs[i]->get_raw_data(), file->data() + info.offset, info.bytes);
+        }
+    }
+    file->unref();
+    return status;
+}
+
+}  //namespace io
+}  //namespace snoopy
+
+#endif
@@ -0,0 +1,447 @@
+/**
+ *  \file  record_file.h
+ *  \brief compact binary format of the training samples
+ *
+ *  Layout, all integers little endian:
+ *      char[8]   magic "SNPYRECD"
+ *      uint32    version
+ *      uint32    slots of a sample
+ *      uint32    flags, kRecordHasLabel | kRecordHasWeight
+ *      uint32    reserved
+ *      uint64    number of samples
+ *      uint64    number of blocks
+ *      uint64    offset of the block index
+ *      blocks
+ *      block index, per block:
+ *          uint64    offset from the start of the file
+ *          uint64    bytes
+ *          uint64    first sample
+ *          uint64    number of samples
+ *
+ *  A block holds up to records_per_block samples. A sample is its float
+ *  label and float weight when the flags say so, then per slot the varint
+ *  number of ids followed by the ids, each one the zigzag varint of its
+ *  difference to the previous id of the slot. The ids are 64 bit in the
+ *  file and read into io::SlotRecords as int.
+ *
+ *  The blocks are decoded from a read-only mapping of the file, a reader
+ *  touches only the blocks it needs, e.g. the blocks of its shard.
+ */
+
+#ifndef SNOOPY_IO_RECORD_FILE_H_
+#define SNOOPY_IO_RECORD_FILE_H_
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+#include "slot_parser.h"
+#include "../common/com_def.h"
+#include "../common/logging.h"
+#include "../storage/mmap_buffer.h"
+
+namespace snoopy {
+namespace io {
+
+const char kRecordMagic[8] = {'S', 'N', 'P', 'Y', 'R', 'E', 'C', 'D'};
+const uint32_t kRecordVersion = 1;
+const uint32_t kRecordHasLabel = 1;
+const uint32_t kRecordHasWeight = 2;
+const size_t kRecordHeaderBytes = sizeof(kRecordMagic) + 4 * sizeof(uint32_t) + 3 * sizeof(uint64_t);
+
+/**
+ * entry of the block index
+ */
+struct RecordBlockInfo {
+    uint64_t offset;
+    uint64_t bytes;
+    uint64_t first_record;
+    uint64_t num_records;
+};
+
+inline bool is_record_file(const char * p, size_t n) {
+    return n >= sizeof(kRecordMagic) && memcmp(p, kRecordMagic, sizeof(kRecordMagic)) == 0;
+}
+
+namespace record_impl {
+
+inline void put_varint(std::string & s, uint64_t v) {
+    while (v >= 0x80) {
+        s.push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    s.push_back(static_cast<char>(v));
+}
+
+/**
+ * decode the varint at p, false if it runs past `end`
+ */
+inline bool get_varint(const uint8_t * & p, const uint8_t * end, uint64_t & v) {
+    //most ids take at most 4 bytes, decode them without the loop
+    if (end - p >= 4) {
+        const uint32_t w = static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+                           static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+        if (!(w & 0x80)) {
+            v = w & 0x7f;
+            p += 1;
+            return true;
+        }
+        if (!(w & 0x8000)) {
+            v = (w & 0x7f) | (w & 0x7f00) >> 1;
+            p += 2;
+            return true;
+        }
+        if (!(w & 0x800000)) {
+            v = (w & 0x7f) | (w & 0x7f00) >> 1 | (w & 0x7f0000) >> 2;
+            p += 3;
+            return true;
+        }
+        if (!(w & 0x80000000)) {
+            v = (w & 0x7f) | (w & 0x7f00) >> 1 | (w & 0x7f0000) >> 2 | (w & 0x7f000000) >> 3;
+            p += 4;
+            return true;
+        }
+    }
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        const uint8_t b = *p++;
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if (b < 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline uint64_t zigzag(int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v) {
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+template <typename T>
+inline void put(std::string & s, T v) {
+    s.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+}  //namespace record_impl
+
+/**
+ * writes samples into a record file block by block
+ */
+class RecordWriter {
+    public:
+        /**
+         * @param slot_size: slots of a sample
+         * @param flags: kRecordHasLabel and/or kRecordHasWeight
+         * @param records_per_block: samples of a full block
+         */
+        RecordWriter(size_t slot_size, uint32_t flags = 0, size_t records_per_block = 4096) :
+            slot_size_(slot_size),
+            flags_(flags),
+            records_per_block_(records_per_block),
+            block_records_(0),
+            num_records_(0) {}
+
+        ~RecordWriter() {
+            if (file_.is_open()) {
+                close();
+            }
+        }
+
+        int open(const std::string & file_name) {
+            file_.open(file_name.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!file_.is_open()) {
+                LOG_ERROR << "open file : " << file_name << " failed!";
+                return snoopy::FAILURE;
+            }
+            //the header is written again by close(), with the counts
+            const std::string header(kRecordHeaderBytes, '\0');
+            file_.write(header.data(), header.size());
+            offset_ = kRecordHeaderBytes;
+            return snoopy::SUCCESS;
+        }
+
+        /**
+         * append sample r of `records`, the label and the weight are only
+         * written if the flags have them
+         */
+        void add(const SlotRecords & records, size_t r, float label = 0, float weight = 1) {
+            using record_impl::put;
+            using record_impl::put_varint;
+            using record_impl::zigzag;
+            CHECK_EQ(records.slot_size, slot_size_);
+            if (flags_ & kRecordHasLabel) {
+                put<float>(block_, label);
+            }
+            if (flags_ & kRecordHasWeight) {
+                put<float>(block_, weight);
+            }
+            for (size_t j = 0; j < slot_size_; ++j) {
+                const int * ids = records.slot_begin(r, j);
+                const size_t len = records.slot_length(r, j);
+                put_varint(block_, len);
+                int64_t prev = 0;
+                for (size_t k = 0; k < len; ++k) {
+                    put_varint(block_, zigzag(static_cast<int64_t>(ids[k]) - prev));
+                    prev = ids[k];
+                }
+            }
+            ++num_records_;
+            if (++block_records_ == records_per_block_) {
+                flush_block();
+            }
+        }
+
+        /**
+         * write the last block, the index and the header
+         */
+        int close() {
+            using record_impl::put;
+            flush_block();
+            std::string index;
+            for (size_t b = 0; b < blocks_.size(); ++b) {
+                put<uint64_t>(index, blocks_[b].offset);
+                put<uint64_t>(index, blocks_[b].bytes);
+                put<uint64_t>(index, blocks_[b].first_record);
+                put<uint64_t>(index, blocks_[b].num_records);
+            }
+            file_.write(index.data(), index.size());
+
+            std::string header(kRecordMagic, sizeof(kRecordMagic));
+            put<uint32_t>(header, kRecordVersion);
+            put<uint32_t>(header, slot_size_);
+            put<uint32_t>(header, flags_);
+            put<uint32_t>(header, 0);
+            put<uint64_t>(header, num_records_);
+            put<uint64_t>(header, blocks_.size());
+            put<uint64_t>(header, offset_);
+            file_.seekp(0);
+            file_.write(header.data(), header.size());
+            const bool is_good = file_.good();
+            file_.close();
+            if (!is_good) {
+                LOG_ERROR << "write record file failed!";
+                return snoopy::FAILURE;
+            }
+            return snoopy::SUCCESS;
+        }
+
+        size_t size() const { return num_records_; }
+
+    private:
+        void flush_block() {
+            if (block_records_ == 0) {
+                return;
+            }
+            RecordBlockInfo info;
+            info.offset = offset_;
+            info.bytes = block_.size();
+            info.first_record = num_records_ - block_records_;
+            info.num_records = block_records_;
+            blocks_.push_back(info);
+            file_.write(block_.data(), block_.size());
+            offset_ += block_.size();
+            block_.clear();
+            block_records_ = 0;
+        }
+
+    private:
+        std::ofstream file_;
+        size_t slot_size_;
+        uint32_t flags_;
+        size_t records_per_block_;
+        std::string block_; //!< the encoded samples of the current block
+        size_t block_records_;
+        uint64_t num_records_;
+        uint64_t offset_;
+        std::vector<RecordBlockInfo> blocks_;
+};
+
+/**
+ * reads the blocks of a record file from a read-only mapping
+ */
+class RecordReader {
+    public:
+        RecordReader() : file_(nullptr), slot_size_(0), flags_(0), num_records_(0) {}
+
+        ~RecordReader() {
+            if (file_ != nullptr) {
+                file_->unref();
+            }
+        }
+
+        /**
+         * map `file_name`, the file opened before is unmapped
+         */
+        int open(const std::string & file_name) {
+            if (file_ != nullptr) {
+                file_->unref();
+            }
+            blocks_.clear();
+            slot_size_ = 0;
+            flags_ = 0;
+            num_records_ = 0;
+            file_ = new storage::MappedFile(file_name);
+            if (!file_->is_open()) {
+                LOG_ERROR << "open file : " << file_name << " failed!";
+                return snoopy::FAILURE;
+            }
+            const char * p = file_->data();
+            const size_t n = file_->size();
+            if (n < kRecordHeaderBytes || !is_record_file(p, n)) {
+                LOG_ERROR << file_name << " is not a record file";
+                return snoopy::FAILURE;
+            }
+            uint32_t version = 0;
+            uint32_t slot_size = 0;
+            uint64_t num_blocks = 0;
+            uint64_t index_offset = 0;
+            size_t pos = sizeof(kRecordMagic);
+            memcpy(&version, p + pos, sizeof(uint32_t));
+            memcpy(&slot_size, p + pos + 4, sizeof(uint32_t));
+            memcpy(&flags_, p + pos + 8, sizeof(uint32_t));
+            memcpy(&num_records_, p + pos + 16, sizeof(uint64_t));
+            memcpy(&num_blocks, p + pos + 24, sizeof(uint64_t));
+            memcpy(&index_offset, p + pos + 32, sizeof(uint64_t));
+            if (version > kRecordVersion) {
+                LOG_ERROR << "record version " << version << " is newer than " << kRecordVersion;
+                return snoopy::FAILURE;
+            }
+            if (index_offset + num_blocks * sizeof(RecordBlockInfo) > n) {
+                LOG_ERROR << "truncated record file " << file_name;
+                return snoopy::FAILURE;
+            }
+            slot_size_ = slot_size;
+            blocks_.resize(num_blocks);
+            memcpy(blocks_.data(), p + index_offset, num_blocks * sizeof(RecordBlockInfo));
+            for (size_t b = 0; b < blocks_.size(); ++b) {
+                if (blocks_[b].offset + blocks_[b].bytes > index_offset) {
+                    LOG_ERROR << "block " << b << " lies outside the record file";
+                    blocks_.clear();
+                    return snoopy::FAILURE;
+                }
+            }
+            return snoopy::SUCCESS;
+        }
+
+        size_t slot_size() const { return slot_size_; }
+        uint32_t flags() const { return flags_; }
+        uint64_t size() const { return num_records_; }
+        size_t num_blocks() const { return blocks_.size(); }
+        const RecordBlockInfo & block_info(size_t b) const { return blocks_[b]; }
+
+        /**
+         * decode block b, appending its samples to `records`; on a corrupt
+         * block nothing is appended
+         *
+         * @param slot_capicity: ids kept of a slot, the others are skipped
+         * @param labels, weights: filled if not null and the file has them
+         */
+        int read_block(size_t b, SlotRecords & records, size_t slot_capicity,
+                       std::vector<float> * labels = nullptr,
+                       std::vector<float> * weights = nullptr) const {
+            CHECK_EQ(records.slot_size, slot_size_);
+            const size_t offsets_size = records.offsets.size();
+            const size_t ids_size = records.ids.size();
+            const size_t labels_size = (labels != nullptr) ? labels->size() : 0;
+            const size_t weights_size = (weights != nullptr) ? weights->size() : 0;
+            if (decode_block(b, records, slot_capicity, labels, weights) != snoopy::SUCCESS) {
+                //drop the samples decoded before the error
+                records.offsets.resize(offsets_size);
+                records.ids.resize(ids_size);
+                if (labels != nullptr) {
+                    labels->resize(labels_size);
+                }
+                if (weights != nullptr) {
+                    weights->resize(weights_size);
+                }
+                return snoopy::FAILURE;
+            }
+            return snoopy::SUCCESS;
+        }
+
+    private:
+        /**
+         * the body of read_block, on an error part of the block may have
+         * been appended
+         */
+        int decode_block(size_t b, SlotRecords & records, size_t slot_capicity,
+                         std::vector<float> * labels,
+                         std::vector<float> * weights) const {
+            using record_impl::get_varint;
+            using record_impl::unzigzag;
+            const uint8_t * p = reinterpret_cast<const uint8_t *>(file_->data() + blocks_[b].offset);
+            const uint8_t * end = p + blocks_[b].bytes;
+            for (uint64_t r = 0; r < blocks_[b].num_records; ++r) {
+                float v = 0;
+                if (flags_ & kRecordHasLabel) {
+                    if (p + sizeof(float) > end) {
+                        return corrupt(b);
+                    }
+                    memcpy(&v, p, sizeof(float));
+                    p += sizeof(float);
+                    if (labels != nullptr) {
+                        labels->push_back(v);
+                    }
+                }
+                if (flags_ & kRecordHasWeight) {
+                    if (p + sizeof(float) > end) {
+                        return corrupt(b);
+                    }
+                    memcpy(&v, p, sizeof(float));
+                    p += sizeof(float);
+                    if (weights != nullptr) {
+                        weights->push_back(v);
+                    }
+                }
+                for (size_t j = 0; j < slot_size_; ++j) {
+                    uint64_t len = 0;
+                    if (!get_varint(p, end, len)) {
+                        return corrupt(b);
+                    }
+                    int64_t id = 0;
+                    for (uint64_t k = 0; k < len; ++k) {
+                        uint64_t delta = 0;
+                        if (!get_varint(p, end, delta)) {
+                            return corrupt(b);
+                        }
+                        id += unzigzag(delta);
+                        if (id < std::numeric_limits<int>::min() ||
+                                id > std::numeric_limits<int>::max()) {
+                            LOG_ERROR << "id " << id << " of block " << b << " does not fit in an int";
+                            return snoopy::FAILURE;
+                        }
+                        if (k < slot_capicity) {
+                            records.ids.push_back(static_cast<int>(id));
+                        }
+                    }
+                    records.offsets.push_back(records.ids.size());
+                }
+            }
+            return snoopy::SUCCESS;
+        }
+
+        int corrupt(size_t b) const {
+            LOG_ERROR << "corrupt block " << b << " of the record file";
+            return snoopy::FAILURE;
+        }
+
+    private:
+        storage::MappedFile * file_;
+        size_t slot_size_;
+        uint32_t flags_;
+        uint64_t num_records_;
+        std::vector<RecordBlockInfo> blocks_;
+
+        DISALLOW_COPY_AND_ASSIGN(RecordReader)
+};
+
+}  //namespace io
+}  //namespace snoopy
+
+#endif
@@ -0,0 +1,294 @@
+/**
+ *  \file  slot_parser.h
+ *  \brief allocation free parser of the slot text format
+ *
+ *  One sample per line, the slots of a line are separated by ';' and the
+ *  ids of a slot by ' ', e.g. "1 2 3;4 5;6". The parser works in place on
+ *  the input, a mapped file or a large block, and writes the ids of every
+ *  slot into a CSR layout, SlotRecords, so nothing is allocated per token
+ *  or per line once the vectors of the records have grown. The delimiters
+ *  are found 32 or 16 bytes at a time with AVX2 or SSE2, the ids are parsed
+ *  by hand. Lines have no length limit.
+ *
+ *  The tokens follow split() in common/utils.h: empty slots and empty ids
+ *  are skipped, a line without any slot is no sample. A '\r' before the
+ *  '\n' is ignored. A line with an id out of the range of an int is logged
+ *  and dropped, as a record file rejects such an id.
+ */
+
+#ifndef SNOOPY_IO_SLOT_PARSER_H_
+#define SNOOPY_IO_SLOT_PARSER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "../common/logging.h"
+
+namespace snoopy {
+namespace io {
+
+/**
+ * the ids of parsed samples, slot j of sample r is
+ * ids[offsets[r * slot_size + j], offsets[r * slot_size + j + 1])
+ */
+struct SlotRecords {
+    explicit SlotRecords(size_t slot_num = 1) : slot_size(slot_num), offsets(1, 0) {}
+
+    size_t slot_size;
+    std::vector<size_t> offsets;
+    std::vector<int> ids;
+
+    size_t size() const { return (offsets.size() - 1) / slot_size; }
+
+    const int * slot_begin(size_t r, size_t j) const {
+        return ids.data() + offsets[r * slot_size + j];
+    }
+
+    size_t slot_length(size_t r, size_t j) const {
+        return offsets[r * slot_size + j + 1] - offsets[r * slot_size + j];
+    }
+
+    /**
+     * drop the samples, the memory is kept for the next ones
+     */
+    void clear() {
+        offsets.resize(1);
+        ids.clear();
+    }
+};
+
+/**
+ * parse the integer of [p, end) like atoi: an optional sign, then digits up
+ * to the first other character
+ *
+ * @return false if it does not fit in an int, v is then left as it is
+ */
+inline bool parse_int(const char * p, const char * end, int & v) {
+    bool is_neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        is_neg = (*p == '-');
+        ++p;
+    }
+    const int64_t limit = is_neg ? -static_cast<int64_t>(std::numeric_limits<int>::min())
+                                 : std::numeric_limits<int>::max();
+    int64_t x = 0;
+    for (; p < end; ++p) {
+        const unsigned d = static_cast<unsigned char>(*p) - '0';
+        if (d > 9) {
+            break;
+        }
+        //x stays below 2^31 + 1, so the product does not overflow
+        x = x * 10 + d;
+        if (x > limit) {
+            return false;
+        }
+    }
+    v = static_cast<int>(is_neg ? -x : x);
+    return true;
+}
+
+/**
+ * bit i is set iff p[i] is ';', ' ' or '\n', for the n <= 64 bytes at p
+ */
+inline uint64_t delimiter_mask(const char * p, size_t n) {
+    uint64_t mask = 0;
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i semi32 = _mm256_set1_epi8(';');
+    const __m256i space32 = _mm256_set1_epi8(' ');
+    const __m256i nl32 = _mm256_set1_epi8('\n');
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+        __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, semi32),
+                        _mm256_cmpeq_epi8(v, space32)), _mm256_cmpeq_epi8(v, nl32));
+        mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(m))) << i;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i semi = _mm_set1_epi8(';');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, semi),
+                        _mm_cmpeq_epi8(v, space)), _mm_cmpeq_epi8(v, nl));
+        mask |= static_cast<uint64_t>(_mm_movemask_epi8(m)) << i;
+    }
+#endif
+    for (; i < n; ++i) {
+        const char c = p[i];
+        if (c == ';' || c == ' ' || c == '\n') {
+            mask |= uint64_t(1) << i;
+        }
+    }
+    return mask;
+}
+
+class SlotParser {
+    public:
+        /**
+         * @param slot_size: slots of a sample, the others are dropped and
+         *        the missing ones are empty
+         * @param slot_capicity: ids kept of a slot, the others are dropped
+         * @param shard_id, shard_num: keep only the lines whose index modulo
+         *        shard_num is shard_id
+         * @param max_line: lines to read at most, counting the skipped ones
+         */
+        SlotParser(size_t slot_size, size_t slot_capicity,
+                   size_t shard_id = 0, size_t shard_num = 1,
+                   size_t max_line = std::numeric_limits<size_t>::max()) :
+            slot_size_(slot_size),
+            slot_capicity_(slot_capicity),
+            shard_id_(shard_id),
+            shard_num_(shard_num),
+            max_line_(max_line),
+            line_index_(0),
+            bad_lines_(0) {}
+
+        /**
+         * parse the lines of [p, end) into `records` until `max_records`
+         * samples were added, the input ends or max_line lines were read
+         *
+         * @return the start of the first line not read, pass it back to
+         *         continue
+         */
+        const char * parse(const char * p, const char * end, SlotRecords & records,
+                           size_t max_records = std::numeric_limits<size_t>::max()) {
+            const size_t limit = records.size() + max_records;
+            while (p < end && records.size() < limit && line_index_ < max_line_) {
+                if (line_index_++ % shard_num_ != shard_id_) {
+                    const char * nl = static_cast<const char *>(memchr(p, '\n', end - p));
+                    p = (nl == nullptr) ? end : nl + 1;
+                    continue;
+                }
+                p = parse_line(p, end, records);
+            }
+            return p;
+        }
+
+        /**
+         * lines read so far, counting the skipped ones
+         */
+        size_t lines() const { return line_index_; }
+
+        /**
+         * max_line lines were read
+         */
+        bool is_full() const { return line_index_ >= max_line_; }
+
+        /**
+         * lines dropped for an id out of the range of an int
+         */
+        size_t bad_lines() const { return bad_lines_; }
+
+    private:
+        /**
+         * parse the line at p into one sample, or none if it has no slot
+         *
+         * @return the start of the next line
+         */
+        const char * parse_line(const char * p, const char * end, SlotRecords & records) {
+            const size_t first_offset = records.offsets.size();
+            size_t slot = 0; //!< slots seen
+            size_t slot_ids = 0; //!< ids kept in the current slot
+            bool is_bad = false; //!< an id does not fit in an int
+            const char * token = p;
+            const char * slot_start = p;
+            for (const char * block = p; block < end; block += 64) {
+                const size_t n = (end - block < 64) ? end - block : 64;
+                uint64_t mask = delimiter_mask(block, n);
+                while (mask != 0) {
+                    const char * q = block + __builtin_ctzll(mask);
+                    mask &= mask - 1;
+                    const char c = *q;
+                    const char * e = (c == '\n' && q > token && q[-1] == '\r') ? q - 1 : q;
+                    if (e > token && slot < slot_size_ && slot_ids < slot_capicity_) {
+                        add_id(token, e, records, is_bad);
+                        ++slot_ids;
+                    }
+                    token = q + 1;
+                    if (c == ' ') {
+                        continue;
+                    }
+                    //';' or '\n' closes the slot if it is not empty
+                    if (e > slot_start) {
+                        if (slot < slot_size_) {
+                            records.offsets.push_back(records.ids.size());
+                        }
+                        ++slot;
+                    }
+                    slot_ids = 0;
+                    slot_start = token;
+                    if (c == '\n') {
+                        end_sample(records, first_offset, slot, is_bad);
+                        return token;
+                    }
+                }
+            }
+            //the last line has no '\n'
+            const char * e = (end > token && end[-1] == '\r') ? end - 1 : end;
+            if (e > token && slot < slot_size_ && slot_ids < slot_capicity_) {
+                add_id(token, e, records, is_bad);
+            }
+            if (e > slot_start) {
+                if (slot < slot_size_) {
+                    records.offsets.push_back(records.ids.size());
+                }
+                ++slot;
+            }
+            end_sample(records, first_offset, slot, is_bad);
+            return end;
+        }
+
+        /**
+         * append the id of [token, e), or flag the line if it does not fit
+         * in an int
+         */
+        void add_id(const char * token, const char * e, SlotRecords & records, bool & is_bad) {
+            int id = 0;
+            if (parse_int(token, e, id)) {
+                records.ids.push_back(id);
+            } else if (!is_bad) {
+                LOG_ERROR << "id " << std::string(token, e) << " of line " << line_index_ - 1
+                          << " does not fit in an int";
+                is_bad = true;
+            }
+        }
+
+        /**
+         * pad the sample to slot_size slots, or drop it if it has none or
+         * is bad
+         */
+        void end_sample(SlotRecords & records, size_t first_offset, size_t slot, bool is_bad) {
+            if (slot == 0 || is_bad) {
+                if (is_bad) {
+                    ++bad_lines_;
+                }
+                records.offsets.resize(first_offset);
+                records.ids.resize(records.offsets.back());
+                return;
+            }
+            for (; slot < slot_size_; ++slot) {
+                records.offsets.push_back(records.ids.size());
+            }
+        }
+
+    private:
+        size_t slot_size_;
+        size_t slot_capicity_;
+        size_t shard_id_;
+        size_t shard_num_;
+        size_t max_line_;
+        size_t line_index_;
+        size_t bad_lines_;
+};
+
+}  //namespace io
+}  //namespace snoopy
+
+#endif
@@ -6,6 +6,7 @@
 #ifndef SNOOPY_MATRIX_EXPR_INL_H
 #define SNOOPY_MATRIX_EXPR_INL_H
 
+#include <utility>
 #include "matrix.h"
 #include "matrix_shape.h"
 #include "../common/utils.h"
@@ -60,6 +61,76 @@ struct ShapeCheck<BinaryOp<Op, LeftExpr, RightExpr, DataType>, N> {
   }
 };
 
+template<typename LeftExpr, typename RightExpr, typename DataType, size_t N>
+struct ShapeCheck<DotExpr<LeftExpr, RightExpr, DataType>, N> {
+  inline static MatrixShape<N> check(
+      const DotExpr<LeftExpr, RightExpr, DataType> & e) {
+    static_assert(N == 2, "matrix product needs two-dimension matrix");
+    CHECK_EQ(e.get_inner(),
+             e.trans_right ? e.right.get_column() : e.right.get_row());
+    MatrixShape<N> s { e.get_row(), e.get_column() };
+    return s;
+  }
+};
+
+/**
+ * Check whether an operator defines packet_op for the packet type of DataType
+ */
+template<typename Op, typename DataType>
+struct PacketOpCheck {
+  typedef typename packet::Packet<DataType>::type P;
+
+  template<typename U>
+  static char single(decltype(U::packet_op(std::declval<P>())) *);
+  template<typename U>
+  static long single(...);
+
+  template<typename U>
+  static char binary(decltype(U::packet_op(std::declval<P>(),
+                                           std::declval<P>())) *);
+  template<typename U>
+  static long binary(...);
+
+  static const bool single_value = sizeof(single<Op>(0)) == sizeof(char);
+  static const bool binary_value = sizeof(binary<Op>(0)) == sizeof(char);
+};
+
+/**
+ * Check whether the expression can be evaluated with SIMD packets
+ *
+ * It is true when every leaf is a matrix or a scalar, every operator defines
+ * packet_op and the target supports packets wider than one element. It is
+ * resolved at compile time, so an expression with an unsupported operator
+ * just falls back to the scalar eval(i, j) loop.
+ */
+template<typename Expr>
+struct PacketCheck {
+  static const bool value = false;
+};
+
+template<typename DataType>
+struct PacketCheck<ScalarExp<DataType> > {
+  static const bool value = (packet::Packet<DataType>::size > 1);
+};
+
+template<typename DataType, size_t N>
+struct PacketCheck<Matrix<DataType, N> > {
+  static const bool value = (packet::Packet<DataType>::size > 1);
+};
+
+template<typename Op, typename Expr, typename DataType>
+struct PacketCheck<SingleOp<Op, Expr, DataType> > {
+  static const bool value = PacketCheck<Expr>::value
+      && PacketOpCheck<Op, DataType>::single_value;
+};
+
+template<typename Op, typename LeftExpr, typename RightExpr, typename DataType>
+struct PacketCheck<BinaryOp<Op, LeftExpr, RightExpr, DataType> > {
+  static const bool value = PacketCheck<LeftExpr>::value
+      && PacketCheck<RightExpr>::value
+      && PacketOpCheck<Op, DataType>::binary_value;
+};
+
 /**
  * template function for binary operator
  *
@@ -150,7 +221,7 @@ inline BinaryOp<op::div, LeftExpr, RightExpr, DataType> operator /(
 template<typename RightExpr, typename DataType>
 inline BinaryOp<op::add, ScalarExp<DataType>, RightExpr, DataType> operator +(
     const MATRIX_SCALAR_TYPE_ l, const ExprBase<RightExpr, DataType>& r) {
-  static ScalarExp<DataType> s = ScalarExp<DataType>(l);
+  ScalarExp<DataType> s = ScalarExp<DataType>(l);
   return binary_op<op::add, ScalarExp<DataType> >(s, r);
 }
 
@@ -164,7 +235,7 @@ inline BinaryOp<op::add, ScalarExp<DataType>, RightExpr, DataType> operator +(
 template<typename RightExpr, typename DataType>
 inline BinaryOp<op::sub, ScalarExp<DataType>, RightExpr, DataType> operator -(
     const MATRIX_SCALAR_TYPE_ l, const ExprBase<RightExpr, DataType>& r) {
-  static ScalarExp<DataType> s = ScalarExp<DataType>(l);
+  ScalarExp<DataType> s = ScalarExp<DataType>(l);
   return binary_op<op::sub, ScalarExp<DataType> >(s, r);
 }
 
@@ -178,7 +249,7 @@ inline BinaryOp<op::sub, ScalarExp<DataType>, RightExpr, DataType> operator -(
 template<typename RightExpr, typename DataType>
 inline BinaryOp<op::mul, ScalarExp<DataType>, RightExpr, DataType> operator *(
     const MATRIX_SCALAR_TYPE_ l, const ExprBase<RightExpr, DataType>& r) {
-  static ScalarExp<DataType> s = ScalarExp<DataType>(l);
+  ScalarExp<DataType> s = ScalarExp<DataType>(l);
   return binary_op<op::mul, ScalarExp<DataType> >(s, r);
 }
 
@@ -192,7 +263,7 @@ inline BinaryOp<op::mul, ScalarExp<DataType>, RightExpr, DataType> operator *(
 template<typename RightExpr, typename DataType>
 inline BinaryOp<op::div, ScalarExp<DataType>, RightExpr, DataType> operator /(
     const MATRIX_SCALAR_TYPE_ l, const ExprBase<RightExpr, DataType>& r) {
-  static ScalarExp<DataType> s = ScalarExp<DataType>(l);
+  ScalarExp<DataType> s = ScalarExp<DataType>(l);
   return binary_op<op::div, ScalarExp<DataType> >(s, r);
 }
 
@@ -206,7 +277,7 @@ inline BinaryOp<op::div, ScalarExp<DataType>, RightExpr, DataType> operator /(
 template<typename LeftExpr, typename DataType>
 inline BinaryOp<op::add, LeftExpr, ScalarExp<DataType>, DataType> operator +(
     const ExprBase<LeftExpr, DataType>& l, const MATRIX_SCALAR_TYPE_ r) {
-  static ScalarExp<DataType> s = ScalarExp<DataType>(r);
+  ScalarExp<DataType> s = ScalarExp<DataType>(r);
   return binary_op<op::add, LeftExpr, ScalarExp<DataType> >(l, s);
 }
 
@@ -220,7 +291,7 @@ inline BinaryOp<op::add, LeftExpr, ScalarExp<DataType>, DataType> operator +(
 template<typename LeftExpr, typename DataType>
 inline BinaryOp<op::sub, LeftExpr, ScalarExp<DataType>, DataType> operator -(
     const ExprBase<LeftExpr, DataType>& l, const MATRIX_SCALAR_TYPE_ r) {
-  static ScalarExp<DataType> s = ScalarExp<DataType>(r);
+  ScalarExp<DataType> s = ScalarExp<DataType>(r);
   return binary_op<op::sub, LeftExpr, ScalarExp<DataType> >(l, s);
 }
 
@@ -234,7 +305,7 @@ inline BinaryOp<op::sub, LeftExpr, ScalarExp<DataType>, DataType> operator -(
 template<typename LeftExpr, typename DataType>
 inline BinaryOp<op::mul, LeftExpr, ScalarExp<DataType>, DataType> operator *(
     const ExprBase<LeftExpr, DataType>& l, const MATRIX_SCALAR_TYPE_ r) {
-  static ScalarExp<DataType> s = ScalarExp<DataType>(r);
+  ScalarExp<DataType> s = ScalarExp<DataType>(r);
   return binary_op<op::mul, LeftExpr, ScalarExp<DataType> >(l, s);
 }
 
@@ -248,10 +319,25 @@ inline BinaryOp<op::mul, LeftExpr, ScalarExp<DataType>, DataType> operator *(
 template<typename LeftExpr, typename DataType>
 inline BinaryOp<op::div, LeftExpr, ScalarExp<DataType>, DataType> operator /(
     const ExprBase<LeftExpr, DataType>& l, const MATRIX_SCALAR_TYPE_ r) {
-  static ScalarExp<DataType> s = ScalarExp<DataType>(r);
+  ScalarExp<DataType> s = ScalarExp<DataType>(r);
   return binary_op<op::div, LeftExpr, ScalarExp<DataType> >(l, s);
 }
 
+/**
+ * fold the scalar of alpha * dot(a, b) into the product
+ */
+template<typename LeftExpr, typename RightExpr, typename DataType>
+inline DotExpr<LeftExpr, RightExpr, DataType> operator *(
+    const DataType l, const DotExpr<LeftExpr, RightExpr, DataType> & r) {
+  return DotExpr<LeftExpr, RightExpr, DataType>(r, l * r.scale);
+}
+
+template<typename LeftExpr, typename RightExpr, typename DataType>
+inline DotExpr<LeftExpr, RightExpr, DataType> operator *(
+    const DotExpr<LeftExpr, RightExpr, DataType> & l, const DataType r) {
+  return DotExpr<LeftExpr, RightExpr, DataType>(l, l.scale * r);
+}
+
 /**
  * template class for uninary operator
  *
@@ -16,6 +16,9 @@
 
 #ifndef SNOOPY_MATRIX_EXPR_H
 #define SNOOPY_MATRIX_EXPR_H
+
+#include "packet.h"
+
 namespace snoopy {
 namespace matrix {
 
@@ -32,12 +35,22 @@ namespace op {
  *   inline static DataType matrix_op(const DataType & , const DataType & );
  * For the single expression, the matrix_op is the following format:
  *   inline static DataType matrix_op(const DataType & );
+ * An operator may also define a static method called "packet_op" with the
+ * same arity which computes a whole SIMD packet at once:
+ *   template<typename Packet>
+ *   inline static Packet packet_op(const Packet & , const Packet & );
+ * Expressions whose operators all define packet_op are evaluated with the
+ * packet path, see PacketCheck in expr-inl.h.
  */
 struct add {
   template<typename DataType>
   inline static DataType matrix_op(const DataType & l, const DataType & r) {
     return l + r;
   }
+  template<typename Packet>
+  inline static Packet packet_op(const Packet & l, const Packet & r) {
+    return packet::add(l, r);
+  }
 };
 
 struct sub {
@@ -45,6 +58,10 @@ struct sub {
   inline static DataType matrix_op(const DataType & l, const DataType & r) {
     return l - r;
   }
+  template<typename Packet>
+  inline static Packet packet_op(const Packet & l, const Packet & r) {
+    return packet::sub(l, r);
+  }
 };
 
 struct mul {
@@ -52,6 +69,10 @@ struct mul {
   inline static DataType matrix_op(const DataType & l, const DataType & r) {
     return l * r;
   }
+  template<typename Packet>
+  inline static Packet packet_op(const Packet & l, const Packet & r) {
+    return packet::mul(l, r);
+  }
 };
 
 struct div {
@@ -59,6 +80,10 @@ struct div {
   inline static DataType matrix_op(const DataType & l, const DataType & r) {
     return l / r;
   }
+  template<typename Packet>
+  inline static Packet packet_op(const Packet & l, const Packet & r) {
+    return packet::div(l, r);
+  }
 };
 
 }  //namespace op
@@ -100,6 +125,26 @@ class ScalarExp : public ExprBase<ScalarExp<DataType>, DataType> {
   inline const DataType eval(size_t i, size_t j) const {
     return s_val;
   }
+  inline typename packet::Packet<DataType>::type packet(size_t i,
+                                                        size_t j) const {
+    return packet::Packet<DataType>::set1(s_val);
+  }
+};
+
+/**
+ * ExprRef decides how a sub expression is held by its parent expression
+ *
+ * Matrix and nested expressions are held by reference. A ScalarExp is
+ * created on the fly by the scalar operators, so it is held by value.
+ */
+template<typename Expr>
+struct ExprRef {
+  typedef const Expr & type;
+};
+
+template<typename DataType>
+struct ExprRef<ScalarExp<DataType> > {
+  typedef const ScalarExp<DataType> type;
 };
 
 /**
@@ -111,8 +156,8 @@ template<typename Op, typename LeftExpr, typename RightExpr, typename DataType>
 class BinaryOp : public ExprBase<BinaryOp<Op, LeftExpr, RightExpr, DataType>,
     DataType> {
  public:
-  const LeftExpr & left;
-  const RightExpr & right;
+  typename ExprRef<LeftExpr>::type left;
+  typename ExprRef<RightExpr>::type right;
   inline BinaryOp() {
   }
   ;
@@ -124,6 +169,10 @@ class BinaryOp : public ExprBase<BinaryOp<Op, LeftExpr, RightExpr, DataType>,
   inline DataType eval(size_t i, size_t j) const {
     return Op::matrix_op(left.eval(i, j), right.eval(i, j));
   }
+  inline typename packet::Packet<DataType>::type packet(size_t i,
+                                                        size_t j) const {
+    return Op::packet_op(left.packet(i, j), right.packet(i, j));
+  }
 
 };
 
@@ -135,7 +184,7 @@ class BinaryOp : public ExprBase<BinaryOp<Op, LeftExpr, RightExpr, DataType>,
 template<typename Op, typename Expr, typename DataType>
 class SingleOp : public ExprBase<SingleOp<Op, Expr, DataType>, DataType> {
  public:
-  const Expr & left;
+  typename ExprRef<Expr>::type left;
   inline SingleOp() {
   }
   ;
@@ -146,9 +195,77 @@ class SingleOp : public ExprBase<SingleOp<Op, Expr, DataType>, DataType> {
   inline DataType eval(size_t i, size_t j) const {
     return Op::matrix_op(left.eval(i, j));
   }
+  inline typename packet::Packet<DataType>::type packet(size_t i,
+                                                        size_t j) const {
+    return Op::packet_op(left.packet(i, j));
+  }
 
 };
 
+/**
+ * Matrix product expression
+ *
+ * dot(a, b) does not compute anything by itself. The product is written
+ * straight into the destination when the expression is assigned, so
+ *   c = dot(a, b);  c += alpha * dot(a, b);
+ * are each a single gemm call without a temporary, with the scale folded
+ * into alpha and += mapped to beta = 1. Inside a larger element-wise
+ * expression eval(i, j) falls back to the inner product of row i and
+ * column j.
+ */
+template<typename LeftExpr, typename RightExpr, typename DataType>
+class DotExpr : public ExprBase<DotExpr<LeftExpr, RightExpr, DataType>,
+    DataType> {
+ public:
+  const LeftExpr & left;
+  const RightExpr & right;
+  const bool trans_left;
+  const bool trans_right;
+  const DataType scale;
+  const bool is_blas;
+  inline DotExpr(const LeftExpr & l, bool tl, const RightExpr & r, bool tr,
+                 const DataType & alpha, bool blas)
+      : left(l),
+        right(r),
+        trans_left(tl),
+        trans_right(tr),
+        scale(alpha),
+        is_blas(blas) {
+  }
+  ;
+  inline DotExpr(const DotExpr & e, const DataType & alpha)
+      : left(e.left),
+        right(e.right),
+        trans_left(e.trans_left),
+        trans_right(e.trans_right),
+        scale(alpha),
+        is_blas(e.is_blas) {
+  }
+  ;
+  inline size_t get_row() const {
+    return trans_left ? left.get_column() : left.get_row();
+  }
+  inline size_t get_column() const {
+    return trans_right ? right.get_row() : right.get_column();
+  }
+  inline size_t get_inner() const {
+    return trans_left ? left.get_row() : left.get_column();
+  }
+  inline DataType eval(size_t i, size_t j) const {
+    DataType acc = 0;
+    for (size_t p = 0; p < get_inner(); ++p) {
+      acc += (trans_left ? left.eval(p, i) : left.eval(i, p))
+          * (trans_right ? right.eval(j, p) : right.eval(p, j));
+    }
+    return scale * acc;
+  }
+  /**
+   * dst = op(left) * op(right) * scale + beta * dst, see matrix_math.h
+   */
+  template<typename Dst>
+  inline void eval_to(Dst & dst, const DataType beta) const;
+};
+
 }  //namespace matrix
 
 } //namespace snoopy
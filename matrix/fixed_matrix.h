@@ -0,0 +1,236 @@
+/**
+ *  A matrix whose shape is known at compile time
+ *
+ *  FixedMatrix<DataType, Rows, Cols> keeps its elements inline (no buffer,
+ *  no reference count) and all its loop bounds are template parameters, so
+ *  the compiler can fully unroll and vectorize the kernels on small
+ *  matrices such as an embedding row, a bias vector or a tiny FC head.
+ *
+ *  It is a leaf of the expression templates and mixes with Matrix and
+ *  MatrixView:
+ *      FixedMatrix<float, 1, 16> bias(0.f);
+ *      Matrix<float, 2> emb {...};            // 1 x 16
+ *      bias = bias + emb * 0.5f;              // fixed = fixed + dynamic
+ *      Matrix<float, 2> out(s);
+ *      out = emb + bias;                      // dynamic = dynamic + fixed
+ *  The shapes of a mixed expression are still checked at run time.
+ */
+
+#ifndef SNOOPY_MATRIX_FIXED_MATRIX_H_
+#define SNOOPY_MATRIX_FIXED_MATRIX_H_
+
+#include <algorithm>
+#include "matrix.h"
+
+namespace snoopy {
+namespace matrix {
+
+template<typename DataType, size_t Rows, size_t Cols>
+class FixedMatrix : public ExprBase<FixedMatrix<DataType, Rows, Cols>,
+    DataType> {
+ public:
+  static const size_t kRows = Rows;
+  static const size_t kCols = Cols;
+  static const size_t kSize = Rows * Cols;
+
+  /**
+   * default constructor, the elements are uninitialized
+   */
+  FixedMatrix() {
+  }
+
+  /**
+   * constructor filling every element with v
+   */
+  explicit FixedMatrix(const DataType & v) {
+    std::fill(base, base + kSize, v);
+  }
+
+  /**
+   * constructor with matrix_initializer_list, for example
+   *   FixedMatrix<float, 2, 2> m {{1, 2}, {3, 4}};
+   */
+  FixedMatrix(matrix_initializer_list<DataType, 2> t) {
+    CHECK_EQ(t.size(), Rows);
+    size_t i = 0;
+    for (auto r = t.begin(); r != t.end(); ++r, ++i) {
+      CHECK_EQ(r->size(), Cols);
+      std::copy(r->begin(), r->end(), base + i * Cols);
+    }
+  }
+
+  template<typename SubType>
+  explicit FixedMatrix(const ExprBase<SubType, DataType> & e) {
+    *this = e;
+  }
+
+  /**
+   * evaluate an expression into this matrix, the loops have constant trip
+   * counts so they are unrolled for small shapes
+   */
+  template<typename SubType>
+  inline FixedMatrix & operator=(const ExprBase<SubType, DataType> & e) {
+    const SubType & sub = e.self();
+    MatrixShape<2> s = ShapeCheck<SubType, 2>::check(sub);
+    check_shape(s.shape[0] == 0 || (s.shape[0] == Rows && s.shape[1] == Cols),
+                "Mismatch matrix shape.");
+    FixedEngine<PacketCheck<SubType>::value>::eval(base, sub);
+    return *this;
+  }
+
+  inline FixedMatrix & operator=(const DataType & v) {
+    std::fill(base, base + kSize, v);
+    return *this;
+  }
+
+  template<typename SubType>
+  inline FixedMatrix & operator+=(const ExprBase<SubType, DataType> & e) {
+    return *this = *this + e.self();
+  }
+  template<typename SubType>
+  inline FixedMatrix & operator-=(const ExprBase<SubType, DataType> & e) {
+    return *this = *this - e.self();
+  }
+  template<typename SubType>
+  inline FixedMatrix & operator*=(const ExprBase<SubType, DataType> & e) {
+    return *this = *this * e.self();
+  }
+  inline FixedMatrix & operator*=(const DataType & v) {
+    for (size_t i = 0; i < kSize; ++i) {
+      base[i] *= v;
+    }
+    return *this;
+  }
+
+  /**
+   * copy the elements of a matrix or a view with the same size
+   */
+  template<typename T>
+  inline void copy_from(const T & s) {
+    CHECK_EQ(static_cast<size_t>(s.get_row() * s.get_column()), kSize);
+    convert(base, s.raw_data(), kSize);
+  }
+
+  /**
+   * copy the elements to a matrix or a view with the same size
+   */
+  template<typename T>
+  inline void copy_to(const T & t) const {
+    CHECK_EQ(static_cast<size_t>(t.get_row() * t.get_column()), kSize);
+    convert(t.raw_data(), base, kSize);
+  }
+
+  inline void clear_data() {
+    std::fill(base, base + kSize, 0);
+  }
+
+  inline DataType eval(size_t i, size_t j) const {
+    return base[i * Cols + j];
+  }
+
+  inline typename packet::Packet<DataType>::type packet(size_t i,
+                                                        size_t j) const {
+    return packet::Packet<DataType>::load(base + i * Cols + j);
+  }
+
+  inline DataType & at(size_t i, size_t j) { return base[i * Cols + j]; }
+  inline const DataType & at(size_t i, size_t j) const {
+    return base[i * Cols + j];
+  }
+  inline DataType * operator[](size_t i) { return base + i * Cols; }
+  inline const DataType * operator[](size_t i) const { return base + i * Cols; }
+  inline DataType * raw_data() { return base; }
+  inline const DataType * raw_data() const { return base; }
+  inline DataType * row_ptr(size_t i) { return base + i * Cols; }
+  inline const DataType * row_ptr(size_t i) const { return base + i * Cols; }
+  inline MatrixShape<2> get_shape() const { return MatrixShape<2> { Rows, Cols }; }
+  inline constexpr size_t get_row() const { return Rows; }
+  inline constexpr size_t get_column() const { return Cols; }
+  inline constexpr size_t get_stride() const { return Cols; }
+  inline constexpr size_t get_size() const { return kSize; }
+
+ private:
+  /**
+   * the scalar engine, and the packet engine used when every leaf of the
+   * expression supports packets; the tail of a row that does not fill a
+   * packet is resolved at compile time
+   */
+  template<bool is_packet, typename Dummy = void>
+  struct FixedEngine {
+    template<typename SubType>
+    inline static void eval(DataType * dst, const SubType & sub) {
+      for (size_t i = 0; i < Rows; ++i) {
+        for (size_t j = 0; j < Cols; ++j) {
+          dst[i * Cols + j] = sub.eval(i, j);
+        }
+      }
+    }
+  };
+
+  template<typename Dummy>
+  struct FixedEngine<true, Dummy> {
+    template<typename SubType>
+    inline static void eval(DataType * dst, const SubType & sub) {
+      typedef packet::Packet<DataType> P;
+      const size_t packet_end = Cols - Cols % P::size;
+      for (size_t i = 0; i < Rows; ++i) {
+        for (size_t j = 0; j < packet_end; j += P::size) {
+          P::store(dst + i * Cols + j, sub.packet(i, j));
+        }
+        for (size_t j = packet_end; j < Cols; ++j) {
+          dst[i * Cols + j] = sub.eval(i, j);
+        }
+      }
+    }
+  };
+
+  alignas(64) DataType base[Rows * Cols];
+};
+
+template<typename DataType, size_t Rows, size_t Cols>
+struct ShapeCheck<FixedMatrix<DataType, Rows, Cols>, 2> {
+  inline static MatrixShape<2> check(
+      const FixedMatrix<DataType, Rows, Cols> & e) {
+    return e.get_shape();
+  }
+};
+
+template<typename DataType, size_t Rows, size_t Cols>
+struct PacketCheck<FixedMatrix<DataType, Rows, Cols> > {
+  static const bool value = (packet::Packet<DataType>::size > 1);
+};
+
+template<typename DataType, size_t Rows, size_t Cols>
+inline bool operator==(const FixedMatrix<DataType, Rows, Cols> & m1,
+                       const FixedMatrix<DataType, Rows, Cols> & m2) {
+  for (size_t i = 0; i < Rows * Cols; ++i) {
+    if (!float_equal(m1.raw_data()[i], m2.raw_data()[i]))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * matrix product of two fixed matrices, the result shape is known at
+ * compile time so it is computed directly without blas
+ */
+template<typename DataType, size_t Rows, size_t Inner, size_t Cols>
+inline FixedMatrix<DataType, Rows, Cols> dot(
+    const FixedMatrix<DataType, Rows, Inner> & m1,
+    const FixedMatrix<DataType, Inner, Cols> & m2) {
+  FixedMatrix<DataType, Rows, Cols> r(DataType(0));
+  for (size_t i = 0; i < Rows; ++i) {
+    for (size_t k = 0; k < Inner; ++k) {
+      const DataType a = m1.at(i, k);
+      for (size_t j = 0; j < Cols; ++j) {
+        r.at(i, j) += a * m2.at(k, j);
+      }
+    }
+  }
+  return r;
+}
+
+}  //namespace matrix
+}  //namespace snoopy
+
+#endif /* SNOOPY_MATRIX_FIXED_MATRIX_H_ */
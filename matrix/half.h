@@ -0,0 +1,272 @@
+/**
+ *  \file half.h
+ *  \brief 16-bit floating point storage types: fp16 (IEEE binary16) and
+ *         bf16 (the upper half of a float).
+ *
+ *  They are storage types: every arithmetic goes through float, so a
+ *  Matrix<fp16, 2> or Matrix<bf16, 2> halves the memory of a table
+ *  while the kernels in matrix_math.h accumulate in float (see AccumType).
+ *
+ *  convert(dst, src, n) converts arrays between float and the 16-bit types.
+ *  It uses F16C for fp16 and AVX-512 BF16 for float -> bf16 when the
+ *  target has them, and a bit-exact software path (round to nearest even)
+ *  otherwise.
+ *
+ *  Example:
+ *    Matrix<fp16, 2> table(s);
+ *    table[i].copy_from(float_row);     // float -> fp16
+ *    out[j].copy_from(table[i]);        // fp16 -> float
+ */
+
+#ifndef SNOOPY_MATRIX_HALF_H_
+#define SNOOPY_MATRIX_HALF_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#if defined(__F16C__) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace snoopy {
+namespace matrix {
+
+namespace half_impl {
+
+inline uint32_t float_bits(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  return x;
+}
+
+inline float bits_float(uint32_t x) {
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+/**
+ * float -> binary16, round to nearest even, overflow goes to inf
+ */
+inline uint16_t float_to_half(float f) {
+#if defined(__F16C__)
+  return _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+  const uint32_t x = float_bits(f);
+  const uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t mant = x & 0x7fffff;
+  const int32_t exp = (x >> 23) & 0xff;
+  if (exp == 0xff) {
+    return sign | 0x7c00 | (mant ? 0x200 : 0);
+  }
+  const int32_t e = exp - 127 + 15;
+  if (e >= 0x1f) {
+    return sign | 0x7c00;
+  }
+  if (e <= 0) {
+    //subnormal half
+    if (e < -10) {
+      return sign;
+    }
+    mant |= 0x800000;
+    const uint32_t shift = 14 - e;
+    uint32_t h = mant >> shift;
+    const uint32_t rem = mant & ((1u << shift) - 1);
+    const uint32_t mid = 1u << (shift - 1);
+    if (rem > mid || (rem == mid && (h & 1))) {
+      ++h;
+    }
+    return sign | h;
+  }
+  uint32_t h = (e << 10) | (mant >> 13);
+  const uint32_t rem = mant & 0x1fff;
+  if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) {
+    ++h;  //a carry into the exponent is the correct rounding
+  }
+  return sign | h;
+#endif
+}
+
+inline float half_to_float(uint16_t h) {
+#if defined(__F16C__)
+  return _cvtsh_ss(h);
+#else
+  const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  if (exp == 0) {
+    if (mant == 0) {
+      return bits_float(sign);
+    }
+    //subnormal half, normalize it
+    exp = 127 - 15 + 1;
+    while (!(mant & 0x400)) {
+      mant <<= 1;
+      --exp;
+    }
+    mant &= 0x3ff;
+    return bits_float(sign | (exp << 23) | (mant << 13));
+  }
+  if (exp == 0x1f) {
+    return bits_float(sign | 0x7f800000 | (mant << 13));
+  }
+  return bits_float(sign | ((exp - 15 + 127) << 23) | (mant << 13));
+#endif
+}
+
+/**
+ * float -> bf16, round to nearest even, NaN stays a quiet NaN
+ */
+inline uint16_t float_to_bf16(float f) {
+  uint32_t x = float_bits(f);
+  if ((x & 0x7fffffff) > 0x7f800000) {
+    return (x >> 16) | 0x40;
+  }
+  x += 0x7fff + ((x >> 16) & 1);
+  return x >> 16;
+}
+
+inline float bf16_to_float(uint16_t b) {
+  return bits_float(static_cast<uint32_t>(b) << 16);
+}
+
+}  //namespace half_impl
+
+/**
+ * IEEE 754 binary16 storage type
+ */
+struct fp16 {
+  uint16_t x;
+  fp16() {
+  }
+  fp16(float f)
+      : x(half_impl::float_to_half(f)) {
+  }
+  operator float() const {
+    return half_impl::half_to_float(x);
+  }
+  fp16 & operator+=(float f) { return *this = float(*this) + f; }
+  fp16 & operator-=(float f) { return *this = float(*this) - f; }
+  fp16 & operator*=(float f) { return *this = float(*this) * f; }
+  fp16 & operator/=(float f) { return *this = float(*this) / f; }
+};
+
+/**
+ * brain floating point storage type, the upper 16 bits of a float
+ */
+struct bf16 {
+  uint16_t x;
+  bf16() {
+  }
+  bf16(float f)
+      : x(half_impl::float_to_bf16(f)) {
+  }
+  operator float() const {
+    return half_impl::bf16_to_float(x);
+  }
+  bf16 & operator+=(float f) { return *this = float(*this) + f; }
+  bf16 & operator-=(float f) { return *this = float(*this) - f; }
+  bf16 & operator*=(float f) { return *this = float(*this) * f; }
+  bf16 & operator/=(float f) { return *this = float(*this) / f; }
+};
+
+/**
+ * the type kernels accumulate in for a storage type
+ */
+template<typename DataType>
+struct AccumType {
+  typedef DataType type;
+};
+
+template<>
+struct AccumType<fp16> {
+  typedef float type;
+};
+
+template<>
+struct AccumType<bf16> {
+  typedef float type;
+};
+
+template<typename DataType>
+struct is_low_precision {
+  static const bool value = false;
+};
+
+template<>
+struct is_low_precision<fp16> {
+  static const bool value = true;
+};
+
+template<>
+struct is_low_precision<bf16> {
+  static const bool value = true;
+};
+
+/**
+ * convert n elements from src to dst
+ */
+template<typename Dst, typename Src>
+inline void convert(Dst * dst, const Src * src, size_t n) {
+  std::copy(src, src + n, dst);
+}
+
+inline void convert(float * dst, const fp16 * src, size_t n) {
+  size_t i = 0;
+#if defined(__F16C__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+  }
+#endif
+  for (; i < n; ++i) {
+    dst[i] = src[i];
+  }
+}
+
+inline void convert(fp16 * dst, const float * src, size_t n) {
+  size_t i = 0;
+#if defined(__F16C__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+                                _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), h);
+  }
+#endif
+  for (; i < n; ++i) {
+    dst[i] = src[i];
+  }
+}
+
+inline void convert(float * dst, const bf16 * src, size_t n) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    __m256i w = _mm256_slli_epi32(_mm256_cvtepu16_epi32(b), 16);
+    _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(w));
+  }
+#endif
+  for (; i < n; ++i) {
+    dst[i] = src[i];
+  }
+}
+
+inline void convert(bf16 * dst, const float * src, size_t n) {
+  size_t i = 0;
+#if defined(__AVX512BF16__)
+  for (; i + 16 <= n; i += 16) {
+    __m256bh b = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), (__m256i) b);
+  }
+#endif
+  for (; i < n; ++i) {
+    dst[i] = src[i];
+  }
+}
+
+}  //namespace matrix
+}  //namespace snoopy
+
+#endif /* SNOOPY_MATRIX_HALF_H_ */
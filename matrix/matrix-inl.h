@@ -13,6 +13,7 @@ inline Matrix<DataType, N>::Matrix(storage::Allocator * a,
       stride(s[N - 1]),
       capicity(get_length(s, s[N - 1])),
       data(new storage::Buffer<DataType>(a, capicity)){
+  base = data->data();
   row = 1;
   for (int i = 0; i < N - 1; ++i) {
     row *= shape[i];
@@ -25,10 +26,8 @@ inline Matrix<DataType, N>::Matrix(const MatrixShape<N> &s)
     : shape(s),
       stride(s[N - 1]),
       capicity(get_length(s, s[N - 1])),
-      data(new storage::Buffer<DataType>(new storage::CPUallocator, capicity)){
-  if (data != nullptr) {
-    data->ref();
-  }
+      data(new storage::Buffer<DataType>(storage::default_allocator(), capicity)){
+  base = data->data();
   row = 1;
   for (int i = 0; i < N - 1; ++i) {
     row *= shape[i];
@@ -46,6 +45,7 @@ inline Matrix<DataType, N>::Matrix(storage::TensorBuffer<DataType> * a, const Ma
   if (data != nullptr) {
      data->ref(); 
   }
+  base = (data != nullptr) ? data->data() : nullptr;
   row = 1;
   for (int i = 0; i < N - 1; ++i) {
     row *= shape[i];
@@ -61,9 +61,7 @@ inline Matrix<DataType, N>::Matrix(storage::Allocator * a,
       stride(st),
       capicity(get_length(s, s[N - 1])),
       data(new storage::Buffer<DataType>(a, capicity)){
-  if (data != nullptr) {
-    data->ref();
-  }
+  base = data->data();
   row = 1;
   for (int i = 0; i < N - 1; ++i) {
     row *= shape[i];
@@ -73,15 +71,13 @@ inline Matrix<DataType, N>::Matrix(storage::Allocator * a,
 
 template<typename DataType, size_t N>
 inline Matrix<DataType, N>::Matrix(const Matrix<DataType, N> &m) {
-    if (data != nullptr) {
-        data->unref();
-    }
     shape = m.get_shape();
     stride = m.get_stride();
     capicity = get_length(m.get_shape(), m.get_stride());
     row = m.row;
     column = m.column;
     data = m.get_data();
+    base = m.raw_data();
     if (data != nullptr) {
         data->ref();
     }
@@ -91,7 +87,11 @@ template<typename DataType, size_t N>
 inline Matrix<DataType, N> & Matrix<DataType, N>::operator =(
     const Matrix<DataType, N> &m) {
   if (this != &m) {
-    //free existing resource
+    //take the new reference before the old one is released, both may
+    //point into the same root buffer
+    if (m.data != nullptr) {
+        m.data->ref();
+    }
     if (data != nullptr) {
         data->unref();
     }
@@ -100,10 +100,8 @@ inline Matrix<DataType, N> & Matrix<DataType, N>::operator =(
     capicity = get_length(m.get_shape(), m.get_stride());
     row = m.row;
     column = m.column;
-    data = m.get_data();
-    if (data != nullptr) {
-        data->ref();
-    }
+    data = m.data;
+    base = m.base;
   }
   return *this;
 }
@@ -115,37 +113,30 @@ inline Matrix<DataType, N>::Matrix(Matrix<DataType, N> &&m) {
     capicity = get_length(m.get_shape(), m.get_stride());
     row = m.row;
     column = m.column;
-    data = m.get_data();
-    if (data != nullptr) {
-        data->ref();
-    }
-    //copy data
-    if (m.get_data() != nullptr) {
-        m.get_data()->unref();
-    }
-    auto m_data_ptr = m.get_data();
-    m_data_ptr = nullptr;
+    //steal the reference, no atomic operation
+    data = m.data;
+    base = m.base;
+    m.data = nullptr;
+    m.base = nullptr;
 }
 
 template<typename DataType, size_t N>
 inline Matrix<DataType, N> & Matrix<DataType, N>::operator =(
     Matrix<DataType, N> &&m) {
   if (this != &m) {
+    if (data != nullptr) {
+        data->unref();
+    }
     shape = m.get_shape();
     stride = m.get_stride();
     capicity = get_length(m.get_shape(), m.get_stride());
     row = m.row;
     column = m.column;
-    //copy data
-    data = m.get_data();
-    if (data != nullptr) {
-        data->ref();
-    }
-    if (m.get_data() != nullptr) {
-        m.get_data()->unref();
-    }
-    auto m_data_ptr = m.get_data();
-    m_data_ptr = nullptr;
+    //steal the reference, no atomic operation
+    data = m.data;
+    base = m.base;
+    m.data = nullptr;
+    m.base = nullptr;
   }
   return *this;
 }
@@ -179,37 +170,10 @@ inline size_t Matrix<DataType, N>::get_length(const MatrixShape<N> &s,
 }
 
 template<typename DataType, size_t N>
-inline Matrix<DataType, N - 1> Matrix<DataType, N>::operator[](
+inline MatrixView<DataType, N - 1> Matrix<DataType, N>::operator[](
     size_t i) const {
-    Matrix<DataType, N-1> sub_matrix;
-    sub_matrix.set_shape(shape.subShape());
-    sub_matrix.set_stride(shape[N - 1]);
-    sub_matrix.set_capicity(sub_matrix.get_length(sub_matrix.get_shape(), sub_matrix.get_stride()));
-    sub_matrix.set_data(new storage::SubBuffer<DataType>(data, i * shape.stride[0]));
-    size_t row = 1;
-    for (int i = 0; i < N - 1; ++i) {
-    row *= shape[i];
-    }
-    sub_matrix.set_row(row);
-    sub_matrix.set_column(sub_matrix.get_shape()[N - 2]);
-    return sub_matrix;
-}
-
-template<typename DataType, size_t N>
-inline Matrix<DataType, N - 1> Matrix<DataType, N>::operator[](
-    size_t i)  {
-    Matrix<DataType, N-1> sub_matrix;
-    sub_matrix.set_shape(shape.subShape());
-    sub_matrix.set_stride(shape[N - 1]);
-    sub_matrix.set_capicity(sub_matrix.get_length(sub_matrix.get_shape(), sub_matrix.get_stride()));
-    sub_matrix.set_data(new storage::SubBuffer<DataType>(data, i * shape.stride[0]));
-    size_t row = 1;
-    for (int i = 0; i < N - 1; ++i) {
-    row *= sub_matrix.get_shape()[i];
-    }
-    sub_matrix.set_row(row);
-    sub_matrix.set_column(sub_matrix.get_shape()[N - 2]);
-    return sub_matrix;
+    return MatrixView<DataType, N - 1>(base + i * shape.stride[0],
+                                       shape.subShape());
 }
 
 template<typename DataType, size_t N>
@@ -256,7 +220,7 @@ inline Matrix<DataType, N> & Matrix<DataType, N>::operator +=(
     const DataType & n) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      data->at(i * stride + j) += n;
+      at(i, j) += n;
     }
   }
   return *this;
@@ -267,7 +231,7 @@ inline Matrix<DataType, N> & Matrix<DataType, N>::operator -=(
     const DataType & n) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      data->at(i * stride + j) -= n;
+      at(i, j) -= n;
     }
   }
   return *this;
@@ -278,7 +242,7 @@ inline Matrix<DataType, N> & Matrix<DataType, N>::operator *=(
     const DataType & n) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      data->at(i * stride + j) *= n;
+      at(i, j) *= n;
     }
   }
   return *this;
@@ -289,7 +253,7 @@ inline Matrix<DataType, N> & Matrix<DataType, N>::operator /=(
     const DataType & n) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      data->at(i * stride + j) /= n;
+      at(i, j) /= n;
     }
   }
   return *this;
@@ -300,8 +264,7 @@ inline Matrix<DataType, N> & Matrix<DataType, N>::operator +=(
     const Matrix<DataType, N> & t) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      size_t offset = i * stride + j;
-      data->at(offset) += t.get_data()->at(offset);
+      at(i, j) += t.at(i, j);
     }
   }
   return *this;
@@ -312,8 +275,7 @@ inline Matrix<DataType, N> & Matrix<DataType, N>::operator -=(
     const Matrix<DataType, N> & t) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      size_t offset = i * stride + j;
-      data->at(offset) -= t.get_data()->at(offset);
+      at(i, j) -= t.at(i, j);
     }
   }
   return *this;
@@ -324,8 +286,7 @@ inline Matrix<DataType, N> & Matrix<DataType, N>::operator *=(
     const Matrix<DataType, N> & t) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      size_t offset = i * stride + j;
-      data->at(offset) *= t.get_data()->at(offset);
+      at(i, j) *= t.at(i, j);
     }
   }
   return *this;
@@ -336,8 +297,7 @@ inline Matrix<DataType, N>& Matrix<DataType, N>::operator /=(
     const Matrix<DataType, N> & t) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      size_t offset = i * stride + j;
-      data->at(offset) /= t.get_data()->at(offset);
+      at(i, j) /= t.at(i, j);
     }
   }
   return *this;
@@ -345,7 +305,13 @@ inline Matrix<DataType, N>& Matrix<DataType, N>::operator /=(
 
 template<typename DataType, size_t N>
 inline DataType Matrix<DataType, N>::eval(size_t i, size_t j) const {
-  return data->at(i * stride + j);
+  return base[i * stride + j];
+}
+
+template<typename DataType, size_t N>
+inline typename packet::Packet<DataType>::type Matrix<DataType, N>::packet(
+    size_t i, size_t j) const {
+  return packet::Packet<DataType>::load(base + i * stride + j);
 }
 
 template<typename DataType, size_t N>
@@ -356,7 +322,7 @@ inline void Matrix<DataType, N>::set_row_ele(int i,
   if (row_s == 1) {
     if (column == col_s) {
       for (int j = 0; j < column; ++j) {
-        data->at(i * stride + j) = s[0][j];
+        at(i, j) = s.at(0, j);
       }
     } else {
       //std::cerr << "Set Row: Shape not match!" << std::endl;
@@ -368,17 +334,89 @@ inline void Matrix<DataType, N>::set_row_ele(int i,
   }
 }
 
+/**
+ * Evaluate an expression into the destination memory row by row
+ *
+ * The scalar engine calls eval(i, j) for every element. The packet engine
+ * calls packet(i, j) for Packet<DataType>::size elements per step and
+ * finishes every row with a scalar tail loop, so the row length need not be
+ * a multiple of the packet size. The engine is selected by PacketCheck.
+ */
+template<bool is_packet>
+struct ExprEngine {
+  template<typename DataType, typename SubType>
+  inline static void eval(DataType * dst, size_t row, size_t column,
+                          size_t stride, const SubType & sub) {
+    for (size_t i = 0; i < row; ++i) {
+      DataType * dst_row = dst + i * stride;
+      for (size_t j = 0; j < column; ++j) {
+        dst_row[j] = sub.eval(i, j);
+      }
+    }
+  }
+};
+
+template<>
+struct ExprEngine<true> {
+  template<typename DataType, typename SubType>
+  inline static void eval(DataType * dst, size_t row, size_t column,
+                          size_t stride, const SubType & sub) {
+    typedef packet::Packet<DataType> P;
+    const size_t packet_end = column - column % P::size;
+    for (size_t i = 0; i < row; ++i) {
+      DataType * dst_row = dst + i * stride;
+      size_t j = 0;
+      for (; j < packet_end; j += P::size) {
+        P::store(dst_row + j, sub.packet(i, j));
+      }
+      for (; j < column; ++j) {
+        dst_row[j] = sub.eval(i, j);
+      }
+    }
+  }
+};
+
 template<typename DataType, size_t N>
 template<typename SubType>
 inline Matrix<DataType, N>& Matrix<DataType, N>::operator=(
     const ExprBase<SubType, DataType> &e) {
   const SubType & sub = e.self();
   ShapeCheck<SubType, N>::check(sub);
-  for (size_t i = 0; i < row; ++i) {
-    for (size_t j = 0; j < column; ++j) {
-      data->at(i * stride + j) = sub.eval(i, j);
-    }
-  }
+  ExprEngine<PacketCheck<SubType>::value>::eval(base, row, column, stride,
+                                                sub);
+  return *this;
+}
+
+template<typename DataType, size_t N>
+template<typename LeftExpr, typename RightExpr>
+inline Matrix<DataType, N>::Matrix(
+    const DotExpr<LeftExpr, RightExpr, DataType> &e)
+    : Matrix(ShapeCheck<DotExpr<LeftExpr, RightExpr, DataType>, N>::check(e)) {
+  e.eval_to(*this, DataType(0));
+}
+
+template<typename DataType, size_t N>
+template<typename LeftExpr, typename RightExpr>
+inline Matrix<DataType, N>& Matrix<DataType, N>::operator=(
+    const DotExpr<LeftExpr, RightExpr, DataType> &e) {
+  e.eval_to(*this, DataType(0));
+  return *this;
+}
+
+template<typename DataType, size_t N>
+template<typename LeftExpr, typename RightExpr>
+inline Matrix<DataType, N>& Matrix<DataType, N>::operator+=(
+    const DotExpr<LeftExpr, RightExpr, DataType> &e) {
+  e.eval_to(*this, DataType(1));
+  return *this;
+}
+
+template<typename DataType, size_t N>
+template<typename LeftExpr, typename RightExpr>
+inline Matrix<DataType, N>& Matrix<DataType, N>::operator-=(
+    const DotExpr<LeftExpr, RightExpr, DataType> &e) {
+  DotExpr<LeftExpr, RightExpr, DataType>(e, -e.scale).eval_to(*this,
+                                                              DataType(1));
   return *this;
 }
 
@@ -445,7 +483,8 @@ inline Matrix<DataType, N>::Matrix(matrix_initializer_list<DataType, N> t) {
   //shape = s;
   stride = shape[N - 1];
   capicity = get_capicity();
-  data = new storage::Buffer<DataType>(new storage::CPUallocator, capicity);
+  data = new storage::Buffer<DataType>(storage::default_allocator(), capicity);
+  base = data->data();
   row = 1;
   for (int i = 0; i < N - 1; ++i) {
     row *= shape[i];
@@ -458,11 +497,15 @@ inline Matrix<DataType, N>::Matrix(matrix_initializer_list<DataType, N> t) {
 template<typename DataType, size_t N>
 inline Matrix<DataType, N> & Matrix<DataType, N>::operator =(
     matrix_initializer_list<DataType, N> t) {
+  if (data != nullptr) {
+    data->unref();
+  }
   init_shape(t, shape);
   //shape = s;
   stride = shape[N - 1];
   capicity = get_capicity();
-  data = new storage::Buffer<DataType>(new storage::CPUallocator, capicity);
+  data = new storage::Buffer<DataType>(storage::default_allocator(), capicity);
+  base = data->data();
   row = 1;
   for (int i = 0; i < N - 1; ++i) {
     row *= shape[i];
@@ -481,12 +524,12 @@ inline void Matrix<DataType,N>::copy_from(const Matrix<DataType, N> &s) {
     stride = s.get_stride();
     row = s.get_row();
     column = s.get_column();
-    std::copy(s.get_data()->data(), s.get_data()->data() + s.get_size(), data->data());
+    std::copy(s.raw_data(), s.raw_data() + s.get_size(), base);
 }
 
 template <typename DataType, size_t N>
 inline void Matrix<DataType,N>::clear_data() {
-    std::fill(data->data(), data->data() + capicity, 0);
+    std::fill(base, base + capicity, 0);
 }
 
 template <typename DataType>
@@ -496,12 +539,12 @@ inline void Matrix<DataType,1>::copy_from(const Matrix<DataType, 1> &s) {
     stride = s.get_stride();
     row = s.get_row();
     column = s.get_column();
-    std::copy(s.get_data()->data(), s.get_data()->data() + s.get_size(), data->data());
+    std::copy(s.raw_data(), s.raw_data() + s.get_size(), base);
 }
 
 template <typename DataType>
 inline void Matrix<DataType,1>::clear_data() {
-    std::fill(data->data(), data->data() + capicity, 0);
+    std::fill(base, base + capicity, 0);
 }
 
 
@@ -513,12 +556,10 @@ inline Matrix<DataType, 1>::Matrix(storage::Allocator * a,
     : shape(s),
       stride(s[0]),
       capicity(get_length(s, s[0])),
-      data(new DataType[capicity]),
+      data(new storage::Buffer<DataType>(a, capicity)),
       row(1),
       column(shape[0]) {
-  if (data != nullptr) {
-    data->ref();
-  }
+  base = data->data();
 }
 
 template<typename DataType>
@@ -528,12 +569,10 @@ inline Matrix<DataType, 1>::Matrix(storage::Allocator * a,
     : shape(s),
       stride(st),
       capicity(get_length(s, s[0])),
-      data(new DataType[capicity]),
+      data(new storage::Buffer<DataType>(a, capicity)),
       row(1),
       column(shape[0]) {
-  if (data != nullptr) {
-    data->ref();
-  }
+  base = data->data();
 }
 
 template<typename DataType>
@@ -541,27 +580,22 @@ inline Matrix<DataType, 1>::Matrix(const MatrixShape<1> &s)
     : shape(s),
       stride(s[0]),
       capicity(get_length(s, s[0])),
-      data(new storage::Buffer<DataType>(new storage::CPUallocator, capicity)),
+      data(new storage::Buffer<DataType>(storage::default_allocator(), capicity)),
       row(1),
       column(s[0]) {
-  if (data != nullptr) {
-    data->ref();
-  }
+  base = data->data();
 }
 
 
 template<typename DataType>
 inline Matrix<DataType, 1>::Matrix(const Matrix<DataType, 1> &m) {
-    //free existing resource
-    if (data != nullptr) {
-        data->unref();
-    }
     shape = m.get_shape();
     stride = m.get_stride();
     capicity = get_length(m.get_shape(), m.get_stride());
     row = m.row;
     column = m.column;
     data = m.get_data();
+    base = m.raw_data();
     if (data != nullptr) {
         data->ref();
     }
@@ -572,7 +606,11 @@ template<typename DataType>
 inline Matrix<DataType, 1> & Matrix<DataType, 1>::operator =(
     const Matrix<DataType, 1> &m) {
   if (this != &m) {
-    //free existing resource
+    //take the new reference before the old one is released, both may
+    //point into the same root buffer
+    if (m.data != nullptr) {
+        m.data->ref();
+    }
     if (data != nullptr) {
         data->unref();
     }
@@ -581,52 +619,43 @@ inline Matrix<DataType, 1> & Matrix<DataType, 1>::operator =(
     capicity = get_length(m.get_shape(), m.get_stride());
     row = m.row;
     column = m.column;
-    data = m.get_data();
-    if (data != nullptr) {
-        data->ref();
-    }
+    data = m.data;
+    base = m.base;
   }
   return *this;
 }
 
 template<typename DataType>
 inline Matrix<DataType, 1>::Matrix(Matrix<DataType, 1> &&m) {
-    //copy data
-    if (m.get_data() != nullptr) {
-        m.get_data()->unref();
-    }
     shape = m.get_shape();
     stride = m.get_stride();
     capicity = get_length(m.get_shape(), m.get_stride());
     row = m.row;
     column = m.column;
-    data = m.get_data();
-    if (data != nullptr) {
-        data->ref();
-    }
-    auto m_data_ptr = m.get_data();
-    m_data_ptr = nullptr;
+    //steal the reference, no atomic operation
+    data = m.data;
+    base = m.base;
+    m.data = nullptr;
+    m.base = nullptr;
 }
 
 template<typename DataType>
 inline Matrix<DataType, 1> & Matrix<DataType, 1>::operator =(
     Matrix<DataType, 1> &&m) {
   if (this != &m) {
-    //copy data
-    if (m.get_data() != nullptr) {
-        m.get_data()->unref();
+    if (data != nullptr) {
+        data->unref();
     }
     shape = m.get_shape();
     stride = m.get_stride();
     capicity = get_length(m.get_shape(), m.get_stride());
     row = m.row;
     column = m.column;
-    data = m.get_data();
-    if (data != nullptr) {
-        data->ref();
-    }
-    auto m_data_ptr = m.get_data();
-    m_data_ptr = nullptr;
+    //steal the reference, no atomic operation
+    data = m.data;
+    base = m.base;
+    m.data = nullptr;
+    m.base = nullptr;
   }
   return *this;
 }
@@ -648,11 +677,11 @@ inline size_t Matrix<DataType, 1>::get_length(const MatrixShape<1> &s,
 
 template<typename DataType>
 inline const DataType & Matrix<DataType, 1>::operator[](size_t i) const {
-  return data->at(i);  
+  return base[i];
 }
 template<typename DataType>
 inline DataType & Matrix<DataType, 1>::operator[](size_t i) {
-  return data->at(i);
+  return base[i];
 }
 
 template<typename DataType>
@@ -693,7 +722,7 @@ inline Matrix<DataType, 1> & Matrix<DataType, 1>::operator +=(
     const DataType & n) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      data->at(i * stride + j) += n;
+      at(i, j) += n;
     }
   }
   return *this;
@@ -704,7 +733,7 @@ inline Matrix<DataType, 1> & Matrix<DataType, 1>::operator -=(
     const DataType & n) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      data->at(i * stride + j) -= n;
+      at(i, j) -= n;
     }
   }
   return *this;
@@ -715,7 +744,7 @@ inline Matrix<DataType, 1> & Matrix<DataType, 1>::operator *=(
     const DataType & n) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      data->at(i * stride + j) *= n;
+      at(i, j) *= n;
     }
   }
   return *this;
@@ -726,7 +755,7 @@ inline Matrix<DataType, 1> & Matrix<DataType, 1>::operator /=(
     const DataType & n) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      data->at(i * stride + j) /= n;
+      at(i, j) /= n;
     }
   }
   return *this;
@@ -737,7 +766,7 @@ inline Matrix<DataType, 1> & Matrix<DataType, 1>::operator +=(
     const Matrix<DataType, 1> & t) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      data->at(i * stride + j) += t[i][j];
+      at(i, j) += t.at(i, j);
     }
   }
   return *this;
@@ -748,7 +777,7 @@ inline Matrix<DataType, 1> & Matrix<DataType, 1>::operator -=(
     const Matrix<DataType, 1> & t) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      data->at(i * stride + j) -= t[i][j];
+      at(i, j) -= t.at(i, j);
     }
   }
   return *this;
@@ -759,7 +788,7 @@ inline Matrix<DataType, 1> & Matrix<DataType, 1>::operator *=(
     const Matrix<DataType, 1> & t) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      data->at(i * stride + j) *= t[i][j];
+      at(i, j) *= t.at(i, j);
     }
   }
   return *this;
@@ -770,7 +799,7 @@ inline Matrix<DataType, 1>& Matrix<DataType, 1>::operator /=(
     const Matrix<DataType, 1> & t) {
   for (size_t i = 0; i < row; ++i) {
     for (size_t j = 0; j < column; ++j) {
-      data->at(i * stride + j) /= t[i][j];
+      at(i, j) /= t.at(i, j);
     }
   }
   return *this;
@@ -778,7 +807,13 @@ inline Matrix<DataType, 1>& Matrix<DataType, 1>::operator /=(
 
 template<typename DataType>
 inline DataType Matrix<DataType, 1>::eval(size_t i, size_t j) const { /*broadcasting the matrix*/
-  return data->at(i * stride + j);
+  return base[i * stride + j];
+}
+
+template<typename DataType>
+inline typename packet::Packet<DataType>::type Matrix<DataType, 1>::packet(
+    size_t i, size_t j) const {
+  return packet::Packet<DataType>::load(base + i * stride + j);
 }
 
 template<typename DataType>
@@ -789,7 +824,7 @@ inline void Matrix<DataType, 1>::set_row_ele(int i,
   if (row_s == 1) {
     if (column == col_s) {
       for (int j = 0; j < column; ++j) {
-        data->at(i * stride + j) = s[0][j];
+        at(i, j) = s.at(0, j);
       }
     } else {
       //std::cerr << "Set Row: Shape not match!" << std::endl;
@@ -806,11 +841,8 @@ template<typename SubType>
 inline Matrix<DataType, 1>& Matrix<DataType, 1>::operator=(
     const ExprBase<SubType, DataType> &e) {
   const SubType & sub = e.self();
-  for (size_t i = 0; i < row; ++i) {
-    for (size_t j = 0; j < column; ++j) {
-      data->at(i * stride + j) = sub.eval(i, j);
-    }
-  }
+  ExprEngine<PacketCheck<SubType>::value>::eval(base, row, column, stride,
+                                                sub);
   return *this;
 }
 
@@ -819,7 +851,8 @@ inline Matrix<DataType, 1>::Matrix(matrix_initializer_list<DataType, 1> t) {
   init_shape(t, shape);
   stride = shape[0];
   capicity = get_capicity();
-  data = new storage::Buffer<DataType>(new storage::CPUallocator, capicity);
+  data = new storage::Buffer<DataType>(storage::default_allocator(), capicity);
+  base = data->data();
   row = 1;
   column = shape[0];
   size_t offset = 0;
@@ -829,10 +862,14 @@ inline Matrix<DataType, 1>::Matrix(matrix_initializer_list<DataType, 1> t) {
 template<typename DataType>
 inline Matrix<DataType, 1> & Matrix<DataType, 1>::operator =(
     matrix_initializer_list<DataType, 1> t) {
+  if (data != nullptr) {
+    data->unref();
+  }
   init_shape(t, shape);
   stride = shape[0];
   capicity = get_capicity();
-  data = new storage::Buffer<DataType>(new storage::CPUallocator, capicity);
+  data = new storage::Buffer<DataType>(storage::default_allocator(), capicity);
+  base = data->data();
   row = 1;
   column = shape[0];
   size_t offset = 0;
@@ -843,7 +880,7 @@ inline Matrix<DataType, 1> & Matrix<DataType, 1>::operator =(
 template<typename DataType, size_t N>
 std::ostream & operator <<(std::ostream &os, const Matrix<DataType, N> & m) {
   for (size_t i = 0; i < m.get_capicity(); ++i) {
-      os << m.get_data()->data()[i] << " ";
+      os << m.raw_data()[i] << " ";
   }
   os << std::endl;
   return os;
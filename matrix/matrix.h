@@ -6,7 +6,8 @@
  *
  *  a. a matrix can be constructed with the matrix_initializer_list (
  *  a.k, recursive initializer_list). The memory of matrix is controlled by a default
- *  memory object.
+ *  memory object, storage::default_allocator(), which a storage::AllocatorScope can
+ *  switch to a pool for the current thread.
  *
  *  For example:
  *      Matrix<float, 2> amat {{1,2}, {2, 4}};
@@ -37,6 +38,7 @@
 #include <array>
 #include "expr.h"
 #include "matrix_shape.h"
+#include "half.h"
 #include "../storage/buffer.h"
 
 //#define DEBUG
@@ -60,6 +62,9 @@ struct MatrixInit<DataType, 0>;
 template<typename DataType, size_t N>
 using matrix_initializer_list = typename MatrixInit<DataType, N>::type;
 
+template<typename DataType, size_t N>
+class MatrixView;
+
 template<typename DataType, size_t N>
 class Matrix : public ExprBase<Matrix<DataType, N>, DataType> {
  public:
@@ -70,7 +75,8 @@ class Matrix : public ExprBase<Matrix<DataType, N>, DataType> {
         stride(size_t(0)),
         capicity(size_t(0)),
         row(size_t(0)),
-        column(size_t(0)) {
+        column(size_t(0)),
+        base(nullptr) {
   }
   ;
 
@@ -120,6 +126,15 @@ class Matrix : public ExprBase<Matrix<DataType, N>, DataType> {
    */
   Matrix(const Matrix<DataType, N> &m);
 
+  /**
+   * constructor from a matrix product, allocate the result and compute
+   * the product into it
+   *
+   * @param e: the lazy product, such as dot(a, b)
+   */
+  template<typename LeftExpr, typename RightExpr>
+  Matrix(const DotExpr<LeftExpr, RightExpr, DataType> &e);
+
   /**
    * copy assignment
    *
@@ -184,10 +199,10 @@ class Matrix : public ExprBase<Matrix<DataType, N>, DataType> {
    *
    * @param i is the index
    *
-   * @return a Matrix Object which is refer to some elements in the Matrix Object
+   * @return a non-owning view of the i-th sub-matrix, it allocates nothing;
+   *         use slice() to get a sub-matrix that keeps the storage alive
    */
-  inline Matrix<DataType, N - 1> operator[](size_t i) const;
-  inline Matrix<DataType, N - 1> operator[](size_t i);
+  inline MatrixView<DataType, N - 1> operator[](size_t i) const;
 
   /**
    * slice function for the matrix
@@ -282,6 +297,23 @@ class Matrix : public ExprBase<Matrix<DataType, N>, DataType> {
   template<typename SubType>
   inline Matrix<DataType, N>& operator=(const ExprBase<SubType, DataType> &e);
 
+  /**
+   * assign, add or subtract a matrix product in place with one gemm call
+   *
+   * @param e is the lazy product, such as alpha * dot(a, b)
+   *
+   * @return the result matrix
+   */
+  template<typename LeftExpr, typename RightExpr>
+  inline Matrix<DataType, N>& operator=(
+      const DotExpr<LeftExpr, RightExpr, DataType> &e);
+  template<typename LeftExpr, typename RightExpr>
+  inline Matrix<DataType, N>& operator+=(
+      const DotExpr<LeftExpr, RightExpr, DataType> &e);
+  template<typename LeftExpr, typename RightExpr>
+  inline Matrix<DataType, N>& operator-=(
+      const DotExpr<LeftExpr, RightExpr, DataType> &e);
+
   /**
    * get the basic element in index (i,j)
    *
@@ -292,6 +324,17 @@ class Matrix : public ExprBase<Matrix<DataType, N>, DataType> {
    */
   inline DataType eval(size_t i, size_t j) const;
 
+  /**
+   * get the SIMD packet starting at index (i,j)
+   *
+   * @param i is the row index
+   * @param j is the column index of the first element in the packet
+   *
+   * @return the packet of elements (i,j) ... (i,j+size-1)
+   */
+  inline typename packet::Packet<DataType>::type packet(size_t i,
+                                                        size_t j) const;
+
   inline void set_row_ele(int i, const Matrix<DataType, N> & s);
 
   inline size_t get_column() const {
@@ -319,16 +362,46 @@ class Matrix : public ExprBase<Matrix<DataType, N>, DataType> {
     return data;
   }
 
+  /**
+   * raw pointer to the first element of the matrix
+   *
+   * The pointer is cached from the buffer when the buffer is set, so the
+   * element access below does not go through the virtual TensorBuffer
+   * interface and tight loops can be inlined and vectorized.
+   */
+  inline DataType * raw_data() const { return base; }
+
+  /**
+   * @param i is the row index
+   *
+   * @return the pointer to the first element of the i-th row
+   */
+  inline DataType * row_ptr(size_t i) const { return base + i * stride; }
+
+  /**
+   * strided element access
+   *
+   * @param i is the row index
+   * @param j is the column index
+   *
+   * @return the element in the index(i,j)
+   */
+  inline DataType & at(size_t i, size_t j) const {
+    return base[i * stride + j];
+  }
+
   inline MatrixShape<N> get_shape() const { return shape; }
   inline size_t get_stride() const {return stride;}
   inline size_t get_stride()  {return stride;}
   inline void set_shape(const MatrixShape<N> & s) { shape = s; }
   inline void set_stride(const size_t s) { stride = s; }
   inline void set_capicity(const size_t c) { capicity = c;}
-  inline void set_data(storage::TensorBuffer<DataType> * d) { data = d; }
+  inline void set_data(storage::TensorBuffer<DataType> * d) {
+    data = d;
+    base = (d != nullptr) ? d->data() : nullptr;
+  }
   inline void set_row(const size_t r) {row = r;}
   inline void set_column(const size_t c) { column = c; }
-  inline void get_size() {return row * column;};
 
   /*
    * copy data from source matrix to this matrix
@@ -349,6 +422,7 @@ class Matrix : public ExprBase<Matrix<DataType, N>, DataType> {
   storage::TensorBuffer<DataType> * data;
   size_t row;
   size_t column;
+  DataType * base; ///< cached data->data()
 };
 
 /**
@@ -360,7 +434,8 @@ class Matrix<DataType, 1> : public ExprBase<Matrix<DataType, 1>, DataType> {
  public:
   Matrix()
       : data(nullptr),
-        stride(size_t(0)) {
+        stride(size_t(0)),
+        base(nullptr) {
   }
   ;
   Matrix(storage::Allocator * a, const MatrixShape<1> &s);
@@ -395,6 +470,11 @@ class Matrix<DataType, 1> : public ExprBase<Matrix<DataType, 1>, DataType> {
   storage::TensorBuffer<DataType> * get_data() const {
     return data;
   }
+  inline DataType * raw_data() const { return base; }
+  inline DataType * row_ptr(size_t i) const { return base + i * stride; }
+  inline DataType & at(size_t i, size_t j) const {
+    return base[i * stride + j];
+  }
   const DataType & operator[](size_t i) const;
   DataType & operator[](size_t i);
 
@@ -413,6 +493,7 @@ class Matrix<DataType, 1> : public ExprBase<Matrix<DataType, 1>, DataType> {
   Matrix<DataType, 1>& operator=(const ExprBase<SubType, DataType> &e);
 
   DataType eval(size_t i, size_t j) const;
+  typename packet::Packet<DataType>::type packet(size_t i, size_t j) const;
   void set_row_ele(int i, const Matrix<DataType, 1> & s);
   size_t get_column() const {
     return column;
@@ -430,7 +511,10 @@ class Matrix<DataType, 1> : public ExprBase<Matrix<DataType, 1>, DataType> {
   inline void set_shape(const MatrixShape<1> & s) { shape = s; }
   inline void set_stride(const size_t s) { stride = s; }
   inline void set_capicity(const size_t c) { capicity = c;}
-  inline void set_data(storage::TensorBuffer<DataType> * d) { data = d; }
+  inline void set_data(storage::TensorBuffer<DataType> * d) {
+    data = d;
+    base = (d != nullptr) ? d->data() : nullptr;
+  }
   inline void set_row(const size_t r) {row = r;}
   inline void set_column(const size_t c) { column = c; }
   inline void copy_from(const Matrix<DataType, 1> & s);
@@ -443,6 +527,7 @@ class Matrix<DataType, 1> : public ExprBase<Matrix<DataType, 1>, DataType> {
   storage::TensorBuffer<DataType> * data;
   size_t row;
   size_t column;
+  DataType * base; ///< cached data->data()
 };
 
 template<typename DataType>
@@ -459,12 +544,12 @@ inline bool float_equal(const DataType& f1, const DataType& f2) {
 template<typename DataType, size_t N>
 inline bool operator==(const Matrix<DataType, N>& m1,
                        const Matrix<DataType, N>& m2) {
-  storage::TensorBuffer<DataType> * d1 = m1.get_data();
-  storage::TensorBuffer<DataType> * d2 = m2.get_data();
+  const DataType * d1 = m1.raw_data();
+  const DataType * d2 = m2.raw_data();
   if (m1.get_size() != m2.get_size())
     return false;
   for (size_t i = 0; i < m1.get_size(); ++i) {
-    if (!float_equal(d1->at(i), d2->at(i)))
+    if (!float_equal(d1[i], d2[i]))
       return false;
   }
   return true;
@@ -486,6 +571,8 @@ inline bool operator==(const Matrix<DataType, N>& m1,
 #include "expr-inl.h"
 #undef MATRIX_SCALAR_TYPE_
 #include "matrix-inl.h"
+#include "matrix_view.h"
+#include "fixed_matrix.h"
 #include "matrix_math.h"
 #include "random.h"
 #endif // MATRIX_MATRIX_H
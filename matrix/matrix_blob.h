@@ -185,6 +185,12 @@ namespace matrix {
            stride_ = bs[bs.dims()-1];
        }
 
+       ~MBlob() {
+           if (data_ != nullptr) {
+               data_->unref();
+           }
+       }
+
        inline Matrix<DataType, 2> flatten_2d_matrix() {
           return Matrix<DataType, 2>(data_, blob_shape_.flatten_2d(), stride_);
        }
@@ -196,12 +202,34 @@ namespace matrix {
        DataType at(size_t index) {
            return data_->at(index);
        }
+
+       DISALLOW_COPY_AND_ASSIGN(MBlob)
+    };
+
+    /**
+     * row-sparse gradient of a 2-D parameter: row k of values_ is the
+     * gradient of parameter row rows_[k], the other rows have a zero gradient.
+     * The row ids are unique, values_ has room for `capicity` rows.
+     */
+    template <typename DataType>
+    struct SparseRows {
+       vector<size_t> rows_;
+       Matrix<DataType, 2> values_;
+
+       SparseRows(size_t capicity, size_t dim) :
+           values_(MatrixShape<2> {capicity, dim}) {
+           rows_.reserve(capicity);
+       }
+
+       size_t size() const { return rows_.size(); }
+       void clear() { rows_.clear(); }
     };
 
     template <typename DataType> 
     struct Blob {
        shared_ptr<MBlob<DataType> > data_;
        shared_ptr<MBlob <DataType> > diff_; 
+       shared_ptr<SparseRows<DataType> > sparse_diff_; //!< set iff the gradient is row-sparse
 
        Blob(MBlob<DataType> * data, MBlob<DataType> * diff):
            data_(data), diff_(diff) {}
@@ -212,6 +240,8 @@ namespace matrix {
 
        shared_ptr<MBlob<DataType> > get_data() {return data_;}
        shared_ptr<MBlob<DataType> > get_diff() {return diff_;}
+       shared_ptr<SparseRows<DataType> > get_sparse_diff() {return sparse_diff_;}
+       void set_sparse_diff(shared_ptr<SparseRows<DataType> > sd) {sparse_diff_ = sd;}
 
        void * get_raw_data() { return static_cast<void *>(data_->data_->data()); }
 
@@ -258,19 +288,16 @@ namespace matrix {
 
     };
 
-    //helper function to create Blob object
+    //helper function to create Blob object, the memory comes from the
+    //default allocator of the calling thread
     template<typename DataType>
     shared_ptr<Blob<DataType> > create_blob_object(const BlobShape & bs, bool is_create_diff) {    
-        storage::Allocator * data_allocator = new storage::CPUallocator;
-        size_t capicity = bs.get_length();
-        data_allocator->allocate<DataType>(capicity);
-        MBlob<DataType> * data_blob = new MBlob<DataType>(data_allocator, bs);
+        storage::Allocator * allocator = storage::default_allocator();
+        MBlob<DataType> * data_blob = new MBlob<DataType>(allocator, bs);
         MBlob<DataType> * diff_blob = nullptr;
 
         if (is_create_diff) {
-            storage::Allocator * diff_allocator = new storage::CPUallocator;
-            diff_allocator->allocate<DataType>(capicity);
-            diff_blob = new MBlob<DataType>(diff_allocator, bs);
+            diff_blob = new MBlob<DataType>(allocator, bs);
         }
 
         shared_ptr<Blob<DataType> > blob (new Blob<DataType>(data_blob, diff_blob));
@@ -6,13 +6,37 @@
 #define SNOOPY_MATRIX_MATH_H_
 
 #include <vector>
+#include <algorithm>
+#include <cmath>
 #include <type_traits>
 #include "../common/utils.h"
 #include "../common/logging.h"
+#include "packet.h"
 
 namespace snoopy {
 namespace matrix {
 
+/**
+ * blas general matrix-matrix product for the row-major matrix
+ *   c = alpha * op(a) * op(b) + beta * c
+ */
+inline void gemm(const CBLAS_TRANSPOSE trans_a, const CBLAS_TRANSPOSE trans_b,
+                 const int m, const int n, const int k, const float alpha,
+                 const float * a, const int lda, const float * b,
+                 const int ldb, const float beta, float * c, const int ldc) {
+  cblas_sgemm(CblasRowMajor, trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb,
+              beta, c, ldc);
+}
+
+inline void gemm(const CBLAS_TRANSPOSE trans_a, const CBLAS_TRANSPOSE trans_b,
+                 const int m, const int n, const int k, const double alpha,
+                 const double * a, const int lda, const double * b,
+                 const int ldb, const double beta, double * c,
+                 const int ldc) {
+  cblas_dgemm(CblasRowMajor, trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb,
+              beta, c, ldc);
+}
+
 /**
  * matrix product function
  *
@@ -30,9 +54,9 @@ inline void dot(Matrix<DataType, N> & dm, const T1 & m1, const T2 & m2,
   size_t column_prod = m2.get_column();
   CHECK_EQ(N, 2);
   CHECK_EQ(m1.get_column(), m2.get_row());
-  DataType * l_data = m1.get_data()->data();
-  DataType * r_data = m2.get_data()->data();
-  DataType * res_data = dm.get_data()->data();
+  DataType * l_data = m1.raw_data();
+  DataType * r_data = m2.raw_data();
+  DataType * res_data = dm.raw_data();
   const size_t l_row = row_prod;
   const size_t l_col = m1.get_column();
   const size_t r_col = column_prod;
@@ -69,50 +93,392 @@ inline void dot(Matrix<DataType, N> & dm, const T1 & m1, const T2 & m2,
   }
 }
 
-template<typename DataType, size_t N>
-inline Matrix<DataType, N> dot(const Matrix<DataType, N> & m1,
-                               const Matrix<DataType, N> & m2,
-                               const DataType alpha = 1, const bool is_blas =
-                                   true) {
-  size_t row_prod = m1.get_row();
-  size_t column_prod = m2.get_column();
-  MatrixShape<N> s { row_prod, column_prod };
-  Matrix<DataType, N> pr(s);
-  dot(pr, m1, m2, alpha, is_blas);
-  return pr;
+/**
+ * lazy matrix product, nothing is computed until the result is assigned
+ *
+ * @param m1 is left operand in the matrix product
+ * @param m2 is right operand in the matrix product
+ * @param alpha is the scalar to scale
+ * @param is_blas: true to use the blas function; otherwise, not
+ *
+ * @return the product expression, see DotExpr
+ */
+template<typename LeftExpr, typename RightExpr, typename DataType>
+inline DotExpr<LeftExpr, RightExpr, DataType> dot(
+    const ExprBase<LeftExpr, DataType> & m1,
+    const ExprBase<RightExpr, DataType> & m2, const DataType alpha = 1,
+    const bool is_blas = true) {
+  return DotExpr<LeftExpr, RightExpr, DataType>(m1.self(), false, m2.self(),
+                                                false, alpha, is_blas);
+}
+
+/**
+ * lazy matrix product with transpose flags, op(m1) * op(m2)
+ */
+template<typename LeftExpr, typename RightExpr, typename DataType>
+inline DotExpr<LeftExpr, RightExpr, DataType> dot(
+    const ExprBase<LeftExpr, DataType> & m1, const CBLAS_TRANSPOSE trans_m1,
+    const ExprBase<RightExpr, DataType> & m2, const CBLAS_TRANSPOSE trans_m2,
+    const DataType alpha = 1, const bool is_blas = true) {
+  return DotExpr<LeftExpr, RightExpr, DataType>(m1.self(),
+                                                trans_m1 != CblasNoTrans,
+                                                m2.self(),
+                                                trans_m2 != CblasNoTrans,
+                                                alpha, is_blas);
+}
+
+/**
+ * matrix product function with transpose flags
+ *   dm = alpha * op(m1) * op(m2) + beta * dm
+ * op(x) is x or its transpose; nothing is materialized, the flags are passed
+ * to blas directly.
+ *
+ * @param dm is the result matrix
+ * @param m1 is left operand in the matrix product
+ * @param trans_m1: CblasTrans to use the transpose of m1
+ * @param m2 is right operand in the matrix product
+ * @param trans_m2: CblasTrans to use the transpose of m2
+ * @param alpha is the scalar to scale the product
+ * @param beta is the scalar to scale dm, 1 to accumulate into dm
+ * @param is_blas: true to use the blas function; otherwise, not
+ */
+template<typename T1, typename T2, typename DataType, size_t N>
+inline void dot(Matrix<DataType, N> & dm, const T1 & m1,
+                const CBLAS_TRANSPOSE trans_m1, const T2 & m2,
+                const CBLAS_TRANSPOSE trans_m2, const DataType alpha = 1,
+                const DataType beta = 0, const bool is_blas = true) {
+  CHECK_EQ(N, 2);
+  const bool ta = (trans_m1 != CblasNoTrans);
+  const bool tb = (trans_m2 != CblasNoTrans);
+  const size_t m = ta ? m1.get_column() : m1.get_row();
+  const size_t k = ta ? m1.get_row() : m1.get_column();
+  const size_t n = tb ? m2.get_row() : m2.get_column();
+  CHECK_EQ(k, tb ? m2.get_column() : m2.get_row());
+  CHECK_EQ(dm.get_row(), m);
+  CHECK_EQ(dm.get_column(), n);
+  const size_t lda = m1.get_column();
+  const size_t ldb = m2.get_column();
+  const DataType * a = m1.raw_data();
+  const DataType * b = m2.raw_data();
+  DataType * c = dm.raw_data();
+  if (is_blas) {
+    gemm(trans_m1, trans_m2, m, n, k, alpha, a, lda, b, ldb, beta, c, n);
+  } else {
+    for (size_t i = 0; i < m; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        DataType acc = 0;
+        for (size_t p = 0; p < k; ++p) {
+          acc += (ta ? a[p * lda + i] : a[i * lda + p])
+              * (tb ? b[j * ldb + p] : b[p * ldb + j]);
+        }
+        c[i * n + j] = alpha * acc + (beta == 0 ? 0 : beta * c[i * n + j]);
+      }
+    }
+  }
+}
+
+/**
+ * matrix product with a 16-bit right operand, such as frozen weights
+ * stored as fp16/bf16
+ *   dm = alpha * op(m1) * op(m2) + beta * dm
+ * The inner dimension is walked in blocks: each block of m2 is converted
+ * to a float panel that fits in L2 and multiplied with sgemm, so the
+ * products are accumulated in float.
+ */
+template<typename LowType, size_t N>
+inline typename std::enable_if<is_low_precision<LowType>::value>::type
+dot(Matrix<float, N> & dm, const Matrix<float, N> & m1,
+    const CBLAS_TRANSPOSE trans_m1, const Matrix<LowType, N> & m2,
+    const CBLAS_TRANSPOSE trans_m2, const float alpha = 1,
+    const float beta = 0) {
+  CHECK_EQ(N, 2);
+  const bool ta = (trans_m1 != CblasNoTrans);
+  const bool tb = (trans_m2 != CblasNoTrans);
+  const size_t m = ta ? m1.get_column() : m1.get_row();
+  const size_t k = ta ? m1.get_row() : m1.get_column();
+  const size_t n = tb ? m2.get_row() : m2.get_column();
+  CHECK_EQ(k, tb ? m2.get_column() : m2.get_row());
+  CHECK_EQ(dm.get_row(), m);
+  CHECK_EQ(dm.get_column(), n);
+  const size_t lda = m1.get_column();
+  const size_t ldb = m2.get_column();
+  const float * a = m1.raw_data();
+  const LowType * b = m2.raw_data();
+  float * c = dm.raw_data();
+  //64K floats, a 256KB panel
+  const size_t kb = std::max<size_t>(1, std::min(k, size_t(65536) / std::max<size_t>(n, 1)));
+  std::vector<float> panel(kb * n);
+  float cur_beta = beta;
+  for (size_t p = 0; p < k; p += kb) {
+    const size_t len = std::min(kb, k - p);
+    if (tb) {
+      //op(m2)[p:p+len, :] is column block p of m2, stored n x len
+      for (size_t j = 0; j < n; ++j) {
+        convert(panel.data() + j * len, b + j * ldb + p, len);
+      }
+    } else {
+      convert(panel.data(), b + p * ldb, len * n);
+    }
+    const float * a_block = ta ? a + p * lda : a + p;
+    gemm(trans_m1, trans_m2, m, n, len, alpha, a_block, lda, panel.data(),
+         tb ? len : n, cur_beta, c, n);
+    cur_beta = 1;
+  }
+  if (k == 0) {
+    dm *= beta;
+  }
+}
+
+template<typename LeftExpr, typename RightExpr, typename DataType>
+template<typename Dst>
+inline void DotExpr<LeftExpr, RightExpr, DataType>::eval_to(
+    Dst & dst, const DataType beta) const {
+  ShapeCheck<DotExpr<LeftExpr, RightExpr, DataType>, 2>::check(*this);
+  const CBLAS_TRANSPOSE ta = trans_left ? CblasTrans : CblasNoTrans;
+  const CBLAS_TRANSPOSE tb = trans_right ? CblasTrans : CblasNoTrans;
+  if (dst.raw_data() != left.raw_data() && dst.raw_data() != right.raw_data()) {
+    dot(dst, left, ta, right, tb, scale, beta, is_blas);
+    return;
+  }
+  //the destination is also an operand, compute aside first
+  MatrixShape<2> s { get_row(), get_column() };
+  Matrix<DataType, 2> tmp(s);
+  dot(tmp, left, ta, right, tb, scale, DataType(0), is_blas);
+  if (beta == 0) {
+    dst.copy_from(tmp);
+  } else {
+    dst = tmp + dst * beta;
+  }
+}
+
+namespace act {
+
+/**
+ * Activation functions for the fused linear operation.
+ *
+ * matrix_op computes the activation y = f(x). deri_op computes the
+ * derivative f'(x) from the output y, so the backward pass does not need
+ * the input of the activation.
+ */
+template<typename DataType>
+struct identity {
+  inline static DataType matrix_op(DataType x) { return x; }
+  inline static DataType deri_op(DataType y) { return 1; }
+};
+
+template<typename DataType>
+struct relu {
+  inline static DataType matrix_op(DataType x) { return x > 0 ? x : 0; }
+  inline static DataType deri_op(DataType y) { return y > 0 ? 1 : 0; }
+};
+
+template<typename DataType>
+struct sigmoid {
+  inline static DataType matrix_op(DataType x) {
+    return static_cast<DataType>(1) / (1 + std::exp(-x));
+  }
+  inline static DataType deri_op(DataType y) { return y * (1 - y); }
+};
+
+template<typename DataType>
+struct tanh {
+  inline static DataType matrix_op(DataType x) { return std::tanh(x); }
+  inline static DataType deri_op(DataType y) { return 1 - y * y; }
+};
+
+template<typename DataType>
+struct softsign {
+  inline static DataType matrix_op(DataType x) {
+    return x / (1 + std::fabs(x));
+  }
+  inline static DataType deri_op(DataType y) {
+    DataType d = 1 - std::fabs(y);
+    return d * d;
+  }
+};
+
+}  //namespace act
+
+/**
+ * fused linear function: out = Act(in * weight + bias)
+ *
+ * The product is computed by blas on blocks of rows. The bias and the
+ * activation are applied to each block right after its product, while the
+ * block is still in cache, instead of in separate passes over the output.
+ *
+ * @param out is the result matrix, (n, n_out)
+ * @param in is the input matrix, (n, n_in)
+ * @param weight is the weight matrix, (n_in, n_out)
+ * @param bias is the bias vector with n_out elements, nullptr for no bias
+ */
+template<typename Act, typename DataType>
+inline void linear(Matrix<DataType, 2> & out, const Matrix<DataType, 2> & in,
+                   const Matrix<DataType, 2> & weight, const DataType * bias) {
+  const size_t n = in.get_row();
+  const size_t n_in = in.get_column();
+  const size_t n_out = weight.get_column();
+  CHECK_EQ(n_in, weight.get_row());
+  CHECK_EQ(n, out.get_row());
+  CHECK_EQ(n_out, out.get_column());
+  //keep one block of the output in the L2 cache
+  const size_t block_bytes = 256 * 1024;
+  size_t block_rows = block_bytes / (sizeof(DataType) * n_out);
+  if (block_rows == 0) {
+    block_rows = 1;
+  }
+  for (size_t r = 0; r < n; r += block_rows) {
+    const size_t rows = std::min(block_rows, n - r);
+    gemm(CblasNoTrans, CblasNoTrans, rows, n_out, n_in, DataType(1),
+         in.row_ptr(r), in.get_stride(), weight.raw_data(),
+         weight.get_stride(), DataType(0), out.row_ptr(r),
+         out.get_stride());
+    for (size_t i = r; i < r + rows; ++i) {
+      DataType * p = out.row_ptr(i);
+      if (bias != nullptr) {
+        for (size_t j = 0; j < n_out; ++j) {
+          p[j] = Act::matrix_op(p[j] + bias[j]);
+        }
+      } else {
+        for (size_t j = 0; j < n_out; ++j) {
+          p[j] = Act::matrix_op(p[j]);
+        }
+      }
+    }
+  }
+}
+
+/**
+ * gradient of the activation in the fused linear function
+ *
+ * @param t is the gradient w.r.t the activation input
+ * @param diff is the gradient w.r.t the activation output
+ * @param out is the activation output
+ * @param is_add adds the gradient to t instead of writing it
+ */
+template<typename Act, typename DataType>
+inline void activation_grad(Matrix<DataType, 2> & t,
+                            const Matrix<DataType, 2> & diff,
+                            const Matrix<DataType, 2> & out,
+                            const bool is_add = false) {
+  for (size_t i = 0; i < out.get_row(); ++i) {
+    DataType * t_p = t.row_ptr(i);
+    const DataType * d_p = diff.row_ptr(i);
+    const DataType * o_p = out.row_ptr(i);
+    if (is_add) {
+      for (size_t j = 0; j < out.get_column(); ++j) {
+        t_p[j] += d_p[j] * Act::deri_op(o_p[j]);
+      }
+      continue;
+    }
+    for (size_t j = 0; j < out.get_column(); ++j) {
+      t_p[j] = d_p[j] * Act::deri_op(o_p[j]);
+    }
+  }
 }
 
 /**
  * matrix transpose function
+ *
+ * The matrix is walked in kTransTile x kTransTile tiles so that both the
+ * source rows and the destination rows of a tile stay in L1, and every tile
+ * is split into packet::kTransBlock register blocks transposed with SIMD
+ * shuffles. Tile rows are distributed over OpenMP threads.
+ *
  * @param t is result matrix
  * @param s is input matrix
  * @param alpha is the scalar to scale
- * @param is_blas: true to use the blas function; otherwise, not
+ * @param is_blas: kept for compatibility, the blocked kernel is always used
  */
+const size_t kTransTile = 64;
+
 template<typename DataType, size_t N, typename T>
 inline void transpose(Matrix<DataType, N> & t, const T & s,
                       const DataType alpha = 1, const bool is_blas = false) {
-  size_t row = s.get_row();
-  size_t column = s.get_column();
-  DataType * s_data = s.get_data()->data();
-  DataType * t_data = t.get_data()->data();
-  if (is_blas) {
-//#ifdef USE_DOUBLE
-//    cblas_domatcopy(CblasRowMajor, CblasTrans,
-//        row, column, alpha, s_data, column, t_data, row); //TODO: test
-//#else
-//    cblas_somatcopy(CblasRowMajor, CblasTrans,
-//        row, column, alpha, s_data, column, t_data, row); //TODO: test
-//#endif
-  } else {
-    for (size_t i = 0; i < column; ++i) {
-      for (size_t j = 0; j < row; ++j) {
-        t_data[i * row + j] = alpha * s_data[j * column + i];
+  const size_t row = s.get_row();
+  const size_t column = s.get_column();
+  CHECK_EQ(t.get_row(), column);
+  CHECK_EQ(t.get_column(), row);
+  const DataType * s_data = s.raw_data();
+  DataType * t_data = t.raw_data();
+  const size_t B = packet::kTransBlock;
+  const long row_tiles = (row + kTransTile - 1) / kTransTile;
+
+  #pragma omp parallel for schedule(static)
+  for (long it = 0; it < row_tiles; ++it) {
+    const size_t ib = it * kTransTile;
+    const size_t ie = std::min(ib + kTransTile, row);
+    for (size_t jb = 0; jb < column; jb += kTransTile) {
+      const size_t je = std::min(jb + kTransTile, column);
+      for (size_t i = ib; i < ie; i += B) {
+        for (size_t j = jb; j < je; j += B) {
+          if (i + B <= ie && j + B <= je) {
+            packet::transpose_block(s_data + i * column + j, column,
+                                    t_data + j * row + i, row, alpha);
+            continue;
+          }
+          //edge block
+          for (size_t ii = i; ii < std::min(i + B, ie); ++ii) {
+            for (size_t jj = j; jj < std::min(j + B, je); ++jj) {
+              t_data[jj * row + ii] = alpha * s_data[ii * column + jj];
+            }
+          }
+        }
       }
     }
   }
 }
 
+/**
+ * in-place transpose of a square matrix
+ *
+ * Block (i, j) and block (j, i) are transposed into registers-sized
+ * buffers and written back swapped; the rows and columns that do not fill a
+ * whole block are swapped element by element.
+ *
+ * @param m is the square matrix to transpose
+ * @param alpha is the scalar to scale
+ */
+template<typename DataType, size_t N>
+inline void transpose_inplace(Matrix<DataType, N> & m,
+                              const DataType alpha = 1) {
+  const size_t n = m.get_row();
+  CHECK_EQ(n, m.get_column());
+  DataType * data = m.raw_data();
+  const size_t B = packet::kTransBlock;
+  const size_t full = n - n % B;
+  const long blocks = full / B;
+
+  #pragma omp parallel for schedule(dynamic)
+  for (long bi = 0; bi < blocks; ++bi) {
+    DataType ta[packet::kTransBlock * packet::kTransBlock];
+    DataType tb[packet::kTransBlock * packet::kTransBlock];
+    const size_t i = bi * B;
+    for (size_t j = i; j < full; j += B) {
+      DataType * a = data + i * n + j;
+      DataType * b = data + j * n + i;
+      packet::transpose_block(a, n, ta, B, alpha);
+      if (i != j) {
+        packet::transpose_block(b, n, tb, B, alpha);
+      }
+      for (size_t r = 0; r < B; ++r) {
+        std::copy(ta + r * B, ta + (r + 1) * B, b + r * n);
+        if (i != j) {
+          std::copy(tb + r * B, tb + (r + 1) * B, a + r * n);
+        }
+      }
+    }
+  }
+  //the rest columns and the rest rows
+  for (size_t j = full; j < n; ++j) {
+    for (size_t i = 0; i < j; ++i) {
+      DataType v = data[i * n + j];
+      data[i * n + j] = alpha * data[j * n + i];
+      data[j * n + i] = alpha * v;
+    }
+    data[j * n + j] *= alpha;
+  }
+}
+
 template<typename DataType, size_t N>
 inline Matrix<DataType, N> transpose(const Matrix<DataType, N> & s,
                                      const DataType alpha = 1,
@@ -132,14 +498,175 @@ inline Matrix<DataType, N> transpose(const Matrix<DataType, N> & s,
  */
 template<typename DataType, size_t N>
 void copyMatrix(Matrix<DataType, N> & t, const Matrix<DataType, N> &s) {
-  CHECK_EQ(t.capicity, s.capicity);
-  DataType * t_data = t.get_data();
-  DataType * s_data = s.get_data();
-  for (int i = 0; i < t.getCapicity(); ++i) {
+  CHECK_EQ(t.get_capicity(), s.get_capicity());
+  DataType * t_data = t.raw_data();
+  DataType * s_data = s.raw_data();
+  for (int i = 0; i < t.get_capicity(); ++i) {
     t_data[i] = s_data[i];
   }
 }
 
+/**
+ * row kernels used by the reductions below, they work on raw row pointers
+ * and reduce a packet at a time
+ */
+template<typename DataType>
+inline typename std::enable_if<!is_low_precision<DataType>::value,
+    DataType>::type row_sum(const DataType * p, const size_t n) {
+  typedef packet::Packet<DataType> P;
+  const size_t n_packet = n - n % P::size;
+  typename P::type acc = P::set1(0);
+  for (size_t j = 0; j < n_packet; j += P::size) {
+    acc = packet::add(acc, P::load(p + j));
+  }
+  DataType s = packet::hsum(acc);
+  for (size_t j = n_packet; j < n; ++j) {
+    s += p[j];
+  }
+  return s;
+}
+
+template<typename DataType>
+inline DataType row_max(const DataType * p, const size_t n) {
+  typedef packet::Packet<DataType> P;
+  const size_t n_packet = n - n % P::size;
+  DataType ma = p[0];
+  if (n_packet > 0) {
+    typename P::type acc = P::load(p);
+    for (size_t j = P::size; j < n_packet; j += P::size) {
+      acc = packet::max(acc, P::load(p + j));
+    }
+    ma = packet::hmax(acc);
+  }
+  for (size_t j = n_packet; j < n; ++j) {
+    if (ma < p[j])
+      ma = p[j];
+  }
+  return ma;
+}
+
+/**
+ * @return the first index of the max value in the row
+ */
+template<typename DataType>
+inline size_t row_argmax(const DataType * p, const size_t n, DataType & ma) {
+  ma = row_max(p, n);
+  size_t j = 0;
+  while (j + 1 < n && p[j] != ma) {
+    ++j;
+  }
+  return j;
+}
+
+/**
+ * t = exp(s - max(s)) / sum(exp(s - max(s))), t may be s
+ *
+ * @return log(sum(exp(s))), computed from the same max and sum
+ */
+template<typename DataType>
+inline DataType row_softmax(DataType * t, const DataType * s, const size_t n) {
+  typedef packet::Packet<DataType> P;
+  const size_t n_packet = n - n % P::size;
+  const DataType ma = row_max(s, n);
+  const typename P::type pma = P::set1(ma);
+  typename P::type acc = P::set1(0);
+  for (size_t j = 0; j < n_packet; j += P::size) {
+    typename P::type e = packet::exp(packet::sub(P::load(s + j), pma));
+    P::store(t + j, e);
+    acc = packet::add(acc, e);
+  }
+  DataType sum = packet::hsum(acc);
+  for (size_t j = n_packet; j < n; ++j) {
+    t[j] = std::exp(s[j] - ma);
+    sum += t[j];
+  }
+  const typename P::type inv = P::set1(DataType(1) / sum);
+  for (size_t j = 0; j < n_packet; j += P::size) {
+    P::store(t + j, packet::mul(P::load(t + j), inv));
+  }
+  for (size_t j = n_packet; j < n; ++j) {
+    t[j] /= sum;
+  }
+  return ma + std::log(sum);
+}
+
+/**
+ * column width summed at once by sum_rows, the partial sums of one block
+ * stay in L1 while the rows stream through
+ */
+const size_t kSumColumnBlock = 1024;
+
+/**
+ * t[j] = sum_i s[i * ld + j], column blocks run in parallel
+ */
+template<typename DataType>
+inline typename std::enable_if<!is_low_precision<DataType>::value>::type
+sum_rows(DataType * t, const DataType * s, const size_t row,
+         const size_t column, const size_t ld) {
+  typedef packet::Packet<DataType> P;
+  const long blocks = (column + kSumColumnBlock - 1) / kSumColumnBlock;
+  #pragma omp parallel for schedule(static)
+  for (long b = 0; b < blocks; ++b) {
+    const size_t jb = b * kSumColumnBlock;
+    const size_t je = std::min(jb + kSumColumnBlock, column);
+    const size_t jp = jb + (je - jb) - (je - jb) % P::size;
+    std::fill(t + jb, t + je, DataType(0));
+    for (size_t i = 0; i < row; ++i) {
+      const DataType * p = s + i * ld;
+      for (size_t j = jb; j < jp; j += P::size) {
+        P::store(t + j, packet::add(P::load(t + j), P::load(p + j)));
+      }
+      for (size_t j = jp; j < je; ++j) {
+        t[j] += p[j];
+      }
+    }
+  }
+}
+
+/**
+ * row_sum and sum_rows for 16-bit storage, the elements are converted to
+ * float a block at a time and summed in float
+ */
+template<typename DataType>
+inline typename std::enable_if<is_low_precision<DataType>::value,
+    float>::type row_sum(const DataType * p, const size_t n) {
+  float buf[kSumColumnBlock];
+  float s = 0;
+  for (size_t jb = 0; jb < n; jb += kSumColumnBlock) {
+    const size_t len = std::min(kSumColumnBlock, n - jb);
+    convert(buf, p + jb, len);
+    s += row_sum(buf, len);
+  }
+  return s;
+}
+
+template<typename DataType>
+inline typename std::enable_if<is_low_precision<DataType>::value>::type
+sum_rows(DataType * t, const DataType * s, const size_t row,
+         const size_t column, const size_t ld) {
+  typedef packet::Packet<float> P;
+  const long blocks = (column + kSumColumnBlock - 1) / kSumColumnBlock;
+  #pragma omp parallel for schedule(static)
+  for (long b = 0; b < blocks; ++b) {
+    float acc[kSumColumnBlock];
+    float buf[kSumColumnBlock];
+    const size_t jb = b * kSumColumnBlock;
+    const size_t len = std::min(kSumColumnBlock, column - jb);
+    const size_t lp = len - len % P::size;
+    std::fill(acc, acc + len, 0.f);
+    for (size_t i = 0; i < row; ++i) {
+      convert(buf, s + i * ld + jb, len);
+      for (size_t j = 0; j < lp; j += P::size) {
+        P::store(acc + j, packet::add(P::load(acc + j), P::load(buf + j)));
+      }
+      for (size_t j = lp; j < len; ++j) {
+        acc[j] += buf[j];
+      }
+    }
+    convert(t + jb, acc, len);
+  }
+}
+
 /**
  * sum up the matrix
  * @param m is input matrix
@@ -150,37 +677,31 @@ void copyMatrix(Matrix<DataType, N> & t, const Matrix<DataType, N> &s) {
 template<typename DataType, size_t N>
 Matrix<DataType, 1> sum(const Matrix<DataType, N> &m, int d = 0) {
   CHECK_EQ(N, 2);
+  const size_t row = m.get_row();
+  const size_t col = m.get_column();
   if (d == 0) {
-    size_t col = m.get_column();
     MatrixShape<1> sh { col };
     Matrix<DataType, 1> temp(sh);
-    for (int i = 0; i < col; ++i) {
-      temp[i] = 0;
-      for (int j = 0; j < m.get_row(); ++j) {
-        temp[i] += m[j][i];
-      }
-    }
+    sum_rows(temp.raw_data(), m.raw_data(), row, col, m.get_stride());
     return temp;
   } else if (d == 1) {
-    size_t row = m.get_row();
     MatrixShape<1> sh { row };
     Matrix<DataType, 1> temp(sh);
-    for (int i = 0; i < row; ++i) {
-      temp[i] = 0;
-      for (int j = 0; j < m.get_column(); ++j) {
-        temp[i] += m[i][j];
-      }
+    DataType * t = temp.raw_data();
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < static_cast<long>(row); ++i) {
+      t[i] = row_sum(m.row_ptr(i), col);
     }
     return temp;
   } else {
     MatrixShape<1> sh { 1 };
     Matrix<DataType, 1> temp(sh);
-    temp[0] = 0;
-    for (int i = 0; i < m.get_row(); ++i) {
-      for (int j = 0; j < m.get_column(); ++j) {
-        temp[0] += m[i][j];
-      }
+    typename AccumType<DataType>::type total = 0;
+    #pragma omp parallel for schedule(static) reduction(+:total)
+    for (long i = 0; i < static_cast<long>(row); ++i) {
+      total += row_sum(m.row_ptr(i), col);
     }
+    temp.raw_data()[0] = total;
     return temp;
   }
 }
@@ -192,22 +713,16 @@ void sum(Matrix<DataType, 2> & t, const Matrix<DataType, 2> & s, int d = 0) {
     size_t col_t = t.get_column();
     size_t col_s = s.get_column();
     CHECK_EQ(col_t, col_s);
-    for (int i = 0; i < col_t; ++i) {
-      t[0][i] = 0;
-      for (int j = 0; j < s.get_row(); ++j) {
-        t[0][i] += s[j][i];
-      }
-    }
+    sum_rows(t.row_ptr(0), s.raw_data(), s.get_row(), col_s, s.get_stride());
   } else if (d == 1) {
     //check row equal
     size_t row_t = t.get_row();
     size_t row_s = s.get_row();
     CHECK_EQ(row_t, row_s);
-    for (int i = 0; i < row_t; ++i) {
-      t[i][0] = 0;
-      for (int j = 0; j < s.get_column(); ++j) {
-        t[i][0] += s[i][j];
-      }
+    const size_t col = s.get_column();
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < static_cast<long>(row_t); ++i) {
+      t.at(i, 0) = row_sum(s.row_ptr(i), col);
     }
   } 
 }
@@ -225,52 +740,49 @@ template<typename DataType, size_t N>
 Matrix<DataType, 1> max(const Matrix<DataType, N> &m, vector<int> &temp_index,
                         int d = 0) {
   CHECK_EQ(N, 2);
+  const size_t row = m.get_row();
+  const size_t col = m.get_column();
   if (d == 0) {
-    size_t col = m.get_column();
     MatrixShape<1> sh { col };
     Matrix<DataType, 1> temp(sh);
-    for (int i = 0; i < col; ++i) {
-      temp[i] = m[0][i];
-      temp_index[0] = 0;
-      for (int j = 1; j < m.get_row(); ++j) {
-        if (temp[i] < m[j][i]) {
-          temp[i] = m[j][i];
-          temp_index[0] = j;
+    DataType * t = temp.raw_data();
+    //walk the rows once, the index is the row of the last column's max
+    std::copy(m.row_ptr(0), m.row_ptr(0) + col, t);
+    temp_index[0] = 0;
+    for (size_t i = 1; i < row; ++i) {
+      const DataType * p = m.row_ptr(i);
+      for (size_t j = 0; j < col; ++j) {
+        if (t[j] < p[j]) {
+          t[j] = p[j];
+          if (j + 1 == col)
+            temp_index[0] = i;
         }
       }
     }
     return temp;
   } else if (d == 1) {
-    size_t row = m.get_row();
     MatrixShape<1> sh { row };
     Matrix<DataType, 1> temp(sh);
-    for (int i = 0; i < row; ++i) {
-      temp[i] = m[i][0];
-      temp_index[i] = 0;
-      for (int j = 1; j < m.get_column(); ++j) {
-        if (temp[i] < m[i][j]) {
-          temp[i] = m[i][j];
-          temp_index[i] = j;
-        }
-      }
+    DataType * t = temp.raw_data();
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < static_cast<long>(row); ++i) {
+      temp_index[i] = row_argmax(m.row_ptr(i), col, t[i]);
     }
     return temp;
   } else {
     MatrixShape<1> sh { 1 };
     Matrix<DataType, 1> temp(sh);
-    for (int i = 0; i < m.get_row(); ++i) {
-      for (int j = 0; j < m.get_column(); ++j) {
-        if (i == 0 && j == 0) {
-            temp[0] = m[0][0];
-            temp_index[0] = 0;
-            temp_index[1] = 0;
-        } else if (temp[0] < m[i][j]) {
-            temp[0] = m[i][j];
-            temp_index[0] = i;
-            temp_index[1] = j;
-        }
+    DataType ma = 0;
+    for (size_t i = 0; i < row; ++i) {
+      DataType v;
+      size_t j = row_argmax(m.row_ptr(i), col, v);
+      if (i == 0 || ma < v) {
+        ma = v;
+        temp_index[0] = i;
+        temp_index[1] = j;
       }
     }
+    temp.raw_data()[0] = ma;
     return temp;
   }
 }
@@ -283,9 +795,9 @@ void oneHotCode(Matrix<DataType, N> &m) {
   for (int i = 0; i < m.get_row(); ++i) {
     for (int j = 0; j < m.get_column(); ++j) {
       if (j == ind[i]) {
-        m[i][j] = 1;
+        m.at(i, j) = 1;
       } else {
-        m[i][j] = 0;
+        m.at(i, j) = 0;
       }
     }
   }
@@ -297,14 +809,33 @@ void oneHotCode(Matrix<DataType, N> &m, const vector<int> & v) {
   for (int i = 0; i < m.get_row(); ++i) {
     for (int j = 0; j < m.get_column(); ++j) {
       if (j == v[i]) {
-        m[i][j] = 1;
+        m.at(i, j) = 1;
       } else {
-        m[i][j] = 0;
+        m.at(i, j) = 0;
       }
     }
   }
 }
 
+/**
+ * row-wise softmax, rows run in parallel
+ *
+ * @param log_sum_exp: if not null, gets log(sum(exp(row i of s))) at i
+ */
+template<typename DataType>
+void softmax(Matrix<DataType, 2> & t, const Matrix<DataType, 2> &s,
+             DataType * log_sum_exp = nullptr) {
+  CHECK_EQ(s.get_shape(), t.get_shape());
+  const size_t col = s.get_column();
+  #pragma omp parallel for schedule(static)
+  for (long i = 0; i < static_cast<long>(s.get_row()); ++i) {
+    const DataType lse = row_softmax(t.row_ptr(i), s.row_ptr(i), col);
+    if (log_sum_exp != nullptr) {
+      log_sum_exp[i] = lse;
+    }
+  }
+}
+
 /**
  * softmax function
  * @param m is input matrix
@@ -313,51 +844,18 @@ void oneHotCode(Matrix<DataType, N> &m, const vector<int> & v) {
 template<typename DataType, size_t N>
 Matrix<DataType, N> softmax(const Matrix<DataType, N> &m) {
   CHECK_EQ(N, 2);
-  Matrix<DataType, N> temp(m);
-  for (int i = 0; i < m.get_row(); ++i) {
-    DataType s = 0;
-    DataType ma = m[i][0];
-    for (int j = 1; j < m.get_column(); ++j) {
-      if (m[i][j] > ma)
-        ma = m[i][j];
-    }
-    for (int j = 0; j < m.get_column(); ++j) {
-      s += exp(m[i][j] - ma);
-    }
-    for (int j = 0; j < m.get_column(); ++j) {
-      temp[i][j] = exp(m[i][j] - ma - log(s));
-    }
-  }
+  Matrix<DataType, N> temp(m.get_shape());
+  softmax(temp, m);
   return temp;
 }
 
 
-template<typename DataType>
-void softmax(Matrix<DataType, 2> & t, const Matrix<DataType, 2> &s) {
-  CHECK_EQ(s.get_shape(), t.get_shape());
-  for (int i = 0; i < s.get_row(); ++i) {
-    DataType sum = 0;
-    DataType ma = s[i][0];
-    for (int j = 1; j < s.get_column(); ++j) {
-      if (s[i][j] > ma)
-        ma = s[i][j];
-    }
-    for (int j = 0; j < s.get_column(); ++j) {
-      sum += exp(s[i][j] - ma);
-    }
-    for (int j = 0; j < s.get_column(); ++j) {
-      t[i][j] = exp(s[i][j] - ma - log(sum));
-    }
-  }
-
-}
-
 template<typename DataType>
 Matrix<DataType, 2> repmat(const Matrix<DataType, 1> &m, size_t row) {
   MatrixShape<2> s { row, m.get_column() };
   Matrix<DataType, 2> temp(s, 0);
-  DataType * t_d = temp.get_data();
-  DataType * s_d = m.get_data();
+  DataType * t_d = temp.raw_data();
+  DataType * s_d = m.raw_data();
   for (int i = 0; i < row; ++i) {
     std::copy(s_d, s_d + m.get_column(), t_d);
     t_d += m.get_column();
@@ -372,8 +870,8 @@ void repmat(Matrix<DataType, 2> & t, const Matrix<DataType, 2> & s, int d) {
         size_t col_t = t.get_column();
         size_t col_s = s.get_column();
         CHECK_EQ(col_t, col_s);
-        DataType * t_d = t.get_data()->data();
-        DataType * s_d = s.get_data()->data();
+        DataType * t_d = t.raw_data();
+        DataType * s_d = s.raw_data();
         for (int i = 0; i < t.get_row(); ++i) {
             std::copy(s_d, s_d + col_s, t_d);
             t_d += col_t;
@@ -384,8 +882,8 @@ void repmat(Matrix<DataType, 2> & t, const Matrix<DataType, 2> & s, int d) {
         size_t row_s = s.get_row();
         size_t col_t = t.get_column();
         CHECK_EQ(row_t, row_s);
-        DataType * t_d = t.get_data()->data();
-        DataType * s_d = s.get_data()->data();
+        DataType * t_d = t.raw_data();
+        DataType * s_d = s.raw_data();
         for (int i = 0; i < row_t; ++i) {
             std::fill(t_d, t_d + col_t, *s_d);
             t_d += col_t;
@@ -0,0 +1,194 @@
+/**
+ *  A non-owning view on the elements of a Matrix
+ *
+ *  MatrixView is what Matrix::operator[] returns. It only carries a raw
+ *  pointer and the shape, so indexing allocates nothing and touches no
+ *  reference count; m[i][j] on a 2-D matrix is a single load. The view is
+ *  valid as long as the matrix it comes from is alive. Use Matrix::slice()
+ *  to get a sub-matrix that owns a reference to the storage.
+ *
+ *  A view is also a leaf of the expression templates:
+ *      Matrix<float, 2> a {{1, 2}, {3, 4}};
+ *      Matrix<float, 2> b {{1, 1}, {1, 1}};
+ *      a[0] = a[1] + b[0] * 2;   // a = {{5, 6}, {3, 4}}
+ */
+
+#ifndef SNOOPY_MATRIX_VIEW_H_
+#define SNOOPY_MATRIX_VIEW_H_
+
+#include <algorithm>
+#include "matrix.h"
+
+namespace snoopy {
+namespace matrix {
+
+template<typename DataType, size_t N>
+class MatrixView : public ExprBase<MatrixView<DataType, N>, DataType> {
+ public:
+  /**
+   * constructor
+   *
+   * @param b is the first element of the view
+   * @param s is the shape of the view
+   */
+  MatrixView(DataType * b, const MatrixShape<N> & s)
+      : base(b),
+        shape(s),
+        stride(s[N - 1]),
+        column(s[N - 1]) {
+    row = 1;
+    for (size_t i = 0; i < N - 1; ++i) {
+      row *= shape[i];
+    }
+  }
+
+  /**
+   * index operation, returns a view of one dimension less
+   */
+  inline MatrixView<DataType, N - 1> operator[](size_t i) const {
+    return MatrixView<DataType, N - 1>(base + i * shape.stride[0],
+                                       shape.subShape());
+  }
+
+  template<typename SubType>
+  inline MatrixView<DataType, N> & operator=(
+      const ExprBase<SubType, DataType> & e) {
+    const SubType & sub = e.self();
+    ShapeCheck<SubType, N>::check(sub);
+    ExprEngine<PacketCheck<SubType>::value>::eval(base, row, column, stride,
+                                                  sub);
+    return *this;
+  }
+
+  inline MatrixView<DataType, N> & operator=(const MatrixView<DataType, N> & v) {
+    return this->operator=<MatrixView<DataType, N> >(v);
+  }
+
+  /**
+   * copy the elements of a matrix or a view with the same size, the
+   * element type may differ, e.g. a float16 row into a float row
+   */
+  template<typename T>
+  inline void copy_from(const T & s) {
+    CHECK_EQ(get_size(), static_cast<size_t>(s.get_row() * s.get_column()));
+    convert(base, s.raw_data(), get_size());
+  }
+
+  inline void clear_data() {
+    std::fill(base, base + get_size(), 0);
+  }
+
+  inline DataType eval(size_t i, size_t j) const {
+    return base[i * stride + j];
+  }
+
+  inline typename packet::Packet<DataType>::type packet(size_t i,
+                                                        size_t j) const {
+    return packet::Packet<DataType>::load(base + i * stride + j);
+  }
+
+  inline DataType & at(size_t i, size_t j) const { return base[i * stride + j]; }
+  inline DataType * raw_data() const { return base; }
+  inline DataType * row_ptr(size_t i) const { return base + i * stride; }
+  inline const MatrixShape<N> & get_shape() const { return shape; }
+  inline size_t get_row() const { return row; }
+  inline size_t get_column() const { return column; }
+  inline size_t get_stride() const { return stride; }
+  inline size_t get_size() const { return row * column; }
+
+ private:
+  DataType * base;
+  MatrixShape<N> shape;
+  size_t stride;
+  size_t row;
+  size_t column;
+};
+
+/**
+ * one-dimension view, indexing returns the element itself
+ */
+template<typename DataType>
+class MatrixView<DataType, 1> : public ExprBase<MatrixView<DataType, 1>,
+    DataType> {
+ public:
+  MatrixView(DataType * b, const MatrixShape<1> & s)
+      : base(b),
+        shape(s),
+        column(s[0]) {
+  }
+
+  inline DataType & operator[](size_t i) const { return base[i]; }
+
+  template<typename SubType>
+  inline MatrixView<DataType, 1> & operator=(
+      const ExprBase<SubType, DataType> & e) {
+    const SubType & sub = e.self();
+    ShapeCheck<SubType, 1>::check(sub);
+    ExprEngine<PacketCheck<SubType>::value>::eval(base, 1, column, column,
+                                                  sub);
+    return *this;
+  }
+
+  inline MatrixView<DataType, 1> & operator=(const MatrixView<DataType, 1> & v) {
+    return this->operator=<MatrixView<DataType, 1> >(v);
+  }
+
+  template<typename T>
+  inline void copy_from(const T & s) {
+    CHECK_EQ(column, static_cast<size_t>(s.get_row() * s.get_column()));
+    convert(base, s.raw_data(), column);
+  }
+
+  inline void clear_data() {
+    std::fill(base, base + column, 0);
+  }
+
+  inline DataType eval(size_t i, size_t j) const { return base[j]; }
+
+  inline typename packet::Packet<DataType>::type packet(size_t i,
+                                                        size_t j) const {
+    return packet::Packet<DataType>::load(base + j);
+  }
+
+  inline DataType & at(size_t i, size_t j) const { return base[j]; }
+  inline DataType * raw_data() const { return base; }
+  inline DataType * row_ptr(size_t i) const { return base; }
+  inline const MatrixShape<1> & get_shape() const { return shape; }
+  inline size_t get_row() const { return 1; }
+  inline size_t get_column() const { return column; }
+  inline size_t get_stride() const { return column; }
+  inline size_t get_size() const { return column; }
+
+ private:
+  DataType * base;
+  MatrixShape<1> shape;
+  size_t column;
+};
+
+template<typename DataType, size_t N>
+struct ShapeCheck<MatrixView<DataType, N>, N> {
+  inline static MatrixShape<N> check(const MatrixView<DataType, N> & e) {
+    return e.get_shape();
+  }
+};
+
+/**
+ * a one-dimension view in a two-dimension expression is a 1 x n row
+ */
+template<typename DataType>
+struct ShapeCheck<MatrixView<DataType, 1>, 2> {
+  inline static MatrixShape<2> check(const MatrixView<DataType, 1> & e) {
+    MatrixShape<2> s { 1, e.get_column() };
+    return s;
+  }
+};
+
+template<typename DataType, size_t N>
+struct PacketCheck<MatrixView<DataType, N> > {
+  static const bool value = (packet::Packet<DataType>::size > 1);
+};
+
+}  //namespace matrix
+}  //namespace snoopy
+
+#endif /* SNOOPY_MATRIX_VIEW_H_ */
@@ -0,0 +1,306 @@
+/**
+ *  \file packet.h
+ *  \brief SIMD packet abstraction used by the expression templates.
+ *
+ *  A packet is a group of adjacent elements that can be loaded, computed and
+ *  stored with one SIMD instruction. Packet<DataType>::size is the number of
+ *  elements in one packet; it is 16 floats with AVX-512, 8 floats with AVX
+ *  and 1 (no vectorization) otherwise. The packet type is selected at compile
+ *  time, so build with -mavx2/-mavx512f (or -march=native) to enable it.
+ *
+ *  Example:
+ *    typedef packet::Packet<float> P;
+ *    P::type v = P::load(src);
+ *    P::store(dst, packet::add(v, P::set1(1.f)));
+ */
+
+#ifndef SNOOPY_MATRIX_PACKET_H_
+#define SNOOPY_MATRIX_PACKET_H_
+
+#include <cstddef>
+#include <cmath>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+namespace snoopy {
+namespace matrix {
+namespace packet {
+
+/**
+ * scalar fallback, one element per packet
+ */
+template<typename DataType>
+struct Packet {
+  typedef DataType type;
+  static const size_t size = 1;
+  inline static type load(const DataType * p) { return *p; }
+  inline static void store(DataType * p, const type & v) { *p = v; }
+  inline static type set1(const DataType & s) { return s; }
+};
+
+template<typename T>
+inline T add(const T & l, const T & r) { return l + r; }
+template<typename T>
+inline T sub(const T & l, const T & r) { return l - r; }
+template<typename T>
+inline T mul(const T & l, const T & r) { return l * r; }
+template<typename T>
+inline T div(const T & l, const T & r) { return l / r; }
+template<typename T>
+inline T max(const T & l, const T & r) { return l < r ? r : l; }
+template<typename T>
+inline T exp(const T & x) { return std::exp(x); }
+
+/**
+ * horizontal reduction of one packet to a scalar
+ */
+template<typename T>
+inline T hsum(const T & v) { return v; }
+template<typename T>
+inline T hmax(const T & v) { return v; }
+
+/**
+ * element-wise exp of a packet through its lanes, used when there is no
+ * vectorized exp for the packet type
+ */
+template<typename DataType>
+inline typename Packet<DataType>::type exp_lanes(
+    const typename Packet<DataType>::type & x) {
+  DataType lanes[Packet<DataType>::size];
+  Packet<DataType>::store(lanes, x);
+  for (size_t i = 0; i < Packet<DataType>::size; ++i) {
+    lanes[i] = std::exp(lanes[i]);
+  }
+  return Packet<DataType>::load(lanes);
+}
+
+/**
+ * coefficients of the cephes expf polynomial, exp(x) = 2^n * exp(r) with
+ * r = x - n * ln2 in [-ln2/2, ln2/2]
+ */
+namespace cephes {
+const float exp_hi = 88.3762626647949f;
+const float exp_lo = -88.3762626647949f;
+const float log2e = 1.44269504088896341f;
+const float ln2_c1 = 0.693359375f;
+const float ln2_c2 = -2.12194440e-4f;
+const float exp_p0 = 1.9875691500E-4f;
+const float exp_p1 = 1.3981999507E-3f;
+const float exp_p2 = 8.3334519073E-3f;
+const float exp_p3 = 4.1665795894E-2f;
+const float exp_p4 = 1.6666665459E-1f;
+const float exp_p5 = 5.0000001201E-1f;
+}  //namespace cephes
+
+#if defined(__AVX512F__)
+
+template<>
+struct Packet<float> {
+  typedef __m512 type;
+  static const size_t size = 16;
+  inline static type load(const float * p) { return _mm512_loadu_ps(p); }
+  inline static void store(float * p, const type & v) { _mm512_storeu_ps(p, v); }
+  inline static type set1(const float & s) { return _mm512_set1_ps(s); }
+};
+
+template<>
+struct Packet<double> {
+  typedef __m512d type;
+  static const size_t size = 8;
+  inline static type load(const double * p) { return _mm512_loadu_pd(p); }
+  inline static void store(double * p, const type & v) { _mm512_storeu_pd(p, v); }
+  inline static type set1(const double & s) { return _mm512_set1_pd(s); }
+};
+
+inline __m512 add(const __m512 & l, const __m512 & r) { return _mm512_add_ps(l, r); }
+inline __m512 sub(const __m512 & l, const __m512 & r) { return _mm512_sub_ps(l, r); }
+inline __m512 mul(const __m512 & l, const __m512 & r) { return _mm512_mul_ps(l, r); }
+inline __m512 div(const __m512 & l, const __m512 & r) { return _mm512_div_ps(l, r); }
+inline __m512 max(const __m512 & l, const __m512 & r) { return _mm512_max_ps(l, r); }
+
+inline __m512d add(const __m512d & l, const __m512d & r) { return _mm512_add_pd(l, r); }
+inline __m512d sub(const __m512d & l, const __m512d & r) { return _mm512_sub_pd(l, r); }
+inline __m512d mul(const __m512d & l, const __m512d & r) { return _mm512_mul_pd(l, r); }
+inline __m512d div(const __m512d & l, const __m512d & r) { return _mm512_div_pd(l, r); }
+inline __m512d max(const __m512d & l, const __m512d & r) { return _mm512_max_pd(l, r); }
+
+inline float hsum(const __m512 & v) { return _mm512_reduce_add_ps(v); }
+inline float hmax(const __m512 & v) { return _mm512_reduce_max_ps(v); }
+inline double hsum(const __m512d & v) { return _mm512_reduce_add_pd(v); }
+inline double hmax(const __m512d & v) { return _mm512_reduce_max_pd(v); }
+inline __m512d exp(const __m512d & x) { return exp_lanes<double>(x); }
+
+inline __m512 exp(const __m512 & v) {
+  using namespace cephes;
+  __m512 x = _mm512_min_ps(v, _mm512_set1_ps(exp_hi));
+  x = _mm512_max_ps(x, _mm512_set1_ps(exp_lo));
+  __m512 fx = _mm512_fmadd_ps(x, _mm512_set1_ps(log2e), _mm512_set1_ps(0.5f));
+  fx = _mm512_roundscale_ps(fx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+  x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(ln2_c1), x);
+  x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(ln2_c2), x);
+  __m512 z = _mm512_mul_ps(x, x);
+  __m512 y = _mm512_set1_ps(exp_p0);
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(exp_p1));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(exp_p2));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(exp_p3));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(exp_p4));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(exp_p5));
+  y = _mm512_fmadd_ps(y, z, x);
+  y = _mm512_add_ps(y, _mm512_set1_ps(1.f));
+  __m512i n = _mm512_cvttps_epi32(fx);
+  n = _mm512_slli_epi32(_mm512_add_epi32(n, _mm512_set1_epi32(0x7f)), 23);
+  return _mm512_mul_ps(y, _mm512_castsi512_ps(n));
+}
+
+#elif defined(__AVX__)
+
+template<>
+struct Packet<float> {
+  typedef __m256 type;
+  static const size_t size = 8;
+  inline static type load(const float * p) { return _mm256_loadu_ps(p); }
+  inline static void store(float * p, const type & v) { _mm256_storeu_ps(p, v); }
+  inline static type set1(const float & s) { return _mm256_set1_ps(s); }
+};
+
+template<>
+struct Packet<double> {
+  typedef __m256d type;
+  static const size_t size = 4;
+  inline static type load(const double * p) { return _mm256_loadu_pd(p); }
+  inline static void store(double * p, const type & v) { _mm256_storeu_pd(p, v); }
+  inline static type set1(const double & s) { return _mm256_set1_pd(s); }
+};
+
+inline __m256 add(const __m256 & l, const __m256 & r) { return _mm256_add_ps(l, r); }
+inline __m256 sub(const __m256 & l, const __m256 & r) { return _mm256_sub_ps(l, r); }
+inline __m256 mul(const __m256 & l, const __m256 & r) { return _mm256_mul_ps(l, r); }
+inline __m256 div(const __m256 & l, const __m256 & r) { return _mm256_div_ps(l, r); }
+inline __m256 max(const __m256 & l, const __m256 & r) { return _mm256_max_ps(l, r); }
+
+inline __m256d add(const __m256d & l, const __m256d & r) { return _mm256_add_pd(l, r); }
+inline __m256d sub(const __m256d & l, const __m256d & r) { return _mm256_sub_pd(l, r); }
+inline __m256d mul(const __m256d & l, const __m256d & r) { return _mm256_mul_pd(l, r); }
+inline __m256d div(const __m256d & l, const __m256d & r) { return _mm256_div_pd(l, r); }
+inline __m256d max(const __m256d & l, const __m256d & r) { return _mm256_max_pd(l, r); }
+
+inline float hsum(const __m256 & v) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+inline float hmax(const __m256 & v) {
+  __m128 s = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_max_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+inline double hsum(const __m256d & v) {
+  __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+inline double hmax(const __m256d & v) {
+  __m128d s = _mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_max_sd(s, _mm_unpackhi_pd(s, s)));
+}
+inline __m256d exp(const __m256d & x) { return exp_lanes<double>(x); }
+
+#if defined(__AVX2__)
+inline __m256 exp(const __m256 & v) {
+  using namespace cephes;
+  __m256 x = _mm256_min_ps(v, _mm256_set1_ps(exp_hi));
+  x = _mm256_max_ps(x, _mm256_set1_ps(exp_lo));
+  __m256 fx = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(log2e)),
+                            _mm256_set1_ps(0.5f));
+  fx = _mm256_floor_ps(fx);
+  x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(ln2_c1)));
+  x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(ln2_c2)));
+  __m256 z = _mm256_mul_ps(x, x);
+  __m256 y = _mm256_set1_ps(exp_p0);
+  y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(exp_p1));
+  y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(exp_p2));
+  y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(exp_p3));
+  y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(exp_p4));
+  y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(exp_p5));
+  y = _mm256_add_ps(_mm256_mul_ps(y, z), x);
+  y = _mm256_add_ps(y, _mm256_set1_ps(1.f));
+  __m256i n = _mm256_cvttps_epi32(fx);
+  n = _mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(0x7f)), 23);
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(n));
+}
+#else
+inline __m256 exp(const __m256 & x) { return exp_lanes<float>(x); }
+#endif
+
+#endif
+
+/**
+ * transpose a kTransBlock x kTransBlock tile
+ *   d[j * ldd + i] = alpha * s[i * lds + j]
+ */
+const size_t kTransBlock = 8;
+
+template<typename DataType>
+inline void transpose_block(const DataType * s, size_t lds, DataType * d,
+                            size_t ldd, DataType alpha) {
+  for (size_t i = 0; i < kTransBlock; ++i) {
+    for (size_t j = 0; j < kTransBlock; ++j) {
+      d[j * ldd + i] = alpha * s[i * lds + j];
+    }
+  }
+}
+
+#if defined(__AVX__)
+
+/**
+ * 8x8 float tile in registers: unpack, shuffle, then swap 128-bit lanes
+ */
+inline void transpose_block(const float * s, size_t lds, float * d,
+                            size_t ldd, float alpha) {
+  __m256 r0 = _mm256_loadu_ps(s);
+  __m256 r1 = _mm256_loadu_ps(s + lds);
+  __m256 r2 = _mm256_loadu_ps(s + 2 * lds);
+  __m256 r3 = _mm256_loadu_ps(s + 3 * lds);
+  __m256 r4 = _mm256_loadu_ps(s + 4 * lds);
+  __m256 r5 = _mm256_loadu_ps(s + 5 * lds);
+  __m256 r6 = _mm256_loadu_ps(s + 6 * lds);
+  __m256 r7 = _mm256_loadu_ps(s + 7 * lds);
+
+  __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+  __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+  __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+  __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+  __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+  __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+  __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+  __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+
+  r0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+  r1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+  r2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+  r3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+  r4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+  r5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+  r6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+  r7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+  const __m256 a = _mm256_set1_ps(alpha);
+  _mm256_storeu_ps(d, _mm256_mul_ps(a, _mm256_permute2f128_ps(r0, r4, 0x20)));
+  _mm256_storeu_ps(d + ldd, _mm256_mul_ps(a, _mm256_permute2f128_ps(r1, r5, 0x20)));
+  _mm256_storeu_ps(d + 2 * ldd, _mm256_mul_ps(a, _mm256_permute2f128_ps(r2, r6, 0x20)));
+  _mm256_storeu_ps(d + 3 * ldd, _mm256_mul_ps(a, _mm256_permute2f128_ps(r3, r7, 0x20)));
+  _mm256_storeu_ps(d + 4 * ldd, _mm256_mul_ps(a, _mm256_permute2f128_ps(r0, r4, 0x31)));
+  _mm256_storeu_ps(d + 5 * ldd, _mm256_mul_ps(a, _mm256_permute2f128_ps(r1, r5, 0x31)));
+  _mm256_storeu_ps(d + 6 * ldd, _mm256_mul_ps(a, _mm256_permute2f128_ps(r2, r6, 0x31)));
+  _mm256_storeu_ps(d + 7 * ldd, _mm256_mul_ps(a, _mm256_permute2f128_ps(r3, r7, 0x31)));
+}
+
+#endif
+
+}  //namespace packet
+}  //namespace matrix
+}  //namespace snoopy
+
+#endif /* SNOOPY_MATRIX_PACKET_H_ */
@@ -18,7 +18,7 @@ class Random {
     std::random_device r;
     std::mt19937 gen(r());
     std::uniform_real_distribution<> dis(a, b);
-    DataType * data = t.get_data()->data();
+    DataType * data = t.raw_data();
     for (size_t i = 0; i < t.get_capicity(); ++i) {
       data[i] = dis(gen);
     }
@@ -31,7 +31,7 @@ class Random {
     std::random_device r;
     std::mt19937 gen(r());
     std::normal_distribution<> dis(a, b);
-    DataType * data = t.get_data()->data();
+    DataType * data = t.raw_data();
     for (size_t i = 0; i < t.get_capicity(); ++i) {
       data[i] = dis(gen);
     }
@@ -0,0 +1,106 @@
+#include "binary_data_layer.h"
+#include "layer_factory.h"
+#include <algorithm>
+#include <vector>
+#include "../common/com_def.h"
+
+namespace snoopy {
+namespace ml{
+
+template <typename DataType>
+void BinaryDataFeedLayer<DataType>::init_spec_layer(const vector<Blob<DataType> *> & input_blob,
+                    const vector<Blob<DataType> *> & output_blob) {
+    data_param_ = this->layer_param_.data_param();
+    records_ = io::SlotRecords(data_param_.slot_size());
+}
+
+template <typename DataType>
+void BinaryDataFeedLayer<DataType>::clear() {
+    is_end_ = false;
+    records_.clear();
+    cursor_ = 0;
+    block_end_ = 0;
+    next_block_ = this->shard_id_;
+    skipped_blocks_ = 0;
+}
+
+template <typename DataType>
+int BinaryDataFeedLayer<DataType>::read_file() {
+    if (reader_.open(data_param_.filepath()) != snoopy::SUCCESS) {
+        LOG_FATAL << "Error open filepath " << data_param_.filepath();
+        return snoopy::FAILURE;
+    }
+    if (reader_.slot_size() != data_param_.slot_size()) {
+        LOG_FATAL << data_param_.filepath() << " has " << reader_.slot_size()
+                  << " slots, the feed " << data_param_.slot_size();
+        return snoopy::FAILURE;
+    }
+    //a replica without a block would end the epoch of a synchronous solver
+    if (static_cast<size_t>(this->shard_id_) >= reader_.num_blocks()) {
+        LOG_FATAL << data_param_.filepath() << " has " << reader_.num_blocks()
+                  << " blocks, fewer than the " << this->shard_num_ << " shards";
+        return snoopy::FAILURE;
+    }
+    clear();
+    return snoopy::SUCCESS;
+}
+
+template <typename DataType>
+int BinaryDataFeedLayer<DataType>::next_block() {
+    records_.clear();
+    cursor_ = 0;
+    block_end_ = 0;
+    //max_line counts the samples of the whole file, as the lines of the
+    //text feed do
+    const uint64_t max_line = std::max(data_param_.max_line(), 0);
+    while (next_block_ < reader_.num_blocks()) {
+        const size_t b = next_block_;
+        const uint64_t first_record = reader_.block_info(b).first_record;
+        if (first_record >= max_line) {
+            return snoopy::FAILURE;
+        }
+        next_block_ += this->shard_num_;
+        if (reader_.read_block(b, records_, data_param_.slot_capicity()) == snoopy::SUCCESS) {
+            block_end_ = std::min<uint64_t>(records_.size(), max_line - first_record);
+            return snoopy::SUCCESS;
+        }
+        //the error is logged by the reader, the epoch goes on
+        LOG_WARNING << "skip block " << b << " of " << data_param_.filepath();
+        ++skipped_blocks_;
+    }
+    return snoopy::FAILURE;
+}
+
+template <typename DataType>
+int BinaryDataFeedLayer<DataType>::get_data(std::vector<matrix::Blob<DataType> *> & output_blob) {
+   CHECK_EQ(output_blob.size(), this->data_param_.slot_size());
+   CHECK_EQ(output_blob[0]->dim_at(0), this->data_param_.batch_size());
+   CHECK_EQ(output_blob[0]->dim_at(1), this->data_param_.slot_capicity());
+   const size_t batch_size = data_param_.batch_size();
+   const size_t slot_capicity = data_param_.slot_capicity();
+   std::vector<DataType *> slots(output_blob.size());
+   for (size_t row = 0; row < batch_size; ) {
+       if (cursor_ == block_end_) {
+           //a last partial batch is dropped, as by the text feed
+           if (next_block() != snoopy::SUCCESS) {
+               is_end_ = true;
+               return snoopy::SUCCESS;
+           }
+           continue;
+       }
+       const size_t n = std::min(batch_size - row, block_end_ - cursor_);
+       for (size_t j = 0; j < output_blob.size(); ++j) {
+           slots[j] = output_blob[j]->get_data()->data_->data() + row * slot_capicity;
+       }
+       this->fill_slot_rows(records_, cursor_, n, slot_capicity, slots);
+       cursor_ += n;
+       row += n;
+   }
+   return snoopy::SUCCESS;
+}
+
+//regesite
+LAYER_REGISTER_CLASS(BinaryDataFeed)
+
+}
+}
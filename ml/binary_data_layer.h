@@ -0,0 +1,77 @@
+#ifndef SNOOPY_ML_BINARY_DATA_H
+#define SNOOPY_ML_BINARY_DATA_H
+
+#include "layer.h"
+#include "data_layer.h"
+#include "../io/record_file.h"
+
+namespace snoopy {
+namespace ml{
+
+/**
+ * feed of a record file of io/record_file.h, see tools/text_to_record.cpp
+ * for the conversion from the text format of TextDataFeedLayer
+ *
+ * The file is mapped and one block at a time is decoded, nothing is parsed
+ * and the memory is a block whatever the size of the file. The shard of a
+ * replica is every shard_num-th block, each replica needs one at least;
+ * max_line bounds the samples of the whole file, not of a shard.
+ * A corrupt block is logged and skipped, the epoch goes on with the next
+ * block of the shard.
+ */
+template <typename DataType>
+class BinaryDataFeedLayer : public DataFeedLayer<DataType> {
+    private:
+        DataFeedParameter data_param_;
+        io::RecordReader reader_;
+        io::SlotRecords records_; //!< the samples of the decoded block
+        size_t cursor_; //!< the next sample of records_
+        size_t next_block_;
+        size_t block_end_; //!< samples of records_ within max_line
+        size_t skipped_blocks_; //!< corrupt blocks of the epoch
+        bool is_end_;
+
+        /**
+         * decode the next block of the shard into records_, skipping the
+         * corrupt ones
+         *
+         * @return FAILURE if the shard has no block left
+         */
+        int next_block();
+
+    public:
+     explicit BinaryDataFeedLayer(const LayerParameter & para) :
+         DataFeedLayer<DataType>(para),
+         cursor_(0),
+         next_block_(0),
+         block_end_(0),
+         skipped_blocks_(0),
+         is_end_(false) {}
+
+        virtual void init_spec_layer(const vector<Blob<DataType> *> & input_blob,
+                    const vector<Blob<DataType> *> & output_blob);
+
+        virtual void clear();
+
+        virtual bool is_end() {
+           return is_end_;
+        }
+
+        /**
+         * corrupt blocks skipped in the epoch
+         */
+        size_t skipped_blocks() const {
+           return skipped_blocks_;
+        }
+
+        virtual int read_file();
+
+        virtual int get_data(std::vector<matrix::Blob<DataType> *> & output_blob);
+        inline virtual int exact_bottom_blob() {return 0;}
+        inline virtual int exact_top_blob() {return data_param_.slot_size(); }
+};
+
+}
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define SNOOPY_ML_DATA_LAYER_H
 
 #include "layer.h"
+#include "../io/slot_parser.h"
 
 namespace snoopy {
 namespace ml{
@@ -10,15 +11,54 @@ template <typename DataType>
 class DataFeedLayer : public Layer<DataType> {
     public:
        explicit DataFeedLayer(const LayerParameter & para) :
-         Layer<DataType>(para) {}
+         Layer<DataType>(para), shard_id_(0), shard_num_(1) {}
         virtual void clear() = 0;
         virtual int read_file() = 0;
         virtual bool is_end() = 0;
         virtual int get_data(std::vector<matrix::Blob<DataType> *> & output_blob) = 0;
 
+        /**
+         * feed only the shard `shard_id` of `shard_num` of the data, the
+         * replicas of a multithreaded solver each read their own shard;
+         * call it before read_file()
+         */
+        virtual void set_shard(int shard_id, int shard_num) {
+            CHECK_GE(shard_id, 0);
+            CHECK_LT(shard_id, shard_num);
+            shard_id_ = shard_id;
+            shard_num_ = shard_num;
+        }
+
         virtual void reshape(const vector<Blob<DataType> *> & input_blob,
                         const vector<Blob<DataType> *> & output_blob) {}
     protected:
+      int shard_id_;
+      int shard_num_;
+
+      /**
+       * write the samples [first, first + n) of `records` into rows 0 .. n - 1
+       * of the slot matrices, the ids past the end of a slot are -1
+       *
+       * @param slots: the data of the matrix of each slot, slot_capicity columns
+       */
+      static void fill_slot_rows(const io::SlotRecords & records, size_t first, size_t n,
+                                 size_t slot_capicity, const std::vector<DataType *> & slots) {
+          for (size_t i = 0; i < n; ++i) {
+              for (size_t j = 0; j < slots.size(); ++j) {
+                  DataType * row = slots[j] + i * slot_capicity;
+                  const int * ids = records.slot_begin(first + i, j);
+                  const size_t len = records.slot_length(first + i, j);
+                  size_t k = 0;
+                  for (; k < len; ++k) {
+                      row[k] = ids[k];
+                  }
+                  for (; k < slot_capicity; ++k) {
+                      row[k] = -1;
+                  }
+              }
+          }
+      }
+
       virtual void forward_cpu(const vector<Blob<DataType> *> & input_blob,
                         const vector<Blob<DataType> *> & output_blob) {}
 
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "emb_layer.h"
 #include "layer_factory.h"
 
@@ -24,6 +25,13 @@ void EmbeddingLayer<DataType>::init_spec_layer(const vector<Blob<DataType> *> &
     size_t output_dim1 = output_blob[0]->dim_at(1);
     CHECK_EQ(output_dim0, input_dim0 * slot_capicity);
     CHECK_EQ(output_dim1, this->param_blob_[0]->dim_at(1));
+
+    //the gradient only has the rows of the ids in the batch
+    this->param_blob_[0]->set_sparse_diff(shared_ptr<SparseRows<DataType> >(
+                new SparseRows<DataType>(output_dim0, output_dim1)));
+    //the dense diff of the table is never written, it is as big as the table
+    this->param_blob_[0]->set_diff(shared_ptr<MBlob<DataType> >());
+    id_pos_.reserve(output_dim0);
 }
 
 template<typename DataType>
@@ -45,7 +53,7 @@ void EmbeddingLayer<DataType>::forward_cpu(const vector<Blob<DataType> *> & inpu
             if (index < 0) {
                 out_matrix[i*slot_capicity+j].clear_data();
                 continue;
-            } else if(index > param_matrix.get_row()) {
+            } else if(index >= param_matrix.get_row()) {
                LOG_FATAL << "index :" << index << " should be less than " << param_matrix.get_row();
             }
             out_matrix[i*slot_capicity+j].copy_from(param_matrix[index]);
@@ -57,7 +65,37 @@ template<typename DataType>
 void EmbeddingLayer<DataType>::backward_cpu(const vector<Blob<DataType> *> & input_blob,
                   const vector<bool> & need_bp,
                   const vector<Blob<DataType> *> & output_blob) {
-    //dot nothing
+    //the ids have no gradient, the parameter gets a row-sparse one
+    if (!this->param_need_bp(0)) {
+        return;
+    }
+    Matrix<DataType, 2> input_matrix = input_blob[0]->get_data()->flatten_2d_matrix();
+    Matrix<DataType, 2> out_diff_matrix = output_blob[0]->get_diff()->flatten_2d_matrix();
+    SparseRows<DataType> & grad = *this->param_blob_[0]->get_sparse_diff();
+
+    //sorted by id, the positions of the same id become neighbours
+    id_pos_.clear();
+    for (size_t i = 0; i < input_matrix.get_row(); ++i) {
+        for (size_t j = 0; j < input_matrix.get_column(); ++j) {
+            int index = input_matrix[i][j];
+            if (index >= 0) {
+                id_pos_.push_back(std::make_pair(static_cast<size_t>(index), i * slot_capicity + j));
+            }
+        }
+    }
+    std::sort(id_pos_.begin(), id_pos_.end());
+
+    //coalesce the duplicate ids
+    grad.clear();
+    for (size_t k = 0; k < id_pos_.size(); ++k) {
+        if (k == 0 || id_pos_[k].first != id_pos_[k - 1].first) {
+            grad.rows_.push_back(id_pos_[k].first);
+            grad.values_[grad.size() - 1].copy_from(out_diff_matrix[id_pos_[k].second]);
+        } else {
+            grad.values_[grad.size() - 1] = grad.values_[grad.size() - 1] +
+                out_diff_matrix[id_pos_[k].second];
+        }
+    }
 }
 
 //regesite
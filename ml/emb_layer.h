@@ -20,6 +20,8 @@ public:
      virtual void reshape(const vector<Blob<DataType> *> & input_blob,
                     const vector<Blob<DataType> *> & output_blob);
 
+     virtual bool bp_need_output_data() { return false; }
+
      virtual int exact_bottom_blob() { return 1; }
      virtual int exact_top_blob() { return 1; }
 
@@ -32,6 +34,7 @@ protected:
                       const vector<Blob<DataType> *> & output_blob);
 
   int slot_capicity;
+  vector<std::pair<size_t, size_t> > id_pos_; //!< (id, output row) of a batch
 
 };
     
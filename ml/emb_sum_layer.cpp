@@ -0,0 +1,109 @@
+#include <algorithm>
+#include "emb_sum_layer.h"
+#include "layer_factory.h"
+
+namespace snoopy {
+namespace ml {
+/*
+ * input: M * slot_capicity ids, output: M * N, N is the embedding dim
+ *
+ */
+template<typename DataType>
+void EmbeddingSumLayer<DataType>::init_spec_layer(const vector<Blob<DataType> *> & input_blob,
+             const vector<Blob<DataType> *> & output_blob) {
+    //check
+    size_t input_blob_size = input_blob.size();
+    size_t output_blob_size = output_blob.size();
+    CHECK_EQ(input_blob_size, 1);
+    CHECK_EQ(output_blob_size, 1);
+    size_t input_dim0 = input_blob[0]->dim_at(0);
+    size_t input_dim1 = input_blob[0]->dim_at(1);
+    CHECK_EQ(input_dim1, slot_capicity);
+
+    size_t output_dim0 = output_blob[0]->dim_at(0);
+    size_t output_dim1 = output_blob[0]->dim_at(1);
+    CHECK_EQ(output_dim0, input_dim0);
+    CHECK_EQ(output_dim1, this->param_blob_[0]->dim_at(1));
+
+    //a row-sparse gradient, at most one row per id of the batch
+    this->param_blob_[0]->set_sparse_diff(shared_ptr<SparseRows<DataType> >(
+                new SparseRows<DataType>(input_dim0 * slot_capicity, output_dim1)));
+    this->param_blob_[0]->set_diff(shared_ptr<MBlob<DataType> >());
+    id_sample_.reserve(input_dim0 * slot_capicity);
+}
+
+template<typename DataType>
+void EmbeddingSumLayer<DataType>::reshape(const vector<Blob<DataType> *> & input_blob,
+            const vector<Blob<DataType> *> & output_blob) {
+
+}
+
+template<typename DataType>
+void EmbeddingSumLayer<DataType>::forward_cpu(const vector<Blob<DataType> *> & input_blob,
+                 const vector<Blob<DataType> *> & output_blob) {
+    Matrix<DataType, 2> input_matrix = input_blob[0]->get_data()->flatten_2d_matrix();
+    Matrix<DataType, 2> out_matrix = output_blob[0]->get_data()->flatten_2d_matrix();
+    Matrix<DataType, 2> param_matrix = this->param_blob_[0]->get_data()->flatten_2d_matrix();
+    const size_t dim = out_matrix.get_column();
+
+    for (size_t i = 0; i < input_matrix.get_row(); ++i) {
+        DataType * out = out_matrix.row_ptr(i);
+        std::fill(out, out + dim, static_cast<DataType>(0));
+        for (size_t j = 0; j < input_matrix.get_column(); ++j) {
+            int index = input_matrix[i][j];
+            if (index < 0) {
+                continue;
+            } else if (index >= param_matrix.get_row()) {
+               LOG_FATAL << "index :" << index << " should be less than " << param_matrix.get_row();
+            }
+            const DataType * row = param_matrix.row_ptr(index);
+            for (size_t k = 0; k < dim; ++k) {
+                out[k] += row[k];
+            }
+        }
+    }
+}
+
+template<typename DataType>
+void EmbeddingSumLayer<DataType>::backward_cpu(const vector<Blob<DataType> *> & input_blob,
+                  const vector<bool> & need_bp,
+                  const vector<Blob<DataType> *> & output_blob) {
+    //the ids have no gradient, an id gets the output gradient of each sample
+    //it is in
+    if (!this->param_need_bp(0)) {
+        return;
+    }
+    Matrix<DataType, 2> input_matrix = input_blob[0]->get_data()->flatten_2d_matrix();
+    Matrix<DataType, 2> out_diff_matrix = output_blob[0]->get_diff()->flatten_2d_matrix();
+    SparseRows<DataType> & grad = *this->param_blob_[0]->get_sparse_diff();
+
+    //sorted by id, the samples of the same id become neighbours
+    id_sample_.clear();
+    for (size_t i = 0; i < input_matrix.get_row(); ++i) {
+        for (size_t j = 0; j < input_matrix.get_column(); ++j) {
+            int index = input_matrix[i][j];
+            if (index >= 0) {
+                id_sample_.push_back(std::make_pair(static_cast<size_t>(index), i));
+            }
+        }
+    }
+    std::sort(id_sample_.begin(), id_sample_.end());
+
+    //coalesce the duplicate ids
+    grad.clear();
+    for (size_t k = 0; k < id_sample_.size(); ++k) {
+        if (k == 0 || id_sample_[k].first != id_sample_[k - 1].first) {
+            grad.rows_.push_back(id_sample_[k].first);
+            grad.values_[grad.size() - 1].copy_from(out_diff_matrix[id_sample_[k].second]);
+        } else {
+            grad.values_[grad.size() - 1] = grad.values_[grad.size() - 1] +
+                out_diff_matrix[id_sample_[k].second];
+        }
+    }
+}
+
+//regesite
+LAYER_REGISTER_CLASS(EmbeddingSum)
+
+} //end namespace
+} //end namespace
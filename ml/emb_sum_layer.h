@@ -0,0 +1,50 @@
+#ifndef SNOOPY_ML_EMB_SUM_LAYER_H_
+#define SNOOPY_ML_EMB_SUM_LAYER_H_
+
+#include "layer.h"
+namespace snoopy {
+namespace ml {
+
+/**
+ * Embedding followed by Vsum in one layer: the output row of a sample is
+ * the sum of the embeddings of its ids, the embeddings of the ids are never
+ * written out one by one. The fusion pass of the net puts it in place of an
+ * Embedding read only by a Vsum; it takes the parameters of the Embedding.
+ */
+template<typename DataType>
+class EmbeddingSumLayer : public Layer<DataType> {
+public: 
+     explicit EmbeddingSumLayer(const LayerParameter & para) :
+         Layer<DataType>(para) {
+         if (para.has_emb_param()) {
+            slot_capicity = para.emb_param().slot_capicity();
+         }
+     }
+     virtual void init_spec_layer(const vector<Blob<DataType> *> & input_blob,
+                    const vector<Blob<DataType> *> & output_blob);
+
+     virtual void reshape(const vector<Blob<DataType> *> & input_blob,
+                    const vector<Blob<DataType> *> & output_blob);
+
+     virtual bool bp_need_output_data() { return false; }
+
+     virtual int exact_bottom_blob() { return 1; }
+     virtual int exact_top_blob() { return 1; }
+
+protected:
+  virtual void forward_cpu(const vector<Blob<DataType> *> & input_blob,
+                    const vector<Blob<DataType> *> & output_blob);
+
+  virtual void backward_cpu(const vector<Blob<DataType> *> & input_blob,
+                      const vector<bool> & need_bp,
+                      const vector<Blob<DataType> *> & output_blob);
+
+  int slot_capicity;
+  vector<std::pair<size_t, size_t> > id_sample_; //!< (id, sample) of a batch
+
+};
+    
+}
+}
+
+#endif
@@ -31,12 +31,30 @@ void FCLayer<DataType>::init_spec_layer(const vector<Blob<DataType> *> & input_b
     n_out_ = output_blob_dim1;
     n_nums_ = input_blob_dim0;
     is_add_bias_ = false;
+    activation_ = IDENTITY;
+    if (this->layer_param_.has_fc_param()) {
+        is_add_bias_ = this->layer_param_.fc_param().bias_term();
+        activation_ = this->layer_param_.fc_param().activation();
+    }
     Matrix<DataType, 2> param_matrix = this->param_blob_[0]->get_data()->flatten_2d_matrix();
 
-    //initialize the parameter
-    float a = -1. / sqrt(n_in_);
-    float b = -1. / sqrt(n_in_);
-    Random::uniform(param_matrix, a, b); 
+    //initialize the parameter, shared ones are the owner's business
+    if (!this->is_param_shared()) {
+        float a = -1. / sqrt(n_in_);
+        float b = 1. / sqrt(n_in_);
+        Random::uniform(param_matrix, a, b); 
+    }
+
+    //bias, (1, n_out)
+    if (is_add_bias_) {
+        if (this->param_blob_.size() < 2) {
+            BlobShape bias_shape {1, n_out_};
+            this->param_blob_.push_back(create_blob_object<DataType>(bias_shape, true));
+            Matrix<DataType, 2> bias_matrix = this->param_blob_[1]->get_data()->flatten_2d_matrix();
+            bias_matrix.clear_data();
+        }
+        CHECK_EQ(this->param_blob_[1]->get_count(), n_out_);
+    }
 }
 
 template<typename DataType>
@@ -51,34 +69,77 @@ void FCLayer<DataType>::forward_cpu(const vector<Blob<DataType> *> & input_blob,
     Matrix<DataType, 2> input_matrix = input_blob[0]->get_data()->flatten_2d_matrix();
     Matrix<DataType, 2> param_matrix = this->param_blob_[0]->get_data()->flatten_2d_matrix();
     Matrix<DataType, 2> out_matrix = output_blob[0]->get_data()->flatten_2d_matrix();
-    out_matrix.copy_from(dot(input_matrix, param_matrix));
+    const DataType * bias = nullptr;
+    if (is_add_bias_) {
+        bias = this->param_blob_[1]->get_data()->data_->data();
+    }
+    switch (activation_) {
+        case RELU:
+            linear<act::relu<DataType> >(out_matrix, input_matrix, param_matrix, bias);
+            break;
+        case SIGMOID:
+            linear<act::sigmoid<DataType> >(out_matrix, input_matrix, param_matrix, bias);
+            break;
+        case TANH:
+            linear<act::tanh<DataType> >(out_matrix, input_matrix, param_matrix, bias);
+            break;
+        case SOFTSIGN:
+            linear<act::softsign<DataType> >(out_matrix, input_matrix, param_matrix, bias);
+            break;
+        default:
+            linear<act::identity<DataType> >(out_matrix, input_matrix, param_matrix, bias);
+    }
 }
 
 template<typename DataType>
 void FCLayer<DataType>::backward_cpu(const vector<Blob<DataType> *> & input_blob,
                   const vector<bool> & need_bp,
                   const vector<Blob<DataType> *> & output_blob) {
-    //backward, transpose mat
     Matrix<DataType, 2>  output_diff_matrix = output_blob[0]->get_diff()->flatten_2d_matrix();
     Matrix<DataType, 2> param_matrix = this->param_blob_[0]->get_data()->flatten_2d_matrix();
     Matrix<DataType, 2> param_diff_matrix = this->param_blob_[0]->get_diff()->flatten_2d_matrix();
 
     Matrix<DataType, 2>  in_diff_matrix = input_blob[0]->get_diff()->flatten_2d_matrix();
     Matrix<DataType, 2> in_data_maxtrix = input_blob[0]->get_data()->flatten_2d_matrix();
-    //gradient with respect to input 
-    size_t dim0 = this->param_blob_[0]->dim_at(0);
-    size_t dim1 = this->param_blob_[0]->dim_at(1);
-    MatrixShape<2> mat_shape(0, {dim1, dim0});
-    Matrix<DataType, 2> trans_param_mat(mat_shape); //storage TODO @xinchao
-    transpose(trans_param_mat, param_matrix);
-    in_diff_matrix.copy_from(dot(output_diff_matrix, trans_param_mat));
-    //gradient with respect to weights
-    size_t in_dim0 = input_blob[0]->dim_at(0);
-    size_t in_dim1 = input_blob[0]->dim_at(1);
-    MatrixShape<2> trans_in_shape(0, {in_dim1, in_dim0});
-    Matrix<DataType, 2> in_trans_mat(trans_in_shape);
-    transpose(in_trans_mat, in_data_maxtrix);
-    param_diff_matrix.copy_from(dot(in_trans_mat, output_diff_matrix));
+
+    //gradient with respect to the activation input
+    const Matrix<DataType, 2> * delta_matrix = &output_diff_matrix;
+    Matrix<DataType, 2> act_diff = activation_ != IDENTITY ?
+        this->scratch_matrix(output_diff_matrix.get_shape()) : Matrix<DataType, 2>();
+    if (activation_ != IDENTITY) {
+        Matrix<DataType, 2> out_matrix = output_blob[0]->get_data()->flatten_2d_matrix();
+        switch (activation_) {
+            case RELU:
+                activation_grad<act::relu<DataType> >(act_diff, output_diff_matrix, out_matrix);
+                break;
+            case SIGMOID:
+                activation_grad<act::sigmoid<DataType> >(act_diff, output_diff_matrix, out_matrix);
+                break;
+            case TANH:
+                activation_grad<act::tanh<DataType> >(act_diff, output_diff_matrix, out_matrix);
+                break;
+            default:
+                activation_grad<act::softsign<DataType> >(act_diff, output_diff_matrix, out_matrix);
+        }
+        delta_matrix = &act_diff;
+    }
+    //gradient with respect to input: delta * W^T
+    if (this->need_bp_at(need_bp, 0)) {
+        if (this->add_bottom_diff(0)) {
+            in_diff_matrix += dot(*delta_matrix, CblasNoTrans, param_matrix, CblasTrans);
+        } else {
+            in_diff_matrix = dot(*delta_matrix, CblasNoTrans, param_matrix, CblasTrans);
+        }
+    }
+    //gradient with respect to weights: X^T * delta
+    if (this->param_need_bp(0)) {
+        param_diff_matrix = dot(in_data_maxtrix, CblasTrans, *delta_matrix, CblasNoTrans);
+    }
+    //gradient with respect to bias
+    if (is_add_bias_ && this->param_need_bp(1)) {
+        Matrix<DataType, 2> bias_diff_matrix = this->param_blob_[1]->get_diff()->flatten_2d_matrix();
+        sum(bias_diff_matrix, *delta_matrix, 0);
+    }
 }
 
 //regesite
@@ -16,6 +16,9 @@ public:
      virtual void reshape(const vector<Blob<DataType> *> & input_blob,
                     const vector<Blob<DataType> *> & output_blob);
 
+     //the output is only read for the gradient of the activation
+     virtual bool bp_need_output_data() { return activation_ != IDENTITY; }
+
      virtual int exact_bottom_blob() { return 1; }
      virtual int exact_top_blob() { return 1; }
 
@@ -30,7 +33,8 @@ protected:
   size_t n_in_;
   size_t n_out_;
   size_t n_nums_;
-  int is_add_bias_; //TODO
+  int is_add_bias_;
+  ActivationType activation_;
 };
     
 }
@@ -0,0 +1,125 @@
+/**
+ *  \file  fusion_pass.h
+ *  \brief rewrite of a net configure that fuses chains of layers
+ *
+ *  A chain of two layers where the second one is the only reader of the
+ *  blob the first one writes becomes a single layer, the blob between them
+ *  is never written:
+ *      FC -> RELU / Sigmoid / Tanh / Softsign  the activation of the FC
+ *      Embedding -> Vsum                       an EmbeddingSum layer
+ *  The fused layer keeps the name, the parameters and the learn rate of the
+ *  first layer, so the parameter names of a model file do not change. A
+ *  blob read after forward, or a layer with a loss weight, is not fused
+ *  away.
+ */
+
+#ifndef SNOOPY_ML_FUSION_PASS_H_
+#define SNOOPY_ML_FUSION_PASS_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "../proto/snoopy.pb.h"
+#include "../common/logging.h"
+
+namespace snoopy {
+namespace ml {
+
+/**
+ * the activation of a FC doing the work of a layer of type `type`, IDENTITY
+ * if there is none
+ */
+inline ActivationType fused_activation(const std::string & type) {
+    if (type == "RELU") {
+        return RELU;
+    } else if (type == "Sigmoid") {
+        return SIGMOID;
+    } else if (type == "Tanh") {
+        return TANH;
+    } else if (type == "Softsign") {
+        return SOFTSIGN;
+    }
+    return IDENTITY;
+}
+
+/**
+ * fuse the layers of `para` in place
+ *
+ * @return the number of the layers removed
+ */
+inline int fuse_layers(NetParameter & para) {
+    std::map<std::string, int> writer_num;
+    std::map<std::string, int> reader_num;
+    std::map<std::string, int> reader;
+    for (int i = 0; i < para.layer_param_size(); ++i) {
+        const LayerParameter & lp = para.layer_param(i);
+        for (int j = 0; j < lp.t_blob_name_size(); ++j) {
+            ++writer_num[lp.t_blob_name(j)];
+        }
+        for (int j = 0; j < lp.b_blob_name_size(); ++j) {
+            ++reader_num[lp.b_blob_name(j)];
+            reader[lp.b_blob_name(j)] = i;
+        }
+    }
+    std::set<std::string> outputs(para.output_blob_name().begin(),
+            para.output_blob_name().end());
+
+    std::vector<bool> is_removed(para.layer_param_size(), false);
+    int removed_num = 0;
+    for (int i = 0; i < para.layer_param_size(); ++i) {
+        LayerParameter * first = para.mutable_layer_param(i);
+        if (is_removed[i] || first->t_blob_name_size() != 1
+                || first->t_blob_shape_size() != 1) {
+            continue;
+        }
+        const std::string & blob_name = first->t_blob_name(0);
+        if (writer_num[blob_name] != 1 || reader_num[blob_name] != 1
+                || outputs.count(blob_name) != 0) {
+            continue;
+        }
+        const int k = reader[blob_name];
+        const LayerParameter & second = para.layer_param(k);
+        if (is_removed[k] || second.b_blob_name_size() != 1
+                || second.t_blob_name_size() != 1 || second.t_blob_shape_size() != 1
+                || second.has_loss_weight()) {
+            continue;
+        }
+
+        if (first->type() == "FC" && first->fc_param().activation() == IDENTITY
+                && fused_activation(second.type()) != IDENTITY) {
+            first->mutable_fc_param()->set_activation(fused_activation(second.type()));
+        } else if (first->type() == "Embedding" && second.type() == "Vsum"
+                && first->has_emb_param()
+                && second.t_blob_shape(0).dim(0) * first->emb_param().slot_capicity()
+                    == first->t_blob_shape(0).dim(0)) {
+            //vsum sums the slot_capicity rows of a sample
+            first->set_type("EmbeddingSum");
+        } else {
+            continue;
+        }
+        LOG_INFO << "fuse layer " << second.name() << " into layer " << first->name()
+                 << ", now of type " << first->type();
+        first->set_t_blob_name(0, second.t_blob_name(0));
+        first->mutable_t_blob_shape(0)->CopyFrom(second.t_blob_shape(0));
+        first->set_is_bp(first->is_bp() || second.is_bp());
+        is_removed[k] = true;
+        ++removed_num;
+    }
+
+    if (removed_num > 0) {
+        google::protobuf::RepeatedPtrField<LayerParameter> layers;
+        layers.Swap(para.mutable_layer_param());
+        for (int i = 0; i < layers.size(); ++i) {
+            if (!is_removed[i]) {
+                para.add_layer_param()->Swap(layers.Mutable(i));
+            }
+        }
+    }
+    return removed_num;
+}
+
+}
+}
+
+#endif
@@ -16,6 +16,12 @@ class InplaceLayer : public Layer<DataType> {
          virtual void reshape(const vector<Blob<DataType> *> & input_blob,
                         const vector<Blob<DataType> *> & output_blob) {}
 
+         /**
+          * the gradient is computed from the output, the input may be gone
+          */
+         virtual bool bp_need_input_data() { return false; }
+         virtual bool can_inplace() { return true; }
+
          virtual int exact_bottom_blob() { return 1; }
          virtual int exact_top_blob() { return 1; }
 };
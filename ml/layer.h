@@ -5,6 +5,7 @@
 #include "../common/utils.h"
 #include "../proto/snoopy.pb.h"
 #include "../matrix/matrix_blob.h"
+#include "../storage/arena_allocator.h"
 
 using namespace snoopy::matrix;
 
@@ -15,7 +16,9 @@ template<typename DataType>
 class Layer {
 public:
      explicit Layer(const LayerParameter & para) :
-         layer_param_(para), phrase_(para.phrase()) {
+         layer_param_(para), phrase_(para.phrase()), is_param_shared_(false),
+         scratch_arena_(nullptr),
+         loss_weight_(para.loss_weight()), loss_(0) {
          if (layer_param_.blob_size() > 0) {
             param_blob_.resize(layer_param_.blob_size());            
             for (int i = 0; i < param_blob_.size(); ++i) {
@@ -28,6 +31,8 @@ public:
 
      inline int init(const vector<Blob<DataType> *> & input_blob,
                     const vector<Blob<DataType> *> & output_blob) {
+         loss_weight_ = layer_param_.has_loss_weight() ?
+             static_cast<DataType>(layer_param_.loss_weight()) : default_loss_weight();
          init_spec_layer(input_blob, output_blob);
          reshape(input_blob, output_blob);
          //make sure 
@@ -47,7 +52,8 @@ public:
      * @param input_blob:  the input data blob
      * @param output_blob: the output data blob
      *
-     * @return the loss of the layer iff the nonzero loss weight
+     * @return the loss of the layer times its loss weight, 0 for the layers
+     *         that are no loss
      */
      inline DataType forward(const vector<Blob<DataType> *> & input_blob,
                         const vector<Blob<DataType> *> & output_blob);
@@ -65,6 +71,29 @@ public:
                           const vector<bool> & need_bp,
                           const vector<Blob<DataType> *> & output_blob);
 
+     /**
+      * loss weight of the layer when the configure has none, the loss
+      * layers weigh 1
+      */
+     inline virtual DataType default_loss_weight() {return 0;}
+
+     DataType get_loss_weight() {
+        return loss_weight_;
+     }
+
+     /**
+      * whether backward reads the data of the input blobs and of the output
+      * blobs, the net gives their memory to other blobs when it does not
+      */
+     inline virtual bool bp_need_input_data() {return true;}
+     inline virtual bool bp_need_output_data() {return true;}
+
+     /**
+      * the output may be written over the input and the input gradient over
+      * the output gradient
+      */
+     inline virtual bool can_inplace() {return false;}
+
      inline virtual int exact_bottom_blob() {return -1;}
      inline virtual int min_bottom_blob() {return -1;}
      inline virtual int max_bottom_blob() {return -1;}
@@ -85,11 +114,92 @@ public:
         return param_blob_;
      }
 
+     /**
+      * parameters of another net, before init; the layer does not
+      * initialize them
+      */
+     void set_param_blob(const vector<shared_ptr<Blob<DataType> > > & blobs) {
+        param_blob_ = blobs;
+        is_param_shared_ = true;
+     }
+
+     bool is_param_shared() {
+        return is_param_shared_;
+     }
+
+     /**
+      * whether backward computes the gradient of parameter blob i, true
+      * unless the net turned it off
+      */
+     bool param_need_bp(size_t i) {
+        return i >= param_blob_need_bp_.size() || param_blob_need_bp_[i];
+     }
+
+     void set_param_need_bp(size_t i, bool need_bp) {
+        if (param_blob_need_bp_.size() <= i) {
+            param_blob_need_bp_.resize(i + 1, true);
+        }
+        param_blob_need_bp_[i] = need_bp;
+     }
+
+     /**
+      * whether backward adds its gradient of bottom blob i to the diff
+      * instead of writing it, another reader of the blob wrote it first;
+      * false unless the net turned it on
+      */
+     bool add_bottom_diff(size_t i) {
+        return i < bottom_diff_add_.size() && bottom_diff_add_[i];
+     }
+
+     void set_add_bottom_diff(size_t i, bool is_add) {
+        if (bottom_diff_add_.size() <= i) {
+            bottom_diff_add_.resize(i + 1, false);
+        }
+        bottom_diff_add_[i] = is_add;
+     }
+
+     /**
+      * set the arena the scratch matrices come from, the net resets it
+      * after each backprop
+      */
+     void set_scratch_arena(storage::ArenaAllocator * arena) {
+        scratch_arena_ = arena;
+     }
+
  protected:
   LayerParameter layer_param_;
   Phrase phrase_;
   vector<shared_ptr<Blob<DataType> > > param_blob_;
   vector<bool> param_blob_need_bp_;
+  vector<bool> bottom_diff_add_;
+  bool is_param_shared_; //!< param_blob_ belongs to another net
+  storage::ArenaAllocator * scratch_arena_;
+  DataType loss_weight_;
+  DataType loss_; //!< set by forward_cpu of the loss layers
+
+  /**
+   * uninitialized matrix for temporaries, it is valid until the end of the
+   * current forward/backward step and must not be kept in the layer
+   *
+   * @param s: the shape of the matrix
+   *
+   * @return a matrix in the scratch arena, or in the default allocator when
+   *         the layer runs outside a net
+   */
+  template<size_t N>
+  Matrix<DataType, N> scratch_matrix(const MatrixShape<N> & s) {
+    storage::Allocator * a = scratch_arena_ != nullptr ?
+        static_cast<storage::Allocator *>(scratch_arena_) : storage::default_allocator();
+    return Matrix<DataType, N>(a, s);
+  }
+
+  /**
+   * whether backward computes the gradient of input blob i; the layers
+   * run outside a net get an empty need_bp and compute them all
+   */
+  static bool need_bp_at(const vector<bool> & need_bp, size_t i) {
+    return i >= need_bp.size() || need_bp[i];
+  }
 
   virtual void forward_cpu(const vector<Blob<DataType> *> & input_blob,
                     const vector<Blob<DataType> *> & output_blob) = 0;
@@ -130,9 +240,8 @@ public:
 template <typename DataType>
 inline DataType Layer<DataType>::forward(const vector<Blob<DataType> *> & input_blob,
                 const vector<Blob<DataType> *> & output_blob) {
-    DataType loss(0);
     forward_cpu(input_blob, output_blob);
-    return loss; //TODO
+    return loss_weight_ == 0 ? static_cast<DataType>(0) : loss_weight_ * loss_;
 } 
 
 template <typename DataType>
@@ -1,12 +1,20 @@
 #ifndef SNOOPY_ML_NN_H_
 #define SNOOPY_ML_NN_H_
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
 #include <vector>
 #include <map>
+#include <set>
 #include "layer.h"
 #include "../common/com_def.h"
+#include "../common/thread_pool.h"
 #include "layer_factory.h"
 #include "data_layer.h"
+#include "fusion_pass.h"
+#include "../storage/pool_allocator.h"
+#include "../storage/arena_allocator.h"
 
 //using namespace std;
 using std::shared_ptr;
@@ -19,24 +27,38 @@ namespace ml {
 template<typename DataType>
 class NeuralNet {
 public:
-  NeuralNet() {}
+  NeuralNet() : planned_blob_bytes_(0), naive_blob_bytes_(0) {}
   ~NeuralNet() {}
   /**
-   * create net from net parameter 
+   * create net from net parameter, the chains of layers that can run as one
+   * layer are fused first unless fuse_layers is off
    *
+   * @param para_owner: a net created from the same configure, this net uses
+   *        its parameters instead of allocating and filling its own; the
+   *        gradients stay private to each net
    */
-  int init(const NetParameter & para);
+  int init(const NetParameter & para, NeuralNet * para_owner = nullptr);
 
   /**
    * perform the forward process to compute the output of each layer
+   *
+   * @param loss: the sum of the losses of the layers times their loss weight
    */
   void forward(DataType * loss);
   
   /**
-   * compute the gradient w.r.t the parameter
+   * compute the gradient w.r.t the learnable parameters, only the layers
+   * between a learnable parameter and a loss run
    */
   void backprop();
 
+  /**
+   * make the parameters of this net the parameters of `other`, a net created
+   * from the same configure; the gradients and the activations stay private
+   * to each net, so several nets can train the same model
+   */
+  int share_para_blobs(NeuralNet & other);
+
   inline vector<Blob<DataType> * >&  get_input_blobs() {
       return input_blobs_;
   }
@@ -45,6 +67,13 @@ public:
     return para_blobs_;
   }
 
+  /**
+   * name of each parameter blob, "<layer name>/<index in the layer>"
+   */
+  vector<string> & get_para_blob_names() {
+    return para_blob_names_;
+  }
+
   vector<Blob<DataType> * > & get_learnable_para_blobs() {
     return learnable_para_blobs_;
   }
@@ -63,8 +92,62 @@ public:
     return input_feed_;
   }
 
+  /**
+   * the blobs of output_blob_name in the configure, the tops of the last
+   * layer run by default
+   */
   vector<Blob<DataType> * > & get_output_blobs() {
-    return top_blobs_[top_blobs_.size() - 1];
+    return output_blob_ptrs_;
+  }
+
+  /**
+   * the layers forward runs, in order; a layer comes after the layers that
+   * write its bottoms
+   */
+  const vector<int> & get_schedule() {
+    return schedule_;
+  }
+
+  /**
+   * the layers backprop runs, in reverse topological order, and whether
+   * each of their bottoms gets a gradient
+   */
+  const vector<int> & get_bp_schedule() {
+    return bp_schedule_;
+  }
+
+  const vector<bool> & get_bottom_need_bp(int layer_index) {
+    return bottom_blob_need_bp_[layer_index];
+  }
+
+  vector<string> & get_layer_names() {
+    return layer_names_;
+  }
+
+  /**
+   * bytes of the data and the gradients of the blobs between the layers,
+   * as planned and as one buffer per blob; the same without a memory plan
+   */
+  size_t get_planned_blob_bytes() {
+    return planned_blob_bytes_;
+  }
+
+  size_t get_naive_blob_bytes() {
+    return naive_blob_bytes_;
+  }
+
+  /**
+   * the allocator of the blobs and of the temporaries created by the layers
+   */
+  storage::Allocator * get_allocator() {
+    return allocator_ != nullptr ? allocator_.get() : storage::cpu_allocator();
+  }
+
+  /**
+   * the arena of the layer scratch matrices, reset after each backprop
+   */
+  storage::ArenaAllocator * get_scratch_arena() {
+    return scratch_arena_.get();
   }
 
   Blob<DataType> * get_label_blob() {
@@ -76,6 +159,59 @@ public:
   }
 
   private:
+  /**
+   * give layer `layer_index` the parameters of the same layer of `owner`,
+   * with gradients of its own
+   */
+  int share_layer_para_blobs(int layer_index, NeuralNet & owner);
+
+  /**
+   * order the layers by their blobs, and in TEST phase drop the ones the
+   * outputs do not depend on
+   */
+  int build_schedule(const NetParameter & para);
+
+  /**
+   * decide which layers run backward and which of their bottoms get a
+   * gradient: those with a learnable parameter or a layer with is_bp
+   * below, and a loss above
+   */
+  void init_need_bp();
+
+  /**
+   * give the blobs between the layers their memory: the blobs whose data,
+   * or gradient, is not used at the same time in a step share a buffer,
+   * and the layers that can run in place write over their input. The
+   * inputs and the outputs of the net keep their own memory.
+   *
+   * @param is_parallel: the layers do not run in the schedule order, only
+   *        the in place layers and the memory nothing uses are shared
+   */
+  void plan_memory(bool is_parallel);
+
+  /**
+   * the dependencies between the layers for the thread pool: in forward a
+   * layer waits for the writers of its bottoms, in backprop for the layers
+   * computing the gradient of its tops, and the layers writing the
+   * gradient of the same bottom run one after the other
+   */
+  void init_executor(int thread_num);
+
+  /**
+   * run the layers of `order` on the pool, each as soon as the layers it
+   * waits for are done
+   */
+  void run_layers(const vector<int> & order, const vector<int> & wait_num,
+                  const vector<vector<int> > & next_layers, bool is_forward);
+
+  void run_layer(int layer_index, const vector<vector<int> > & next_layers, bool is_forward);
+
+  /**
+   * declared first so that it is destroyed after every blob it allocated
+   */
+  shared_ptr<storage::Allocator> allocator_;
+  shared_ptr<storage::ArenaAllocator> scratch_arena_; //!< scratch of one step
+
   string net_name_; //!< network name
   Phrase net_type_; //!< train or test
 
@@ -92,6 +228,28 @@ public:
   vector<string> layer_names_; //!< layer names
   map<string, int> layer_name_index_dict_; //!< layer index
   vector<bool> layer_need_bp_;
+  vector<int> schedule_; //!< layers run by forward, in order
+  vector<int> bp_schedule_; //!< layers run by backprop, in order
+
+  /**
+   * parallel execution of the layers, without a pool the schedules are run
+   * in order in the calling thread
+   */
+  shared_ptr<ThreadPool> pool_;
+  vector<int> wait_num_; //!< layers a layer waits for in forward
+  vector<vector<int> > next_layers_; //!< layers waiting for a layer in forward
+  vector<int> bp_wait_num_;
+  vector<vector<int> > bp_next_layers_;
+  std::unique_ptr<std::atomic<int>[]> wait_counter_; //!< of the current pass
+  vector<DataType> layer_loss_;
+  vector<shared_ptr<storage::ArenaAllocator> > layer_arenas_; //!< a scratch arena per layer
+
+  /**
+   * memory of the blobs between the layers, data and gradient, with the
+   * memory plan and without
+   */
+  size_t planned_blob_bytes_;
+  size_t naive_blob_bytes_;
 
   /**
    * inter data for layers
@@ -127,6 +285,7 @@ public:
    * parameters
    */
   vector<shared_ptr<Blob<DataType> > > para_blobs_;
+  vector<string> para_blob_names_;
   vector<Blob<DataType> * > learnable_para_blobs_; //defalut,learnable
 
   vector<int> learnable_para_ids_;
@@ -135,7 +294,11 @@ public:
 };
 
 template <typename DataType>
-int NeuralNet<DataType>::init(const NetParameter & para) {
+int NeuralNet<DataType>::init(const NetParameter & net_para, NeuralNet * para_owner) {
+    NetParameter para(net_para);
+    if (para.fuse_layers()) {
+        fuse_layers(para);
+    }
     if (para.has_name()) {
         net_name_ = para.name();
     } else {
@@ -155,9 +318,29 @@ int NeuralNet<DataType>::init(const NetParameter & para) {
         return snoopy::FAILURE;
     }
 
+    if (para.allocator() == POOL_ALLOCATOR) {
+        allocator_ = shared_ptr<storage::Allocator>(new storage::PoolAllocator);
+    }
+    storage::AllocatorScope allocator_scope(get_allocator());
+    scratch_arena_ = shared_ptr<storage::ArenaAllocator>(
+            new storage::ArenaAllocator(get_allocator()));
+
+    if (para_owner != nullptr && para_owner->layers_.size() != para.layer_param_size()) {
+        LOG_ERROR << "share the parameters of a net of another configure";
+        return snoopy::FAILURE;
+    }
     for (int layer_index = 0; layer_index < para.layer_param_size(); ++layer_index) {
         LayerParameter lp = para.layer_param(layer_index);
+        if (para_owner != nullptr) {
+            //the layer gets the parameters of para_owner, none is allocated
+            lp.clear_blob();
+        }
         layers_.push_back(LayerRegiste<DataType>::create_layer(lp));
+        if (para_owner != nullptr &&
+                share_layer_para_blobs(layer_index, *para_owner) != snoopy::SUCCESS) {
+            return snoopy::FAILURE;
+        }
+        layers_[layer_index]->set_scratch_arena(scratch_arena_.get());
         layer_names_.push_back(lp.name());
         layer_name_index_dict_[lp.name()] = layer_index;
         layer_need_bp_.push_back(lp.is_bp());
@@ -170,6 +353,7 @@ int NeuralNet<DataType>::init(const NetParameter & para) {
 
     //input data
     int net_blob_index(0);
+    storage::Buffer<DataType> * empty_buffer = new storage::Buffer<DataType>(get_allocator(), 0);
     //layer output data
     for (int layer_index = 0; layer_index < para.layer_param_size(); ++layer_index) {
         //input blob
@@ -189,13 +373,18 @@ int NeuralNet<DataType>::init(const NetParameter & para) {
 
         for (int t_blob_index = 0; t_blob_index < para.layer_param(layer_index).t_blob_name_size(); 
                 ++t_blob_index) {
-            shared_ptr<Blob<DataType> > tmp_blob = create_blob_object<DataType>(
-                    para.layer_param(layer_index).t_blob_shape(t_blob_index), true);
+            //with the memory plan the blob only has its shape until plan_memory
+            BlobShape shape(para.layer_param(layer_index).t_blob_shape(t_blob_index));
+            shared_ptr<Blob<DataType> > tmp_blob = para.share_blob_memory() ?
+                shared_ptr<Blob<DataType> >(new Blob<DataType>(new MBlob<DataType>(empty_buffer, shape))) :
+                create_blob_object<DataType>(shape, true);
             blob_.push_back(tmp_blob);
             blob_name_index_dict_[para.layer_param(layer_index).t_blob_name(t_blob_index)] = net_blob_index++;
         }
     }
 
+    empty_buffer->unref();
+
     for (auto iter = blob_name_index_dict_.begin(); iter != blob_name_index_dict_.end(); ++iter) {
         cerr << iter->first << "\t" << blob_[iter->second]->dim_at(0) << "\t" << blob_[iter->second]->dim_at(1) << endl;
     }
@@ -242,14 +431,47 @@ int NeuralNet<DataType>::init(const NetParameter & para) {
         layers_[layer_index]->init(layer_bottom_blobs, layer_top_blobs);
     }
 
-    //layer param data
-    size_t learnable_id(0);
+    //layer param data, a parameter with a lr_multi that is not positive is
+    //frozen and gets no gradient
     for (int layer_index = 0; layer_index < para.layer_param_size(); ++ layer_index) {
+        const float lr_multi = para.layer_param(layer_index).lr().lr_multi();
         for (int para_blob_index = 0; para_blob_index < layers_[layer_index]->get_param_blob().size(); 
                 ++para_blob_index) {
            para_blobs_.push_back(layers_[layer_index]->get_param_blob()[para_blob_index]);
-           learnable_para_blobs_.push_back(layers_[layer_index]->get_param_blob()[para_blob_index].get());
-           learnable_para_ids_.push_back(learnable_id);
+           para_blob_names_.push_back(layer_names_[layer_index] + "/" + std::to_string(para_blob_index));
+           layers_[layer_index]->set_param_need_bp(para_blob_index, lr_multi > 0);
+        }
+    }
+    if (build_schedule(para) != snoopy::SUCCESS) {
+        return snoopy::FAILURE;
+    }
+    init_need_bp();
+    if (para.share_blob_memory()) {
+        plan_memory(para.layer_thread_num() > 1);
+    } else {
+        for (size_t b = 0; b < blob_.size(); ++b) {
+            if (blob_[b]->get_diff() != nullptr) {
+                naive_blob_bytes_ += 2 * blob_[b]->get_count() * sizeof(DataType);
+            }
+        }
+        planned_blob_bytes_ = naive_blob_bytes_;
+    }
+    if (para.layer_thread_num() > 1) {
+        init_executor(para.layer_thread_num());
+    }
+
+    //learnable: not frozen, and under a loss so that backprop computes it
+    for (int layer_index = 0, para_id = 0; layer_index < para.layer_param_size(); ++ layer_index) {
+        for (int para_blob_index = 0; para_blob_index < layers_[layer_index]->get_param_blob().size(); 
+                ++para_blob_index, ++para_id) {
+           if (!layer_need_bp_[layer_index]) {
+               layers_[layer_index]->set_param_need_bp(para_blob_index, false);
+           }
+           if (!layers_[layer_index]->param_need_bp(para_blob_index)) {
+               continue;
+           }
+           learnable_para_blobs_.push_back(para_blobs_[para_id].get());
+           learnable_para_ids_.push_back(para_id);
            learnable_para_lr_.push_back(para.layer_param(layer_index).lr().lr_multi());
            has_learnable_para_lr_.push_back(true);
         }
@@ -257,21 +479,560 @@ int NeuralNet<DataType>::init(const NetParameter & para) {
     return snoopy::SUCCESS;
 }
 
+template <typename DataType>
+void NeuralNet<DataType>::init_need_bp() {
+    //in the schedule order: a blob needs a gradient iff a learnable
+    //parameter, or a layer with is_bp, is below it
+    blob_need_bp_.assign(blob_.size(), false);
+    bottom_blob_need_bp_.resize(layers_.size());
+    top_blob_need_bp_.resize(layers_.size());
+    vector<bool> need_bp(layers_.size(), false);
+    for (size_t s = 0; s < schedule_.size(); ++s) {
+        const int layer_index = schedule_[s];
+        bool layer_need_bp = layer_need_bp_[layer_index];
+        for (size_t p = 0; p < layers_[layer_index]->get_param_blob().size(); ++p) {
+            layer_need_bp = layer_need_bp || layers_[layer_index]->param_need_bp(p);
+        }
+        bottom_blob_need_bp_[layer_index].clear();
+        for (size_t j = 0; j < bottom_blob_ids_[layer_index].size(); ++j) {
+            const bool bottom_need_bp = blob_need_bp_[bottom_blob_ids_[layer_index][j]];
+            bottom_blob_need_bp_[layer_index].push_back(bottom_need_bp);
+            layer_need_bp = layer_need_bp || bottom_need_bp;
+        }
+        for (size_t j = 0; j < top_blob_ids_[layer_index].size(); ++j) {
+            blob_need_bp_[top_blob_ids_[layer_index][j]] = layer_need_bp;
+        }
+        need_bp[layer_index] = layer_need_bp;
+    }
+
+    //in the reverse order: a layer gets a gradient on its tops iff a loss
+    //depends on it, the others have nothing to propagate
+    vector<bool> blob_has_diff(blob_.size(), false);
+    for (int s = schedule_.size() - 1; s >= 0; --s) {
+        const int layer_index = schedule_[s];
+        bool has_diff = layers_[layer_index]->get_loss_weight() != 0;
+        top_blob_need_bp_[layer_index].clear();
+        for (size_t j = 0; j < top_blob_ids_[layer_index].size(); ++j) {
+            const bool top_has_diff = blob_has_diff[top_blob_ids_[layer_index][j]];
+            top_blob_need_bp_[layer_index].push_back(top_has_diff);
+            has_diff = has_diff || top_has_diff;
+        }
+        need_bp[layer_index] = need_bp[layer_index] && has_diff;
+        for (size_t j = 0; j < bottom_blob_ids_[layer_index].size(); ++j) {
+            bottom_blob_need_bp_[layer_index][j] = bottom_blob_need_bp_[layer_index][j] &&
+                need_bp[layer_index];
+            if (bottom_blob_need_bp_[layer_index][j]) {
+                blob_has_diff[bottom_blob_ids_[layer_index][j]] = true;
+            }
+        }
+    }
+    layer_need_bp_ = need_bp;
+    blob_need_bp_ = blob_has_diff;
+
+    //the backward schedule, the layers skipped are logged once
+    bp_schedule_.clear();
+    for (int s = schedule_.size() - 1; s >= 0; --s) {
+        if (layer_need_bp_[schedule_[s]]) {
+            bp_schedule_.push_back(schedule_[s]);
+        } else if (net_type_ != TEST) {
+            LOG_INFO << "layer " << layer_names_[schedule_[s]] << " has no backward";
+        }
+    }
+
+    //a blob read by several layers gets the sum of their gradients: the
+    //first of them in bp_schedule_ writes the diff, the others add to it
+    vector<bool> has_diff_writer(blob_.size(), false);
+    for (size_t s = 0; s < bp_schedule_.size(); ++s) {
+        const int layer_index = bp_schedule_[s];
+        for (size_t j = 0; j < bottom_blob_ids_[layer_index].size(); ++j) {
+            const int b = bottom_blob_ids_[layer_index][j];
+            const bool bottom_need_bp = bottom_blob_need_bp_[layer_index][j];
+            layers_[layer_index]->set_add_bottom_diff(j, bottom_need_bp && has_diff_writer[b]);
+            has_diff_writer[b] = has_diff_writer[b] || bottom_need_bp;
+        }
+    }
+}
+
+template <typename DataType>
+int NeuralNet<DataType>::build_schedule(const NetParameter & para) {
+    //layer i waits for every other layer writing one of its bottoms
+    const size_t layer_num = layers_.size();
+    vector<vector<int> > writers(blob_.size());
+    for (size_t i = 0; i < layer_num; ++i) {
+        for (size_t j = 0; j < top_blob_ids_[i].size(); ++j) {
+            writers[top_blob_ids_[i][j]].push_back(i);
+        }
+    }
+    vector<vector<int> > next_layers(layer_num);
+    vector<int> wait_num(layer_num, 0);
+    for (size_t i = 0; i < layer_num; ++i) {
+        std::set<int> prev_layers;
+        for (size_t j = 0; j < bottom_blob_ids_[i].size(); ++j) {
+            const vector<int> & w = writers[bottom_blob_ids_[i][j]];
+            for (size_t k = 0; k < w.size(); ++k) {
+                if (w[k] != static_cast<int>(i)) {
+                    prev_layers.insert(w[k]);
+                }
+            }
+        }
+        for (auto iter = prev_layers.begin(); iter != prev_layers.end(); ++iter) {
+            next_layers[*iter].push_back(i);
+        }
+        wait_num[i] = prev_layers.size();
+    }
+
+    //of the ready layers the first one of the configure goes first, a
+    //configure in order is run in order
+    schedule_.clear();
+    std::set<int> ready;
+    for (size_t i = 0; i < layer_num; ++i) {
+        if (wait_num[i] == 0) {
+            ready.insert(i);
+        }
+    }
+    while (!ready.empty()) {
+        const int layer_index = *ready.begin();
+        ready.erase(ready.begin());
+        schedule_.push_back(layer_index);
+        for (size_t k = 0; k < next_layers[layer_index].size(); ++k) {
+            if (--wait_num[next_layers[layer_index][k]] == 0) {
+                ready.insert(next_layers[layer_index][k]);
+            }
+        }
+    }
+    if (schedule_.size() != layer_num) {
+        LOG_FATAL << "Check net configure, the layers have a cycle";
+        return snoopy::FAILURE;
+    }
+
+    //output blobs
+    output_blob_ids_.clear();
+    output_blob_ptrs_.clear();
+    if (para.output_blob_name_size() > 0) {
+        for (int i = 0; i < para.output_blob_name_size(); ++i) {
+            auto iter = blob_name_index_dict_.find(para.output_blob_name(i));
+            if (iter == blob_name_index_dict_.end()) {
+                LOG_FATAL << "Check net configure, no output blob " << para.output_blob_name(i);
+                return snoopy::FAILURE;
+            }
+            output_blob_ids_.push_back(iter->second);
+        }
+    } else {
+        output_blob_ids_ = top_blob_ids_[schedule_.back()];
+    }
+    for (size_t i = 0; i < output_blob_ids_.size(); ++i) {
+        output_blob_ptrs_.push_back(blob_[output_blob_ids_[i]].get());
+    }
+
+    if (net_type_ != TEST) {
+        return snoopy::SUCCESS;
+    }
+    //walk back from the outputs, a layer runs iff it writes a blob needed
+    vector<bool> blob_needed(blob_.size(), false);
+    for (size_t i = 0; i < output_blob_ids_.size(); ++i) {
+        blob_needed[output_blob_ids_[i]] = true;
+    }
+    vector<bool> layer_needed(layer_num, false);
+    for (int s = layer_num - 1; s >= 0; --s) {
+        const int layer_index = schedule_[s];
+        for (size_t j = 0; j < top_blob_ids_[layer_index].size(); ++j) {
+            layer_needed[layer_index] = layer_needed[layer_index] ||
+                blob_needed[top_blob_ids_[layer_index][j]];
+        }
+        if (!layer_needed[layer_index]) {
+            continue;
+        }
+        for (size_t j = 0; j < bottom_blob_ids_[layer_index].size(); ++j) {
+            blob_needed[bottom_blob_ids_[layer_index][j]] = true;
+        }
+    }
+    vector<int> needed_schedule;
+    for (size_t s = 0; s < layer_num; ++s) {
+        if (layer_needed[schedule_[s]]) {
+            needed_schedule.push_back(schedule_[s]);
+        } else {
+            LOG_INFO << "layer " << layer_names_[schedule_[s]] << " is skipped, no output depends on it";
+        }
+    }
+    schedule_.swap(needed_schedule);
+    return snoopy::SUCCESS;
+}
+
+template <typename DataType>
+void NeuralNet<DataType>::plan_memory(bool is_parallel) {
+    //the steps of a training step: forward of schedule_[s] is step s,
+    //backward of bp_schedule_[s] is step schedule_.size() + s
+    const size_t layer_num = layers_.size();
+    vector<int> forward_step(layer_num, -1);
+    vector<int> backward_step(layer_num, -1);
+    for (size_t s = 0; s < schedule_.size(); ++s) {
+        forward_step[schedule_[s]] = s;
+    }
+    for (size_t s = 0; s < bp_schedule_.size(); ++s) {
+        backward_step[bp_schedule_[s]] = schedule_.size() + s;
+    }
+
+    //the inputs and the outputs are read and swapped outside of the steps
+    vector<bool> is_input(blob_.size(), false);
+    for (size_t b = 0; b < blob_.size(); ++b) {
+        for (size_t i = 0; i < input_blobs_.size(); ++i) {
+            is_input[b] = is_input[b] || input_blobs_[i] == blob_[b].get();
+        }
+    }
+    vector<bool> is_pinned(is_input);
+    for (size_t i = 0; i < output_blob_ids_.size(); ++i) {
+        is_pinned[output_blob_ids_[i]] = true;
+    }
+    vector<vector<int> > writers(blob_.size());
+    vector<vector<std::pair<int, int> > > readers(blob_.size()); //!< (layer, bottom index)
+    for (size_t s = 0; s < schedule_.size(); ++s) {
+        const int layer_index = schedule_[s];
+        for (size_t j = 0; j < top_blob_ids_[layer_index].size(); ++j) {
+            writers[top_blob_ids_[layer_index][j]].push_back(layer_index);
+        }
+        for (size_t j = 0; j < bottom_blob_ids_[layer_index].size(); ++j) {
+            readers[bottom_blob_ids_[layer_index][j]].push_back(std::make_pair(layer_index, j));
+        }
+    }
+
+    //in place: the top takes the memory of the bottom, data and gradient,
+    //when the layer is the only reader of the bottom and its writer does
+    //not read it in backward
+    vector<int> group(blob_.size());
+    for (size_t b = 0; b < blob_.size(); ++b) {
+        group[b] = b;
+    }
+    for (size_t s = 0; s < schedule_.size(); ++s) {
+        const int layer_index = schedule_[s];
+        if (!layers_[layer_index]->can_inplace() || bottom_blob_ids_[layer_index].size() != 1 ||
+                top_blob_ids_[layer_index].size() != 1) {
+            continue;
+        }
+        const int bottom = bottom_blob_ids_[layer_index][0];
+        const int top = top_blob_ids_[layer_index][0];
+        if (is_pinned[bottom] || is_pinned[top] || readers[bottom].size() != 1 ||
+                writers[bottom].size() != 1 || writers[top].size() != 1 ||
+                blob_[bottom]->get_count() != blob_[top]->get_count()) {
+            continue;
+        }
+        const int writer = writers[bottom][0];
+        if (layer_need_bp_[writer] && layers_[writer]->bp_need_output_data()) {
+            continue;
+        }
+        group[top] = group[bottom];
+        LOG_INFO << "layer " << layer_names_[layer_index] << " runs in place";
+    }
+
+    //the steps each group uses its data and its gradient in, [first, last]
+    const int no_step = std::numeric_limits<int>::max();
+    vector<std::pair<int, int> > data_live(blob_.size(), std::make_pair(no_step, -1));
+    vector<std::pair<int, int> > diff_live(blob_.size(), std::make_pair(no_step, -1));
+    auto use = [](std::pair<int, int> & live, int step) {
+        if (step >= 0) {
+            live.first = std::min(live.first, step);
+            live.second = std::max(live.second, step);
+        }
+    };
+    for (size_t b = 0; b < blob_.size(); ++b) {
+        std::pair<int, int> & data = data_live[group[b]];
+        std::pair<int, int> & diff = diff_live[group[b]];
+        for (size_t k = 0; k < writers[b].size(); ++k) {
+            const int writer = writers[b][k];
+            use(data, forward_step[writer]);
+            if (layers_[writer]->bp_need_output_data()) {
+                use(data, backward_step[writer]);
+            }
+            if (blob_need_bp_[b]) {
+                use(diff, backward_step[writer]);
+            }
+        }
+        for (size_t k = 0; k < readers[b].size(); ++k) {
+            const int reader = readers[b][k].first;
+            use(data, forward_step[reader]);
+            if (layers_[reader]->bp_need_input_data()) {
+                use(data, backward_step[reader]);
+            }
+            if (bottom_blob_need_bp_[reader][readers[b][k].second]) {
+                use(diff, backward_step[reader]);
+            }
+        }
+    }
+
+    //the groups, largest first, go to the first buffer free in their steps;
+    //a buffer is as large as its first group
+    struct Item {
+        size_t count;
+        std::pair<int, int> live;
+        int group;
+        bool is_diff;
+    };
+    vector<Item> items;
+    naive_blob_bytes_ = 0;
+    planned_blob_bytes_ = 0;
+    for (size_t b = 0; b < blob_.size(); ++b) {
+        if (is_input[b]) {
+            continue;
+        }
+        naive_blob_bytes_ += 2 * blob_[b]->get_count() * sizeof(DataType);
+        if (is_pinned[b]) {
+            planned_blob_bytes_ += 2 * blob_[b]->get_count() * sizeof(DataType);
+        } else if (group[b] == static_cast<int>(b)) {
+            items.push_back(Item {blob_[b]->get_count(), data_live[b], static_cast<int>(b), false});
+            items.push_back(Item {blob_[b]->get_count(), diff_live[b], static_cast<int>(b), true});
+        }
+    }
+    std::stable_sort(items.begin(), items.end(),
+            [](const Item & a, const Item & b) { return a.count > b.count; });
+    vector<size_t> buffer_count;
+    vector<vector<std::pair<int, int> > > buffer_live;
+    vector<int> data_buffer(blob_.size(), -1);
+    vector<int> diff_buffer(blob_.size(), -1);
+    for (size_t i = 0; i < items.size(); ++i) {
+        std::pair<int, int> live = items[i].live;
+        if (is_parallel && live.first <= live.second) {
+            //the steps overlap in any order of the layers
+            live = std::make_pair(0, no_step);
+        }
+        size_t k = 0;
+        for (; k < buffer_count.size(); ++k) {
+            bool is_free = true;
+            for (size_t j = 0; j < buffer_live[k].size() && is_free; ++j) {
+                is_free = live.second < buffer_live[k][j].first || buffer_live[k][j].second < live.first;
+            }
+            if (is_free) {
+                break;
+            }
+        }
+        if (k == buffer_count.size()) {
+            buffer_count.push_back(items[i].count);
+            buffer_live.push_back(vector<std::pair<int, int> >());
+        }
+        if (live.first <= live.second) {
+            buffer_live[k].push_back(live);
+        }
+        (items[i].is_diff ? diff_buffer : data_buffer)[items[i].group] = k;
+    }
+
+    vector<storage::Buffer<DataType> *> buffers;
+    for (size_t k = 0; k < buffer_count.size(); ++k) {
+        buffers.push_back(new storage::Buffer<DataType>(get_allocator(), buffer_count[k]));
+        planned_blob_bytes_ += buffer_count[k] * sizeof(DataType);
+    }
+    for (size_t b = 0; b < blob_.size(); ++b) {
+        BlobShape shape = blob_[b]->get_blobshape();
+        if (!is_pinned[b]) {
+            blob_[b]->set_data(shared_ptr<MBlob<DataType> >(
+                        new MBlob<DataType>(buffers[data_buffer[group[b]]], shape)));
+            blob_[b]->set_diff(shared_ptr<MBlob<DataType> >(
+                        new MBlob<DataType>(buffers[diff_buffer[group[b]]], shape)));
+        } else if (blob_[b]->get_data()->data_->size() == 0) {
+            shared_ptr<Blob<DataType> > own = create_blob_object<DataType>(shape, true);
+            blob_[b]->set_data(own->get_data());
+            blob_[b]->set_diff(own->get_diff());
+        }
+    }
+    for (size_t k = 0; k < buffers.size(); ++k) {
+        buffers[k]->unref();
+    }
+    LOG_INFO << "memory plan of " << net_name_ << ": " << items.size() / 2 << " blobs in "
+             << buffers.size() << " buffers, blobs take " << planned_blob_bytes_ << " bytes instead of "
+             << naive_blob_bytes_;
+}
+
+template <typename DataType>
+void NeuralNet<DataType>::init_executor(int thread_num) {
+    const size_t layer_num = layers_.size();
+    vector<bool> is_run(layer_num, false);
+    for (size_t s = 0; s < schedule_.size(); ++s) {
+        is_run[schedule_[s]] = true;
+    }
+    vector<vector<int> > writers(blob_.size());
+    for (size_t s = 0; s < schedule_.size(); ++s) {
+        const int layer_index = schedule_[s];
+        for (size_t j = 0; j < top_blob_ids_[layer_index].size(); ++j) {
+            writers[top_blob_ids_[layer_index][j]].push_back(layer_index);
+        }
+    }
+    wait_num_.assign(layer_num, 0);
+    next_layers_.assign(layer_num, vector<int>());
+    for (size_t s = 0; s < schedule_.size(); ++s) {
+        const int layer_index = schedule_[s];
+        std::set<int> prev_layers;
+        for (size_t j = 0; j < bottom_blob_ids_[layer_index].size(); ++j) {
+            const vector<int> & w = writers[bottom_blob_ids_[layer_index][j]];
+            for (size_t k = 0; k < w.size(); ++k) {
+                if (w[k] != layer_index) {
+                    prev_layers.insert(w[k]);
+                }
+            }
+        }
+        for (auto iter = prev_layers.begin(); iter != prev_layers.end(); ++iter) {
+            next_layers_[*iter].push_back(layer_index);
+        }
+        wait_num_[layer_index] = prev_layers.size();
+    }
+
+    //backprop: the writers of the gradient of each blob, in the order of
+    //bp_schedule_; the first one writes the diff and the next ones add to
+    //it, so each of them waits for the one before
+    vector<vector<int> > diff_writers(blob_.size());
+    for (size_t s = 0; s < bp_schedule_.size(); ++s) {
+        const int layer_index = bp_schedule_[s];
+        for (size_t j = 0; j < bottom_blob_ids_[layer_index].size(); ++j) {
+            if (bottom_blob_need_bp_[layer_index][j]) {
+                diff_writers[bottom_blob_ids_[layer_index][j]].push_back(layer_index);
+            }
+        }
+    }
+    bp_wait_num_.assign(layer_num, 0);
+    bp_next_layers_.assign(layer_num, vector<int>());
+    for (size_t s = 0; s < bp_schedule_.size(); ++s) {
+        const int layer_index = bp_schedule_[s];
+        std::set<int> prev_layers;
+        for (size_t j = 0; j < top_blob_ids_[layer_index].size(); ++j) {
+            const vector<int> & w = diff_writers[top_blob_ids_[layer_index][j]];
+            prev_layers.insert(w.begin(), w.end());
+        }
+        for (size_t j = 0; j < bottom_blob_ids_[layer_index].size(); ++j) {
+            const vector<int> & w = diff_writers[bottom_blob_ids_[layer_index][j]];
+            auto pos = std::find(w.begin(), w.end(), layer_index);
+            if (pos != w.end() && pos != w.begin()) {
+                prev_layers.insert(*(pos - 1));
+            }
+        }
+        prev_layers.erase(layer_index);
+        for (auto iter = prev_layers.begin(); iter != prev_layers.end(); ++iter) {
+            bp_next_layers_[*iter].push_back(layer_index);
+        }
+        bp_wait_num_[layer_index] = prev_layers.size();
+    }
+
+    //the layers of one step run on several threads, the scratch arena is
+    //not shared
+    for (size_t i = 0; i < layer_num; ++i) {
+        layer_arenas_.push_back(shared_ptr<storage::ArenaAllocator>(
+                new storage::ArenaAllocator(get_allocator(), size_t(1) << 16)));
+        layers_[i]->set_scratch_arena(layer_arenas_[i].get());
+    }
+    wait_counter_.reset(new std::atomic<int>[layer_num]);
+    layer_loss_.assign(layer_num, 0);
+    pool_ = shared_ptr<ThreadPool>(new ThreadPool(thread_num));
+}
+
+template <typename DataType>
+void NeuralNet<DataType>::run_layers(const vector<int> & order, const vector<int> & wait_num,
+                                     const vector<vector<int> > & next_layers, bool is_forward) {
+    for (size_t s = 0; s < order.size(); ++s) {
+        wait_counter_[order[s]] = wait_num[order[s]];
+    }
+    for (size_t s = 0; s < order.size(); ++s) {
+        const int layer_index = order[s];
+        if (wait_num[layer_index] == 0) {
+            pool_->schedule([this, layer_index, &next_layers, is_forward] {
+                run_layer(layer_index, next_layers, is_forward);
+            });
+        }
+    }
+    pool_->wait();
+}
+
+template <typename DataType>
+void NeuralNet<DataType>::run_layer(int layer_index, const vector<vector<int> > & next_layers,
+                                    bool is_forward) {
+    {
+        storage::AllocatorScope allocator_scope(get_allocator());
+        if (is_forward) {
+            layer_loss_[layer_index] = layers_[layer_index]->forward(
+                    bottom_blobs_[layer_index], top_blobs_[layer_index]);
+        } else {
+            layers_[layer_index]->backward(bottom_blobs_[layer_index],
+                    bottom_blob_need_bp_[layer_index], top_blobs_[layer_index]);
+        }
+    }
+    const vector<int> & next = next_layers[layer_index];
+    for (size_t k = 0; k < next.size(); ++k) {
+        const int next_index = next[k];
+        if (--wait_counter_[next_index] == 0) {
+            pool_->schedule([this, next_index, &next_layers, is_forward] {
+                run_layer(next_index, next_layers, is_forward);
+            });
+        }
+    }
+}
+
+template <typename DataType>
+int NeuralNet<DataType>::share_para_blobs(NeuralNet<DataType> & other) {
+    if (para_blobs_.size() != other.para_blobs_.size()) {
+        LOG_ERROR << "share the parameters of a net of another configure";
+        return snoopy::FAILURE;
+    }
+    for (size_t i = 0; i < para_blobs_.size(); ++i) {
+        if (!(para_blobs_[i]->get_blobshape() == other.para_blobs_[i]->get_blobshape())) {
+            LOG_ERROR << "parameter " << para_blob_names_[i] << " does not match";
+            return snoopy::FAILURE;
+        }
+        //the layers hold the same Blob, they see the shared data too
+        para_blobs_[i]->set_data(other.para_blobs_[i]->get_data());
+    }
+    return snoopy::SUCCESS;
+}
+
+template <typename DataType>
+int NeuralNet<DataType>::share_layer_para_blobs(int layer_index, NeuralNet<DataType> & owner) {
+    if (owner.layer_names_[layer_index] != layers_[layer_index]->get_layer_parameter().name()) {
+        LOG_ERROR << "share the parameters of a net of another configure";
+        return snoopy::FAILURE;
+    }
+    vector<shared_ptr<Blob<DataType> > > owner_blobs = owner.layers_[layer_index]->get_param_blob();
+    vector<shared_ptr<Blob<DataType> > > blobs;
+    for (size_t i = 0; i < owner_blobs.size(); ++i) {
+        //a row-sparse gradient is made by the layer, there is no dense one
+        MBlob<DataType> * diff = nullptr;
+        if (owner_blobs[i]->get_diff() != nullptr) {
+            diff = new MBlob<DataType>(storage::default_allocator(), owner_blobs[i]->get_blobshape());
+        }
+        shared_ptr<Blob<DataType> > blob(new Blob<DataType>(nullptr, diff));
+        blob->set_data(owner_blobs[i]->get_data());
+        blobs.push_back(blob);
+    }
+    layers_[layer_index]->set_param_blob(blobs);
+    return snoopy::SUCCESS;
+}
+
 template <typename DataType>
 void NeuralNet<DataType>::forward(DataType * loss) {
+    storage::AllocatorScope allocator_scope(get_allocator());
     *loss = 0;
-    for (int layer_index = 0; layer_index < layers_.size(); ++layer_index) {
-        shared_ptr<Layer<DataType> > layer = layers_[layer_index];
-        *loss += layer->forward(bottom_blobs_[layer_index], top_blobs_[layer_index]);
+    if (pool_ != nullptr) {
+        run_layers(schedule_, wait_num_, next_layers_, true);
+        //summed in the schedule order whatever order the layers ran in
+        for (size_t s = 0; s < schedule_.size(); ++s) {
+            *loss += layer_loss_[schedule_[s]];
+        }
+        return;
+    }
+    for (size_t s = 0; s < schedule_.size(); ++s) {
+        const int layer_index = schedule_[s];
+        *loss += layers_[layer_index]->forward(bottom_blobs_[layer_index], top_blobs_[layer_index]);
     }
 }
 
 template <typename DataType>
 void NeuralNet<DataType>::backprop() {
-    for (int layer_index = 0; layer_index < layers_.size(); ++layer_index) {
-        vector<bool> need_bp;
-        shared_ptr<Layer<DataType> > layer = layers_[layer_index];
-        layer->backward(bottom_blobs_[layer_index], need_bp, top_blobs_[layer_index]);
+    storage::AllocatorScope allocator_scope(get_allocator());
+    if (pool_ != nullptr) {
+        run_layers(bp_schedule_, bp_wait_num_, bp_next_layers_, false);
+    } else {
+        for (size_t s = 0; s < bp_schedule_.size(); ++s) {
+            const int layer_index = bp_schedule_[s];
+            layers_[layer_index]->backward(bottom_blobs_[layer_index],
+                    bottom_blob_need_bp_[layer_index], top_blobs_[layer_index]);
+        }
+    }
+    //the scratch of forward and backward dies with the step
+    scratch_arena_->reset();
+    for (size_t i = 0; i < layer_arenas_.size(); ++i) {
+        layer_arenas_[i]->reset();
     }
 }
 
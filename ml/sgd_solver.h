@@ -2,10 +2,18 @@
 #define SNOOPY_ML_SGD_SOLVER_H_
 
 #include <vector>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <functional>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "nn.h"
 #include "solver.h"
 #include "../proto/snoopy.pb.h"
 #include "../common/logging.h"
+#include "../common/barrier.h"
 
 //using namespace std;
 using std::shared_ptr;
@@ -15,6 +23,57 @@ using std::string;
 namespace snoopy {
 namespace ml {
 
+/**
+ * momentum sgd restricted to the rows of a row-sparse gradient, the cost is
+ * O(rows in the batch * dim) whatever the size of the table. The momentum is
+ * lazy: the velocity of a row only decays in the steps where the row has a
+ * gradient.
+ *
+ * @param param: the parameter matrix
+ * @param history: the velocity, same shape as param
+ * @param grad: the gradient rows, the row ids are unique
+ */
+template <typename DataType>
+inline void sparse_momentum_update(Matrix<DataType, 2> & param,
+                                   Matrix<DataType, 2> & history,
+                                   const SparseRows<DataType> & grad,
+                                   DataType lr, DataType momentum) {
+    const int64_t n = grad.size();
+#pragma omp parallel for if (n * param.get_column() > 32768)
+    for (int64_t k = 0; k < n; ++k) {
+        const size_t r = grad.rows_[k];
+        history[r] = history[r] * momentum - grad.values_[k] * lr;
+        param[r] = param[r] + history[r];
+    }
+}
+
+/**
+ * momentum sgd of a dense parameter
+ *
+ * @param param: the parameter matrix
+ * @param history: the velocity, same shape as param
+ * @param grad: the gradient, same shape as param
+ */
+template <typename DataType>
+inline void dense_momentum_update(Matrix<DataType, 2> & param,
+                                  Matrix<DataType, 2> & history,
+                                  const Matrix<DataType, 2> & grad,
+                                  DataType lr, DataType momentum) {
+    history = history * momentum - grad * lr;
+    param = param + history;
+}
+
+/**
+ * wall time of the phases of the synchronous data parallel mode, summed over
+ * the steps; the waits for the slowest thread count in compute
+ */
+struct SyncPhaseTimes {
+    double compute_ms;
+    double reduce_ms;
+    double update_ms;
+    int64_t steps;
+};
+
 template <typename DataType> 
 class SGDSolver : public Solver<DataType> {
     public:
@@ -33,11 +92,65 @@ class SGDSolver : public Solver<DataType> {
 
        float get_base_lr() { return base_lr_; }
        float get_momentum() { return momentum_; }
+       int get_thread_num() { return thread_num_; }
+       const SyncPhaseTimes & get_phase_times() { return phase_times_; }
+       /**
+        * the steps each hogwild thread made in the last update, over all the
+        * epochs
+        */
+       const vector<int64_t> & get_worker_steps() { return worker_steps_; }
 
     private:
+       /**
+        * state shared by the threads of the synchronous mode
+        */
+       struct SyncState {
+           explicit SyncState(size_t n) : barrier(n), is_end(n, 0) {}
+           Barrier barrier;
+           vector<char> is_end; //!< the shard of the thread ran out this step
+           vector<vector<int64_t> > row_step; //!< last step each sparse row was updated
+       };
+
+       /**
+        * read the shards of the replicas
+        */
+       int read_replica_data();
+
+       /**
+        * train the replicas on their shards in parallel, the updates of the
+        * shared parameters and velocities are not locked (hogwild)
+        */
+       int update_hogwild(vector<shared_ptr<Blob<DataType> > > & history);
+
+       /**
+        * the loop of one hogwild thread over its replica
+        */
+       void hogwild_worker(int worker_id, vector<shared_ptr<Blob<DataType> > > & history);
+
+       /**
+        * train the replicas in lockstep, every step the gradients of all the
+        * replicas make one update of the shared parameters
+        */
+       int update_sync(vector<shared_ptr<Blob<DataType> > > & history);
+
+       /**
+        * the loop of one synchronous thread: its replica computes the
+        * gradients of its micro-batch, then the thread reduces and applies
+        * its chunk of every dense parameter and its rows of every sparse one
+        */
+       void sync_worker(int worker_id, vector<shared_ptr<Blob<DataType> > > & history,
+                        SyncState * state);
+
        float base_lr_;
        float momentum_;
        int max_epochs_;
+       int thread_num_;
+       int dense_reduce_interval_;
+       ParallelMode parallel_mode_;
+       SyncPhaseTimes phase_times_;
+       vector<int64_t> worker_steps_;
+       //nets of the threads, sharing the parameters of net_
+       vector<shared_ptr<NeuralNet<DataType> > > replicas_;
 };
 
 template <typename DataType>
@@ -48,10 +161,31 @@ int SGDSolver<DataType>::init(const SolverParameter & solver) {
     if (status != snoopy::SUCCESS) {
         return snoopy::FAILURE;
     }
-    this->net_->init(net_p);
+    if (this->net_->init(net_p) != snoopy::SUCCESS) {
+        return snoopy::FAILURE;
+    }
     base_lr_ = solver.base_lr();
     momentum_ = solver.momentum(); 
     max_epochs_ = solver.epochs();
+    thread_num_ = solver.thread_num();
+    dense_reduce_interval_ = solver.dense_reduce_interval();
+    parallel_mode_ = solver.parallel_mode();
+    phase_times_ = SyncPhaseTimes();
+    if (thread_num_ < 1 || dense_reduce_interval_ < 1) {
+        LOG_ERROR << "thread_num and dense_reduce_interval must be positive";
+        return snoopy::FAILURE;
+    }
+    replicas_.clear();
+    for (int t = 0; thread_num_ > 1 && t < thread_num_; ++t) {
+        //the replicas use the parameters of net_, they allocate none
+        shared_ptr<NeuralNet<DataType> > replica(new NeuralNet<DataType>);
+        if (replica->init(net_p, this->net_.get()) != snoopy::SUCCESS) {
+            return snoopy::FAILURE;
+        }
+        static_cast<DataFeedLayer<DataType> *>(
+                replica->get_input_feed().get())->set_shard(t, thread_num_);
+        replicas_.push_back(replica);
+    }
     return snoopy::SUCCESS;
 }
 
@@ -69,13 +203,17 @@ int SGDSolver<DataType>::update() {
         BlobShape blob_shape {static_cast<unsigned long>(para_vector[para_index]->dim_at(0)), 
                                             static_cast<unsigned long>(para_vector[para_index]->dim_at(1))};
        shared_ptr<Blob<DataType> > tmp = create_blob_object<DataType>(
-                blob_shape, true);
+                blob_shape, false);
        Matrix<DataType, 2> history_param_matrix = tmp->get_data()->flatten_2d_matrix();
-       Matrix<DataType, 2> derivate_matrix = tmp->get_diff()->flatten_2d_matrix();
        history_param_matrix.clear_data();
-       derivate_matrix.clear_data();
        history_param_matrix_vec.push_back(tmp);
     }
+    if (thread_num_ > 1 && parallel_mode_ == SYNC_DATA_PARALLEL) {
+        return update_sync(history_param_matrix_vec);
+    }
+    if (thread_num_ > 1) {
+        return update_hogwild(history_param_matrix_vec);
+    }
     //feed data
     int status = data_feed->read_file();
     if (status == snoopy::FAILURE) {
@@ -85,32 +223,312 @@ int SGDSolver<DataType>::update() {
 
     for (int epoch_index = 0; epoch_index < max_epochs_; ++epoch_index) {
         cerr << "epoch_index: " << epoch_index << endl;
-        for (int iter_index = 0; !data_feed->is_end(); ++iter_index) {
+        for (int iter_index = 0; ; ++iter_index) {
             cerr << "epoch_index: " << epoch_index << " iter_index: " << iter_index << endl;
+            //the feed ends when it has no full batch, the blobs keep the last one
             data_feed->get_data(this->net_->get_input_blobs());
+            if (data_feed->is_end()) {
+                break;
+            }
             this->net_->forward(&loss);
             this->net_->backprop();
             //update the learnabel parameter
             for (int para_index = 0; para_index < para_vector.size(); ++
                     para_index) {
                Matrix<DataType, 2> para_matrix =  para_vector[para_index]->get_data()->flatten_2d_matrix();
-               Matrix<DataType, 2> para_diff_matrix =  para_vector[para_index]->get_diff()->flatten_2d_matrix();
                Matrix<DataType, 2> history_param_matrix = history_param_matrix_vec[para_index]->get_data()->flatten_2d_matrix();
-               Matrix<DataType, 2> derivate_matrix = history_param_matrix_vec[para_index]->get_diff()->flatten_2d_matrix();
+               shared_ptr<SparseRows<DataType> > sparse_diff = para_vector[para_index]->get_sparse_diff();
+               if (sparse_diff != nullptr) {
+                   sparse_momentum_update(para_matrix, history_param_matrix, *sparse_diff,
+                           static_cast<DataType>(base_lr_ * this->net_->get_learnable_para_lr()[para_index]),
+                           static_cast<DataType>(momentum_));
+                   continue;
+               }
+               Matrix<DataType, 2> para_diff_matrix =  para_vector[para_index]->get_diff()->flatten_2d_matrix();
+               dense_momentum_update(para_matrix, history_param_matrix, para_diff_matrix,
+                       static_cast<DataType>(base_lr_ * this->net_->get_learnable_para_lr()[para_index]),
+                       static_cast<DataType>(momentum_));
+            }
+        }
+        data_feed->clear();
+    }
+    return snoopy::SUCCESS;
+}
+
+template <typename DataType>
+int SGDSolver<DataType>::read_replica_data() {
+    for (size_t t = 0; t < replicas_.size(); ++t) {
+        DataFeedLayer<DataType> * data_feed = static_cast<DataFeedLayer<DataType> *>(
+                replicas_[t]->get_input_feed().get());
+        if (data_feed->read_file() == snoopy::FAILURE) {
+            LOG_FATAL << "load data file failure, please check data" << endl;
+            return snoopy::FAILURE;
+        }
+    }
+    return snoopy::SUCCESS;
+}
 
-               derivate_matrix = history_param_matrix * momentum_;
-               derivate_matrix = derivate_matrix - para_diff_matrix * 
-                   (base_lr_ * this->net_->get_learnable_para_lr()[para_index]);
+template <typename DataType>
+int SGDSolver<DataType>::update_hogwild(vector<shared_ptr<Blob<DataType> > > & history) {
+    if (read_replica_data() != snoopy::SUCCESS) {
+        return snoopy::FAILURE;
+    }
+    worker_steps_.assign(replicas_.size(), 0);
+    vector<std::thread> workers;
+    for (int t = 0; t < replicas_.size(); ++t) {
+        workers.push_back(std::thread(&SGDSolver<DataType>::hogwild_worker,
+                    this, t, std::ref(history)));
+    }
+    for (size_t t = 0; t < workers.size(); ++t) {
+        workers[t].join();
+    }
+    return snoopy::SUCCESS;
+}
 
-               para_matrix = para_matrix + derivate_matrix;  
-               history_param_matrix.copy_from(derivate_matrix);
+template <typename DataType>
+void SGDSolver<DataType>::hogwild_worker(int worker_id,
+        vector<shared_ptr<Blob<DataType> > > & history) {
+#ifdef _OPENMP
+    //the cores are taken by the solver threads, no nested teams
+    omp_set_num_threads(1);
+#endif
+    NeuralNet<DataType> & net = *replicas_[worker_id];
+    DataFeedLayer<DataType> * data_feed = static_cast<DataFeedLayer<DataType> *>(net.get_input_feed().get());
+    vector<Blob<DataType> *> para_vector = net.get_learnable_para_blobs();
+    const vector<float> & lr_multi = net.get_learnable_para_lr();
+    const DataType momentum = static_cast<DataType>(momentum_);
+
+    //dense gradients summed since the last reduction
+    vector<Matrix<DataType, 2> > accum(para_vector.size());
+    for (size_t p = 0; dense_reduce_interval_ > 1 && p < para_vector.size(); ++p) {
+        if (para_vector[p]->get_sparse_diff() == nullptr) {
+            accum[p] = Matrix<DataType, 2>(para_vector[p]->get_diff()->flatten_2d_matrix().get_shape());
+            accum[p].clear_data();
+        }
+    }
+
+    DataType loss = static_cast<DataType>(0);
+    int pending = 0;
+    for (int epoch_index = 0; epoch_index < max_epochs_; ++epoch_index) {
+        int iter_index = 0;
+        for (; ; ++iter_index) {
+            data_feed->get_data(net.get_input_blobs());
+            if (data_feed->is_end()) {
+                break;
+            }
+            net.forward(&loss);
+            net.backprop();
+            ++pending;
+            const bool is_reduce = (pending >= dense_reduce_interval_);
+            for (size_t p = 0; p < para_vector.size(); ++p) {
+                Matrix<DataType, 2> para_matrix = para_vector[p]->get_data()->flatten_2d_matrix();
+                Matrix<DataType, 2> history_matrix = history[p]->get_data()->flatten_2d_matrix();
+                const DataType lr = static_cast<DataType>(base_lr_ * lr_multi[p]);
+                shared_ptr<SparseRows<DataType> > sparse_diff = para_vector[p]->get_sparse_diff();
+                if (sparse_diff != nullptr) {
+                    sparse_momentum_update(para_matrix, history_matrix, *sparse_diff, lr, momentum);
+                    continue;
+                }
+                Matrix<DataType, 2> para_diff_matrix = para_vector[p]->get_diff()->flatten_2d_matrix();
+                if (dense_reduce_interval_ == 1) {
+                    dense_momentum_update(para_matrix, history_matrix, para_diff_matrix, lr, momentum);
+                    continue;
+                }
+                accum[p] = accum[p] + para_diff_matrix;
+                if (is_reduce) {
+                    //one step with the mean gradient of the interval
+                    dense_momentum_update(para_matrix, history_matrix, accum[p],
+                            static_cast<DataType>(lr / pending), momentum);
+                    accum[p].clear_data();
+                }
+            }
+            if (is_reduce) {
+                pending = 0;
             }
         }
         data_feed->clear();
+        worker_steps_[worker_id] += iter_index;
+        LOG_INFO << "hogwild worker " << worker_id << " epoch " << epoch_index
+                 << " iters " << iter_index;
     }
+
+    //the gradients left over from the last interval
+    for (size_t p = 0; pending > 0 && p < para_vector.size(); ++p) {
+        if (para_vector[p]->get_sparse_diff() == nullptr) {
+            Matrix<DataType, 2> para_matrix = para_vector[p]->get_data()->flatten_2d_matrix();
+            Matrix<DataType, 2> history_matrix = history[p]->get_data()->flatten_2d_matrix();
+            dense_momentum_update(para_matrix, history_matrix, accum[p],
+                    static_cast<DataType>(base_lr_ * lr_multi[p] / pending), momentum);
+        }
+    }
+}
+
+template <typename DataType>
+int SGDSolver<DataType>::update_sync(vector<shared_ptr<Blob<DataType> > > & history) {
+    if (read_replica_data() != snoopy::SUCCESS) {
+        return snoopy::FAILURE;
+    }
+    SyncState state(replicas_.size());
+    vector<Blob<DataType> *> para_vector = this->net_->get_learnable_para_blobs();
+    state.row_step.resize(para_vector.size());
+    for (size_t p = 0; p < para_vector.size(); ++p) {
+        if (para_vector[p]->get_sparse_diff() != nullptr) {
+            state.row_step[p].assign(para_vector[p]->dim_at(0), -1);
+        }
+    }
+    phase_times_ = SyncPhaseTimes();
+
+    vector<std::thread> workers;
+    for (int t = 0; t < replicas_.size(); ++t) {
+        workers.push_back(std::thread(&SGDSolver<DataType>::sync_worker,
+                    this, t, std::ref(history), &state));
+    }
+    for (size_t t = 0; t < workers.size(); ++t) {
+        workers[t].join();
+    }
+    LOG_INFO << "sync data parallel, " << replicas_.size() << " threads, "
+             << phase_times_.steps << " steps, compute " << phase_times_.compute_ms
+             << " ms, reduce " << phase_times_.reduce_ms
+             << " ms, update " << phase_times_.update_ms << " ms";
     return snoopy::SUCCESS;
 }
 
+template <typename DataType>
+void SGDSolver<DataType>::sync_worker(int worker_id,
+        vector<shared_ptr<Blob<DataType> > > & history, SyncState * state) {
+#ifdef _OPENMP
+    omp_set_num_threads(1);
+#endif
+    typedef std::chrono::steady_clock Clock;
+    typedef std::chrono::duration<double, std::milli> Ms;
+    //a chunk starts on a cache line, the tree of a block stays in L1
+    const size_t kLineElems = 64 / sizeof(DataType);
+    const size_t kBlockElems = 16384 / sizeof(DataType);
+    const int n = replicas_.size();
+    NeuralNet<DataType> & net = *replicas_[worker_id];
+    DataFeedLayer<DataType> * data_feed = static_cast<DataFeedLayer<DataType> *>(net.get_input_feed().get());
+    vector<Blob<DataType> *> para_vector = net.get_learnable_para_blobs();
+    const vector<float> & lr_multi = net.get_learnable_para_lr();
+    const DataType momentum = static_cast<DataType>(momentum_);
+
+    //the diffs of every replica, by parameter, and the chunk of this thread
+    vector<vector<DataType *> > diffs(para_vector.size());
+    vector<std::pair<size_t, size_t> > chunks(para_vector.size(), std::make_pair(0, 0));
+    for (size_t p = 0; p < para_vector.size(); ++p) {
+        if (para_vector[p]->get_sparse_diff() != nullptr) {
+            continue;
+        }
+        for (int k = 0; k < n; ++k) {
+            diffs[p].push_back(replicas_[k]->get_learnable_para_blobs()[p]->get_diff()->data_->data());
+        }
+        const size_t count = para_vector[p]->get_count();
+        const size_t chunk = ((count + n - 1) / n + kLineElems - 1) / kLineElems * kLineElems;
+        const size_t begin = std::min(count, worker_id * chunk);
+        chunks[p] = std::make_pair(begin, std::min(count, begin + chunk));
+    }
+    vector<size_t> touched;
+
+    int64_t step = 0;
+    DataType loss = static_cast<DataType>(0);
+    for (int epoch_index = 0; epoch_index < max_epochs_; ++epoch_index) {
+        int iter_index = 0;
+        for (; ; ++iter_index, ++step) {
+            Clock::time_point t0 = Clock::now();
+            data_feed->get_data(net.get_input_blobs());
+            state->is_end[worker_id] = data_feed->is_end();
+            state->barrier.wait();
+            bool is_end = false;
+            for (int k = 0; k < n; ++k) {
+                is_end = is_end || state->is_end[k];
+            }
+            if (is_end) {
+                break;
+            }
+            net.forward(&loss);
+            net.backprop();
+            state->barrier.wait();
+            Clock::time_point t1 = Clock::now();
+
+            //reduce-scatter: this thread sums its chunk of the diffs into
+            //replica 0 by a pairwise tree, the order is fixed
+            for (size_t p = 0; p < para_vector.size(); ++p) {
+                for (size_t b = chunks[p].first; b < chunks[p].second; b += kBlockElems) {
+                    const size_t e = std::min(chunks[p].second, b + kBlockElems);
+                    for (int stride = 1; stride < n; stride *= 2) {
+                        for (int k = 0; k + stride < n; k += 2 * stride) {
+                            DataType * dst = diffs[p][k];
+                            const DataType * src = diffs[p][k + stride];
+                            for (size_t i = b; i < e; ++i) {
+                                dst[i] += src[i];
+                            }
+                        }
+                    }
+                }
+            }
+            Clock::time_point t2 = Clock::now();
+
+            //one step with the mean gradient of the replicas, the parameters
+            //are shared so every replica sees the whole update after the
+            //next barrier
+            for (size_t p = 0; p < para_vector.size(); ++p) {
+                const DataType lr = static_cast<DataType>(base_lr_ * lr_multi[p] / n);
+                Matrix<DataType, 2> para_matrix = para_vector[p]->get_data()->flatten_2d_matrix();
+                Matrix<DataType, 2> history_matrix = history[p]->get_data()->flatten_2d_matrix();
+                if (para_vector[p]->get_sparse_diff() == nullptr) {
+                    DataType * param = static_cast<DataType *>(para_vector[p]->get_raw_data());
+                    DataType * velocity = static_cast<DataType *>(history[p]->get_raw_data());
+                    const DataType * grad = diffs[p][0];
+                    for (size_t i = chunks[p].first; i < chunks[p].second; ++i) {
+                        velocity[i] = velocity[i] * momentum - grad[i] * lr;
+                        param[i] += velocity[i];
+                    }
+                    continue;
+                }
+                //the rows of a sparse parameter are split by id, a row sums
+                //the gradients of the replicas in replica order
+                vector<int64_t> & row_step = state->row_step[p];
+                touched.clear();
+                for (int k = 0; k < n; ++k) {
+                    const SparseRows<DataType> & grad =
+                        *replicas_[k]->get_learnable_para_blobs()[p]->get_sparse_diff();
+                    for (size_t j = 0; j < grad.size(); ++j) {
+                        const size_t r = grad.rows_[j];
+                        if (r % n != worker_id) {
+                            continue;
+                        }
+                        if (row_step[r] != step) {
+                            row_step[r] = step;
+                            touched.push_back(r);
+                            history_matrix[r] = history_matrix[r] * momentum - grad.values_[j] * lr;
+                        } else {
+                            history_matrix[r] = history_matrix[r] - grad.values_[j] * lr;
+                        }
+                    }
+                }
+                for (size_t j = 0; j < touched.size(); ++j) {
+                    para_matrix[touched[j]] = para_matrix[touched[j]] + history_matrix[touched[j]];
+                }
+            }
+            Clock::time_point t3 = Clock::now();
+            if (worker_id == 0) {
+                phase_times_.compute_ms += Ms(t1 - t0).count();
+                phase_times_.reduce_ms += Ms(t2 - t1).count();
+                phase_times_.update_ms += Ms(t3 - t2).count();
+            }
+        }
+        //every thread has seen the end before the flags are reused
+        state->barrier.wait();
+        data_feed->clear();
+        if (worker_id == 0) {
+            phase_times_.steps += iter_index;
+            LOG_INFO << "sync epoch " << epoch_index << " iters " << iter_index
+                     << ", compute " << phase_times_.compute_ms << " ms, reduce "
+                     << phase_times_.reduce_ms << " ms, update "
+                     << phase_times_.update_ms << " ms";
+        }
+    }
+}
+
 }
 }
 
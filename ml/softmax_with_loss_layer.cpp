@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include "softmax_with_loss_layer.h"
 #include "layer_factory.h"
 
@@ -26,13 +28,35 @@ void SoftmaxWithLossLayer<DataType>::forward_cpu(const vector<Blob<DataType> *>
                  const vector<Blob<DataType> *> & output_blob) {
     Matrix<DataType, 2> input_matrix = input_blob[0]->get_data()->flatten_2d_matrix();
     Matrix<DataType, 2> out_matrix = output_blob[0]->get_data()->flatten_2d_matrix();
-    softmax(out_matrix, input_matrix);
+    const bool is_loss = (this->loss_weight_ != 0 && input_blob.size() >= 2);
+    log_sum_exp_.resize(input_matrix.get_row());
+    softmax(out_matrix, input_matrix, is_loss ? log_sum_exp_.data() : nullptr);
+    if (!is_loss) {
+        return;
+    }
+
+    //-log(p[label]) = log(sum(exp(x))) - x[label], with the log-sum-exp of
+    //the softmax it is finite even where the probability underflows
+    Matrix<DataType, 2> label_matrix = input_blob[1]->get_data()->flatten_2d_matrix();
+    size_t row_n = input_matrix.get_row();
+    size_t col_n = input_matrix.get_column();
+    CHECK_EQ(row_n, label_matrix.get_row());
+    DataType loss = 0;
+    for (size_t index_sample = 0; index_sample < row_n; ++index_sample) {
+        size_t label = static_cast<size_t>(label_matrix[index_sample][0]);
+        CHECK_LT(label, col_n);
+        loss += log_sum_exp_[index_sample] - input_matrix[index_sample][label];
+    }
+    this->loss_ = loss;
 }
 
 template<typename DataType>
 void SoftmaxWithLossLayer<DataType>::backward_cpu(const vector<Blob<DataType> *> & input_blob,
                   const vector<bool> & need_bp,
                   const vector<Blob<DataType> *> & output_blob) {
+    if (!this->need_bp_at(need_bp, 0)) {
+        return;
+    }
     //backward, compute the gradient on the input directly
     //see ref: http://freemind.pluskid.org/machine-learning/softmax-vs-softmax-loss-numerical-stability/
     Matrix<DataType, 2> input_matrix = input_blob[0]->get_data()->flatten_2d_matrix();
@@ -50,14 +74,21 @@ void SoftmaxWithLossLayer<DataType>::backward_cpu(const vector<Blob<DataType> *>
     CHECK_EQ(row_n, label_row_n);
     CHECK_GE(label_col_n, 1);
 
+    const bool is_add = this->add_bottom_diff(0);
     for (size_t index_sample = 0; index_sample < row_n; ++index_sample) {
         //int label = static_cast<int>(input_blob[1]->get_data_at(index_sample)) - 1;
         int label = static_cast<int>(label_matrix[index_sample][0]);
         for (size_t index_dim = 0; index_dim < col_n; ++index_dim) {
+            DataType grad = out_matrix[index_sample][index_dim];
             if (label == index_dim) {
-                in_diff_matrix[index_sample][index_dim] = out_matrix[index_sample][index_dim] - 1;            
+                grad = this->loss_weight_ * (grad - 1);
+            } else {
+                grad = this->loss_weight_ * grad;
+            }
+            if (is_add) {
+                in_diff_matrix[index_sample][index_dim] += grad;
             } else {
-                in_diff_matrix[index_sample][index_dim] = out_matrix[index_sample][index_dim];            
+                in_diff_matrix[index_sample][index_dim] = grad;
             }
         }
     }
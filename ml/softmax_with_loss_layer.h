@@ -18,6 +18,12 @@ public:
 
      virtual int exact_top_blob() { return 1; }
 
+     /**
+      * the loss is the cross entropy, summed over the batch like the
+      * gradient of backward
+      */
+     virtual DataType default_loss_weight() { return 1; }
+
 protected:
   virtual void forward_cpu(const vector<Blob<DataType> *> & input_blob,
                     const vector<Blob<DataType> *> & output_blob);
@@ -26,6 +32,8 @@ protected:
                       const vector<bool> & need_bp,
                       const vector<Blob<DataType> *> & output_blob);
 
+  vector<DataType> log_sum_exp_; //!< of each row of the input, by forward
+
 };
     
 }
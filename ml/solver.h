@@ -32,13 +32,32 @@ class Solver {
         */
        virtual int update() = 0;
 
+       shared_ptr<NeuralNet<DataType> > get_net() {
+            return net_;
+       }
+
        /**
         * save model 
         */
        virtual int save_model(const string & save_file_name) {
-            io::write_model_to_binary_file(save_file_name, 
-                                        net_->get_para_blobs());
-            return snoopy::SUCCESS;
+            return io::write_model_to_binary_file(save_file_name,
+                                        net_->get_para_blobs(),
+                                        net_->get_para_blob_names());
+       }
+
+       /**
+        * load model, with is_mmap the parameters are mapped read-only from
+        * the file instead of copied, for nets that are only evaluated
+        */
+       virtual int load_model(const string & model_file_name, bool is_mmap = false) {
+            if (is_mmap) {
+                return io::map_model_from_binary_file(model_file_name,
+                                        net_->get_para_blobs(),
+                                        net_->get_para_blob_names());
+            }
+            return io::load_model_from_binary_file(model_file_name,
+                                        net_->get_para_blobs(),
+                                        net_->get_para_blob_names());
        }
 
        /**
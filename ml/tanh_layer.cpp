@@ -27,11 +27,15 @@ template<typename DataType>
 void TanhLayer<DataType>::backward_cpu(const vector<Blob<DataType> *> & input_blob,
                   const vector<bool> & need_bp,
                   const vector<Blob<DataType> *> & output_blob) {
+  if (!this->need_bp_at(need_bp, 0)) {
+    return;
+  }
+  //in one pass from the output, the gradients may share their memory
   Matrix<DataType, 2>  in_diff_matrix = input_blob[0]->get_diff()->flatten_2d_matrix();
   Matrix<DataType, 2>  output_diff_matrix = output_blob[0]->get_diff()->flatten_2d_matrix();
   Matrix<DataType, 2> out_matrix = output_blob[0]->get_data()->flatten_2d_matrix();
-  act_fun_de(in_diff_matrix, out_matrix);
-  in_diff_matrix = in_diff_matrix * output_diff_matrix;
+  activation_grad<act::tanh<DataType> >(in_diff_matrix, output_diff_matrix, out_matrix,
+      this->add_bottom_diff(0));
 }
 
 //regesite
@@ -5,6 +5,7 @@
 #include <cstdlib>
 #include <fstream>
 #include "../common/utils.h"
+#include "../storage/mmap_buffer.h"
 
 namespace snoopy {
 namespace ml{
@@ -15,40 +16,148 @@ void TextDataFeedLayer<DataType>::init_spec_layer(const vector<Blob<DataType> *>
     current_index = 0;
     data_param_ = this->layer_param_.data_param();
     is_end_ = false;
-    data_.clear();
+    records_ = io::SlotRecords(data_param_.slot_size());
+
+    is_stream_ = data_param_.streaming();
+    if (is_stream_) {
+        CHECK_GE(data_param_.prefetch_batches(), 1);
+        //one batch more than the prefetch, for the one in the output blobs
+        BlobShape bs {static_cast<unsigned long>(data_param_.batch_size()),
+                      static_cast<unsigned long>(data_param_.slot_capicity())};
+        ring_.resize(data_param_.prefetch_batches() + 1);
+        for (size_t b = 0; b < ring_.size(); ++b) {
+            for (int j = 0; j < data_param_.slot_size(); ++j) {
+                ring_[b].push_back(shared_ptr<MBlob<DataType> >(
+                            new MBlob<DataType>(storage::default_allocator(), bs)));
+            }
+        }
+    }
+}
+
+template <typename DataType>
+TextDataFeedLayer<DataType>::~TextDataFeedLayer() {
+    stop_stream();
+}
+
+template <typename DataType>
+void TextDataFeedLayer<DataType>::clear() {
+    is_end_ = false;
+    current_index = 0;
+    if (is_stream_) {
+        start_stream();
+    }
+}
+
+template <typename DataType>
+void TextDataFeedLayer<DataType>::start_stream() {
+    stop_stream();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_.clear();
+        free_.clear();
+        for (int b = 0; b < ring_.size(); ++b) {
+            if (b != current_) {
+                free_.push_back(b);
+            }
+        }
+        stream_done_ = false;
+        stop_ = false;
+    }
+    producer_ = std::thread(&TextDataFeedLayer<DataType>::produce, this);
+}
+
+template <typename DataType>
+void TextDataFeedLayer<DataType>::stop_stream() {
+    if (!producer_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    free_cond_.notify_all();
+    producer_.join();
+}
+
+template <typename DataType>
+void TextDataFeedLayer<DataType>::produce() {
+    //pages behind the reader are dropped every kReleaseBytes
+    const size_t kReleaseBytes = size_t(64) << 20;
+    storage::MappedFile * file = new storage::MappedFile(data_param_.filepath());
+    if (!file->is_open()) {
+        LOG_ERROR << "Error open filepath " << data_param_.filepath();
+    }
+    file->advise_sequential();
+    const char * begin = file->data();
+    const char * end = begin + file->size();
+    const char * p = begin;
+    size_t released = 0;
+    const size_t batch_size = data_param_.batch_size();
+    io::SlotParser parser(data_param_.slot_size(), data_param_.slot_capicity(),
+            this->shard_id_, this->shard_num_, data_param_.max_line());
+    io::SlotRecords records(data_param_.slot_size());
+    std::vector<DataType *> slots(data_param_.slot_size());
+    for (bool is_eof = !file->is_open(); !is_eof; ) {
+        int b = -1;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            free_cond_.wait(lock, [this] { return stop_ || !free_.empty(); });
+            if (stop_) {
+                break;
+            }
+            b = free_.front();
+            free_.pop_front();
+        }
+        records.clear();
+        p = parser.parse(p, end, records, batch_size);
+        is_eof = (records.size() < batch_size);
+        if (!is_eof) {
+            for (size_t j = 0; j < slots.size(); ++j) {
+                slots[j] = ring_[b][j]->data_->data();
+            }
+            this->fill_slot_rows(records, 0, batch_size, data_param_.slot_capicity(), slots);
+        }
+        if (p - begin >= released + kReleaseBytes) {
+            released = p - begin;
+            file->release(released);
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        //a last partial batch is dropped, as by the loading mode
+        if (!is_eof) {
+            ready_.push_back(b);
+        } else {
+            free_.push_front(b);
+        }
+        ready_cond_.notify_one();
+    }
+    file->unref();
+    std::lock_guard<std::mutex> lock(mutex_);
+    stream_done_ = true;
+    ready_cond_.notify_all();
 }
 
 template <typename DataType>
 int TextDataFeedLayer<DataType>::read_file() {
-   ifstream in(this->data_param_.filepath().c_str());
-   char buffer[1024];
-   std::vector<std::string> token_list1;
-   std::vector<std::string> token_list2;
-   if (!in.is_open()) {
+   if (is_stream_) {
+       if (!std::ifstream(this->data_param_.filepath().c_str()).is_open()) {
+           LOG_FATAL << "Error open filepath " << this->data_param_.filepath();
+           return snoopy::FAILURE;
+       }
+       start_stream();
+       return snoopy::SUCCESS;
+   }
+   storage::MappedFile * file = new storage::MappedFile(this->data_param_.filepath());
+   if (!file->is_open()) {
        LOG_FATAL << "Error open filepath " << this->data_param_.filepath();
+       file->unref();
        return snoopy::FAILURE;
    }
-   std::vector<std::vector<int> > tmp_vec1;
-   std::vector<int> tmp_vec2;
-   for (int i = 0; i < this->data_param_.max_line() && !in.eof(); ++i) {
-       if (!in.getline(buffer, 1024)) {
-           break;
-       }
-       split(buffer, token_list1, ";");
-       if (token_list1.size() == 0) {
-           continue;
-       }
-       tmp_vec1.clear();
-       for (int j = 0; j < token_list1.size(); ++ j) {
-           tmp_vec2.clear();
-           split(token_list1[j], token_list2, " ");
-           for (int k = 0; k < token_list2.size() && k < this->data_param_.slot_capicity(); ++k) {
-               tmp_vec2.push_back(std::atoi(token_list2[k].c_str()));
-           }
-           tmp_vec1.push_back(tmp_vec2);
-       }
-       data_.push_back(tmp_vec1);
-   }
+   file->advise_sequential();
+   io::SlotParser parser(this->data_param_.slot_size(), this->data_param_.slot_capicity(),
+           this->shard_id_, this->shard_num_, this->data_param_.max_line());
+   records_.clear();
+   parser.parse(file->data(), file->data() + file->size(), records_);
+   file->unref();
    return snoopy::SUCCESS;
 }
 
@@ -58,36 +167,48 @@ int TextDataFeedLayer<DataType>::get_data(std::vector<matrix::Blob<DataType> *>
    CHECK_EQ(output_blob.size(), this->data_param_.slot_size());
    CHECK_EQ(output_blob[0]->dim_at(0), this->data_param_.batch_size());
    CHECK_EQ(output_blob[0]->dim_at(1), this->data_param_.slot_capicity());
-   if (data_.size() > 0) {
-       CHECK_GE(data_[0].size(), output_blob.size());
-       if (data_[0].size() > 0) {
-           CHECK_LE(data_[0][0].size(), output_blob[0]->dim_at(1));
-       }
+   if (is_stream_) {
+       return get_stream_data(output_blob);
    }
-
-   if (data_.size() - current_index < this->data_param_.batch_size()) {
+   if (records_.size() - current_index < this->data_param_.batch_size()) {
        is_end_ = true;
        return snoopy::SUCCESS;
    }
-   for (size_t i = 0; i < this->data_param_.batch_size(); ++i) {
-       size_t n_row = current_index + i;
-       if (n_row < data_.size()) {
-           for (size_t j = 0; j < this->data_param_.slot_size(); ++j) {
-               for (size_t k = 0; k < this->data_param_.slot_capicity(); ++k) {
-                   size_t index_of_blob = k + i * this->data_param_.slot_capicity();
-                   if (k < data_[n_row][j].size()) {
-                    output_blob[j]->set_data_at(index_of_blob, data_[n_row][j][k]);
-                   } else {
-                    output_blob[j]->set_data_at(index_of_blob, -1);
-                   }
-               }
-           }
-       }
+   std::vector<DataType *> slots;
+   for (size_t j = 0; j < output_blob.size(); ++j) {
+       slots.push_back(output_blob[j]->get_data()->data_->data());
    }
+   this->fill_slot_rows(records_, current_index, this->data_param_.batch_size(),
+           this->data_param_.slot_capicity(), slots);
    current_index += this->data_param_.batch_size();
    return snoopy::SUCCESS;
 }
 
+template <typename DataType>
+int TextDataFeedLayer<DataType>::get_stream_data(std::vector<matrix::Blob<DataType> *> & output_blob) {
+   int b = -1;
+   {
+       std::unique_lock<std::mutex> lock(mutex_);
+       ready_cond_.wait(lock, [this] { return stream_done_ || !ready_.empty(); });
+       if (ready_.empty()) {
+           is_end_ = true;
+           return snoopy::SUCCESS;
+       }
+       b = ready_.front();
+       ready_.pop_front();
+       //the net is done with the batch of the last step
+       if (current_ >= 0) {
+           free_.push_back(current_);
+       }
+       current_ = b;
+   }
+   free_cond_.notify_one();
+   for (size_t j = 0; j < output_blob.size(); ++j) {
+       output_blob[j]->set_data(ring_[b][j]);
+   }
+   return snoopy::SUCCESS;
+}
+
 //regesite
 LAYER_REGISTER_CLASS(TextDataFeed)
 
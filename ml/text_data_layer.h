@@ -1,6 +1,10 @@
 #ifndef SNOOPY_ML_TEXT_DATA_H
 #define SNOOPY_ML_TEXT_DATA_H
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 #include "layer.h"
 #include "data_layer.h"
@@ -8,28 +12,69 @@
 namespace snoopy {
 namespace ml{
 
+/**
+ * feed of text lines, one sample per line, the slots are separated by ';'
+ * and the ids of a slot by ' '
+ *
+ * By default read_file() parses the whole file, mapped, with io::SlotParser
+ * into one io::SlotRecords. In streaming mode a
+ * background thread parses the file into a ring of prefetch_batches + 1
+ * batches while the net trains; get_data() swaps a parsed batch into the
+ * output blobs instead of copying it, and the batch it replaces goes back
+ * to the thread. The memory does not depend on the size of the file.
+ */
 template <typename DataType>
 class TextDataFeedLayer : public DataFeedLayer<DataType> {
     private:
-        std::vector<std::vector<std::vector<int> > > data_;     
+        io::SlotRecords records_; //!< the samples of the file in loading mode
         int current_index;
         DataFeedParameter data_param_;
         bool is_end_;
+
+        /**
+         * streaming mode
+         */
+        bool is_stream_;
+        std::vector<std::vector<shared_ptr<MBlob<DataType> > > > ring_; //!< batches, a MBlob per slot
+        std::deque<int> ready_; //!< parsed batches, in file order
+        std::deque<int> free_; //!< batches to parse into
+        int current_; //!< the batch in the output blobs, -1 for none
+        bool stream_done_; //!< the thread has parsed its last batch
+        bool stop_;
+        std::thread producer_;
+        std::mutex mutex_;
+        std::condition_variable ready_cond_;
+        std::condition_variable free_cond_;
+
+        /**
+         * (re)start the thread from the beginning of the file
+         */
+        void start_stream();
+        void stop_stream();
+
+        /**
+         * the loop of the background thread
+         */
+        void produce();
+
+        int get_stream_data(std::vector<matrix::Blob<DataType> *> & output_blob);
+
     public:
      explicit TextDataFeedLayer(const LayerParameter & para) :
-         DataFeedLayer<DataType>(para) {}
+         DataFeedLayer<DataType>(para),
+         is_stream_(false),
+         current_(-1),
+         stream_done_(true),
+         stop_(false) {}
         virtual void init_spec_layer(const vector<Blob<DataType> *> & input_blob,
                     const vector<Blob<DataType> *> & output_blob);
 
-        ~TextDataFeedLayer() {}
+        ~TextDataFeedLayer();
 
-        virtual void clear() {
-            is_end_ = false;
-            current_index = 0;
-        }
+        virtual void clear();
 
         virtual bool is_end() {
-           return is_end_; 
+           return is_end_;
         }
 
         virtual int read_file();
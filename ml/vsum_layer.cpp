@@ -23,13 +23,23 @@ template<typename DataType>
 void VsumLayer<DataType>::backward_cpu(const vector<Blob<DataType> *> & input_blob,
                   const vector<bool> & need_bp,
                   const vector<Blob<DataType> *> & output_blob) {
+    if (!this->need_bp_at(need_bp, 0)) {
+        return;
+    }
     Matrix<DataType, 2>  output_diff_matrix = output_blob[0]->get_diff()->flatten_2d_matrix();
     Matrix<DataType, 2>  in_diff_matrix = input_blob[0]->get_diff()->flatten_2d_matrix();
 
     size_t in_row = in_diff_matrix.get_row();
     size_t out_row = output_diff_matrix.get_row();
     size_t sum_range = in_row / out_row;
+    const bool is_add = this->add_bottom_diff(0);
     for (size_t i = 0; i < out_row; ++i) {
+        if (is_add) {
+            for (size_t k = i*sum_range; k < (i+1)*sum_range; ++k) {
+                in_diff_matrix[k] = in_diff_matrix[k] + output_diff_matrix[i];
+            }
+            continue;
+        }
         Matrix<DataType, 2> slice_matrix = in_diff_matrix.slice(i*sum_range, (i+1)*sum_range); 
         repmat(slice_matrix, output_diff_matrix.slice(i, i+1), 0);
     }
@@ -17,6 +17,9 @@ public:
      virtual void reshape(const vector<Blob<DataType> *> & input_blob,
                     const vector<Blob<DataType> *> & output_blob) {}
 
+     virtual bool bp_need_input_data() { return false; }
+     virtual bool bp_need_output_data() { return false; }
+
      virtual int exact_bottom_blob() { return 1; }
      virtual int exact_top_blob() { return 1; }
 
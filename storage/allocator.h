@@ -98,6 +98,46 @@ class CPUallocator : public Allocator {
 
 };
 
+// -------------------------------
+/// @Brief  the process wide CPUallocator, it is never destroyed so buffers
+///         released during static destruction still have a valid allocator
+// ---------------------------------
+inline Allocator * cpu_allocator() {
+    static Allocator * a = new CPUallocator;
+    return a;
+}
+
+inline Allocator *& thread_allocator_slot() {
+    static thread_local Allocator * a = nullptr;
+    return a;
+}
+
+// -------------------------------
+/// @Brief  the allocator used by the current thread for new matrices and
+///         blobs, cpu_allocator() unless an AllocatorScope is active
+// ---------------------------------
+inline Allocator * default_allocator() {
+    Allocator * a = thread_allocator_slot();
+    return a != nullptr ? a : cpu_allocator();
+}
+
+// -------------------------------
+/// @Brief  make `a` the default allocator of the current thread until the
+///         scope ends, scopes nest
+// ---------------------------------
+class AllocatorScope {
+    public:
+        explicit AllocatorScope(Allocator * a) : _prev(thread_allocator_slot()) {
+            thread_allocator_slot() = a;
+        }
+        ~AllocatorScope() { thread_allocator_slot() = _prev; }
+
+    private:
+        Allocator * _prev;
+
+        DISALLOW_COPY_AND_ASSIGN(AllocatorScope)
+};
+
 
 
 
@@ -0,0 +1,150 @@
+/**
+ *  \file  arena_allocator.h
+ *  \brief bump-pointer allocator for the scratch memory of one step
+ *
+ *  ArenaAllocator hands out memory by moving a pointer forward and frees
+ *  nothing on deallocate_raw. reset() gives back everything at once, so it
+ *  suits temporaries that all die at the same point, e.g. the scratch
+ *  matrices of the layers during one forward/backward step. When a step
+ *  needs more than the current chunk, a new chunk is taken from the backing
+ *  allocator; the next reset() merges the chunks into one, so a steady
+ *  state step is a single chunk and reset() is O(1).
+ */
+
+#ifndef SNOOPY_ARENA_ALLOCATOR_H
+#define SNOOPY_ARENA_ALLOCATOR_H
+
+#include <cstdint>
+#include <vector>
+#include "allocator.h"
+#include "../common/logging.h"
+
+namespace snoopy {
+namespace storage {
+
+class ArenaAllocator : public Allocator {
+    public:
+        static const size_t kChunkAlign = 64;
+
+        // -------------------------------
+        /// @Brief  constructor
+        ///
+        /// @Param backing: the allocator the chunks come from, it must outlive the arena
+        /// @Param chunk_bytes: the size of the first chunk
+        // ---------------------------------
+        explicit ArenaAllocator(Allocator * backing = cpu_allocator(),
+                size_t chunk_bytes = size_t(1) << 20) :
+            _backing(backing),
+            _cur(nullptr),
+            _end(nullptr),
+            _used(0),
+            _peak(0),
+            _first_chunk_bytes(chunk_bytes) {}
+
+        ~ArenaAllocator() {
+            release();
+        }
+
+        void * allocate_raw(size_t align, size_t num_bytes) {
+            CHECK_LE(align, kChunkAlign);
+            char * p = align_up(_cur, align);
+            if (_cur == nullptr || p + num_bytes > _end) {
+                size_t bytes = _chunks.empty() ? _first_chunk_bytes : 2 * _chunks.back().second;
+                if (bytes < num_bytes) {
+                    bytes = num_bytes;
+                }
+                add_chunk(bytes);
+                p = _cur;
+            }
+            _cur = p + num_bytes;
+            _used += num_bytes;
+            if (_used > _peak) {
+                _peak = _used;
+            }
+            return p;
+        }
+
+        // -------------------------------
+        /// @Brief  nothing is freed until reset()
+        // ---------------------------------
+        void deallocate_raw(void * ptr) {}
+
+        // -------------------------------
+        /// @Brief  release every allocation of the step, the memory handed
+        ///         out before must not be used afterwards
+        // ---------------------------------
+        void reset() {
+            if (_chunks.size() > 1) {
+                size_t total = 0;
+                for (size_t i = 0; i < _chunks.size(); ++i) {
+                    total += _chunks[i].second;
+                }
+                release();
+                add_chunk(total);
+            } else if (!_chunks.empty()) {
+                _cur = _chunks[0].first;
+            }
+            _used = 0;
+        }
+
+        // -------------------------------
+        /// @Brief  bytes handed out since the last reset()
+        // ---------------------------------
+        size_t bytes_used() const { return _used; }
+
+        // -------------------------------
+        /// @Brief  the largest bytes_used() seen
+        // ---------------------------------
+        size_t peak_bytes_used() const { return _peak; }
+
+        size_t capacity() const {
+            size_t total = 0;
+            for (size_t i = 0; i < _chunks.size(); ++i) {
+                total += _chunks[i].second;
+            }
+            return total;
+        }
+
+        size_t num_chunks() const { return _chunks.size(); }
+
+    private:
+        static inline char * align_up(char * p, size_t align) {
+            return reinterpret_cast<char *>(
+                    (reinterpret_cast<uintptr_t>(p) + align - 1) & ~(uintptr_t(align) - 1));
+        }
+
+        void add_chunk(size_t bytes) {
+            char * p = static_cast<char *>(_backing->allocate_raw(kChunkAlign, bytes));
+            if (p == nullptr) {
+                LOG_FATAL << "ArenaAllocator: allocate " << bytes << " bytes failed";
+            }
+            _chunks.push_back(std::make_pair(p, bytes));
+            _cur = p;
+            _end = p + bytes;
+        }
+
+        void release() {
+            for (size_t i = 0; i < _chunks.size(); ++i) {
+                _backing->deallocate_raw(_chunks[i].first);
+            }
+            _chunks.clear();
+            _cur = nullptr;
+            _end = nullptr;
+        }
+
+    private:
+        Allocator * _backing;
+        std::vector<std::pair<char *, size_t> > _chunks;
+        char * _cur;
+        char * _end;
+        size_t _used;
+        size_t _peak;
+        size_t _first_chunk_bytes;
+
+        DISALLOW_COPY_AND_ASSIGN(ArenaAllocator)
+};
+
+}
+}
+
+#endif
@@ -25,20 +25,21 @@ class RefCount {
         }
 
         // -------------------------------
-        /// @Brief  decrease the ref count by 1
+        /// @Brief  decrease the ref count by 1, the owner that drops the
+        ///         last reference deletes the object
         /// 
         /// @Returns   true if ref count is zero, false otherwise
         //
         // ---------------------------------
         inline bool unref() const {
-            if (_ref_count.load(memory_order_acquire) == 1 ||
-                    _ref_count.fetch_sub(1) == 1) {
-                _ref_count.store(0);
+            //a single read-modify-write decides the last owner; release
+            //publishes our writes to it, acquire makes the writes of the
+            //other owners visible before the delete
+            if (_ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
                 delete this;
                 return true;
-            } else {
-                return false;
             }
+            return false;
         }
 
         inline bool ref_is_one() const {
@@ -0,0 +1,123 @@
+/**
+ *  \file  mmap_buffer.h
+ *  \brief tensor buffers backed by a read-only file mapping
+ *
+ *  A MappedFile maps a whole file with PROT_READ and MAP_SHARED, so every
+ *  process that maps the same file shares its page cache and nothing is
+ *  read until it is touched. MmapBuffer is a TensorBuffer on a range of the
+ *  mapping; it holds a reference on the file, the mapping goes away with
+ *  the last buffer. The memory is read-only: writing through a MmapBuffer
+ *  faults, so only nets that do not update their parameters may use it.
+ */
+
+#ifndef SNOOPY_MMAP_BUFFER_H
+#define SNOOPY_MMAP_BUFFER_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include "buffer.h"
+#include "../common/logging.h"
+
+namespace snoopy {
+namespace storage {
+
+class MappedFile : public RefCount {
+    public:
+        // -------------------------------
+        /// @Brief  map `file_name`, is_open() tells whether it succeeded
+        // ---------------------------------
+        explicit MappedFile(const std::string & file_name) : _data(nullptr), _size(0) {
+            int fd = open(file_name.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return;
+            }
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void * p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+                if (p != MAP_FAILED) {
+                    _data = static_cast<char *>(p);
+                    _size = st.st_size;
+                }
+            }
+            close(fd);
+        }
+
+        inline bool is_open() const { return _data != nullptr; }
+        inline const char * data() const { return _data; }
+        inline size_t size() const { return _size; }
+
+        // -------------------------------
+        /// @Brief  the file will be read once from the start, read ahead
+        // ---------------------------------
+        void advise_sequential() {
+            if (_data != nullptr) {
+                madvise(_data, _size, MADV_SEQUENTIAL);
+            }
+        }
+
+        // -------------------------------
+        /// @Brief  drop the pages of [0, end) from the mapping, they are read
+        ///         from the file again if touched; keeps a streaming reader of
+        ///         a large file from holding the whole file resident
+        // ---------------------------------
+        void release(size_t end) {
+            const size_t page = sysconf(_SC_PAGESIZE);
+            end = end / page * page;
+            if (_data != nullptr && end > 0) {
+                madvise(_data, end < _size ? end : _size, MADV_DONTNEED);
+            }
+        }
+
+    private:
+        ~MappedFile() {
+            if (_data != nullptr) {
+                munmap(_data, _size);
+            }
+        }
+
+    private:
+        char * _data;
+        size_t _size;
+
+        DISALLOW_COPY_AND_ASSIGN(MappedFile)
+};
+
+template <typename T>
+class MmapBuffer : public TensorBuffer<T> {
+    public:
+        // -------------------------------
+        /// @Brief  buffer of `n` elements at `byte_offset` of the mapping
+        // ---------------------------------
+        MmapBuffer(MappedFile * f, size_t byte_offset, int64_t n) :
+            _file(f),
+            _data(reinterpret_cast<T *>(const_cast<char *>(f->data()) + byte_offset)),
+            _data_ele_num(n) {
+            CHECK_LE(byte_offset + n * sizeof(T), f->size());
+            _file->ref();
+        }
+
+        T * data() const { return _data; }
+        T * data() { return _data; }
+        int64_t size() const { return _data_ele_num * sizeof(T); }
+        TensorBuffer<T> * root_buffer() { return this; }
+        virtual const T & operator[] (size_t i) const { return _data[i]; }
+        virtual T & operator[] (size_t i) { return _data[i]; }
+        virtual const T & at (size_t i) const { return _data[i]; }
+        virtual T & at (size_t i) { return _data[i]; }
+
+    private:
+        ~MmapBuffer() { _file->unref(); }
+
+    private:
+        MappedFile * _file;
+        T * _data;
+        int64_t _data_ele_num;
+};
+
+}
+}
+
+#endif
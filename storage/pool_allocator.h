@@ -0,0 +1,343 @@
+/**
+ *  \file  pool_allocator.h
+ *  \brief size-class caching allocator
+ *
+ *  PoolAllocator rounds every request up to a power-of-two size class and
+ *  keeps released blocks on free lists instead of giving them back to the
+ *  system. Small classes are carved out of 2MB slabs that are mapped with
+ *  transparent huge pages; big blocks get their own mapping and are cached
+ *  the same way. Each thread keeps a short free list per small class, so
+ *  the common alloc/free pair of a temporary takes no lock at all.
+ *
+ *  Once the working set of an iteration has been seen, the following
+ *  iterations are served from the free lists and `system_allocs` in the
+ *  stats stops growing. The memory is unmapped when the pool is destroyed,
+ *  so the pool must outlive every buffer it has handed out.
+ */
+
+#ifndef SNOOPY_POOL_ALLOCATOR_H
+#define SNOOPY_POOL_ALLOCATOR_H
+
+#include <sys/mman.h>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "allocator.h"
+#include "../common/logging.h"
+
+namespace snoopy {
+namespace storage {
+
+// -------------------------------
+/// @Brief  counters of a PoolAllocator
+// ---------------------------------
+struct PoolStats {
+    uint64_t allocs;            //!< calls of allocate_raw
+    uint64_t reuse_hits;        //!< allocations served from a free list
+    uint64_t system_allocs;     //!< mmap calls
+    uint64_t bytes_reserved;    //!< bytes mapped from the system
+    uint64_t bytes_in_use;      //!< bytes of the blocks handed out
+    uint64_t peak_bytes_in_use;
+};
+
+class PoolAllocator : public Allocator {
+    public:
+        static const size_t kHeaderBytes = 64;      //!< also the alignment of the blocks
+        static const size_t kMinShift = 7;          //!< smallest block is 128 bytes
+        static const size_t kNumClasses = 48 - kMinShift;
+        static const size_t kSlabShift = 21;        //!< 2MB slabs
+        static const size_t kSlabBytes = size_t(1) << kSlabShift;
+        static const size_t kNumSlabClasses = kSlabShift - 2 - kMinShift + 1; //!< blocks up to 512KB
+        static const size_t kThreadCacheBlocks = 32; //!< per thread and per class
+        static const size_t kMaxThreadCaches = 8;   //!< pools one thread caches for
+
+        PoolAllocator() : _id(next_id()), _slab_cur(nullptr), _slab_end(nullptr) {
+            for (size_t c = 0; c < kNumClasses; ++c) {
+                _free[c] = nullptr;
+            }
+            _allocs = 0;
+            _reuse_hits = 0;
+            _system_allocs = 0;
+            _bytes_reserved = 0;
+            _bytes_in_use = 0;
+            _peak_bytes_in_use = 0;
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            registry()[_id] = this;
+        }
+
+        ~PoolAllocator() {
+            {
+                std::lock_guard<std::mutex> lock(registry_mutex());
+                registry().erase(_id);
+            }
+            for (size_t i = 0; i < _regions.size(); ++i) {
+                munmap(_regions[i].first, _regions[i].second);
+            }
+        }
+
+        void * allocate_raw(size_t align, size_t num_bytes) {
+            CHECK_LE(align, kHeaderBytes);
+            const size_t c = size_class(num_bytes + kHeaderBytes);
+            CHECK_LT(c, kNumClasses);
+            _allocs.fetch_add(1, std::memory_order_relaxed);
+
+            Block * b = nullptr;
+            ThreadCache * tc = c < kNumSlabClasses ? thread_cache() : nullptr;
+            if (tc != nullptr && tc->head[c] != nullptr) {
+                b = tc->head[c];
+                tc->head[c] = b->next;
+                --tc->count[c];
+                _reuse_hits.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_free[c] != nullptr) {
+                    b = _free[c];
+                    _free[c] = b->next;
+                    _reuse_hits.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    b = carve(c);
+                }
+            }
+            b->magic = kMagic;
+            b->size_class = c;
+            b->next = nullptr;
+
+            const uint64_t in_use = _bytes_in_use.fetch_add(block_bytes(c),
+                    std::memory_order_relaxed) + block_bytes(c);
+            uint64_t peak = _peak_bytes_in_use.load(std::memory_order_relaxed);
+            while (in_use > peak && !_peak_bytes_in_use.compare_exchange_weak(peak, in_use,
+                        std::memory_order_relaxed)) {
+            }
+            return reinterpret_cast<char *>(b) + kHeaderBytes;
+        }
+
+        void deallocate_raw(void * ptr) {
+            if (ptr == nullptr) {
+                return;
+            }
+            Block * b = reinterpret_cast<Block *>(static_cast<char *>(ptr) - kHeaderBytes);
+            CHECK_EQ(b->magic, kMagic);
+            const size_t c = b->size_class;
+            _bytes_in_use.fetch_sub(block_bytes(c), std::memory_order_relaxed);
+
+            ThreadCache * tc = c < kNumSlabClasses ? thread_cache() : nullptr;
+            if (tc != nullptr && tc->count[c] < kThreadCacheBlocks) {
+                b->next = tc->head[c];
+                tc->head[c] = b;
+                ++tc->count[c];
+                return;
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            b->next = _free[c];
+            _free[c] = b;
+        }
+
+        // -------------------------------
+        /// @Brief  snapshot of the counters
+        // ---------------------------------
+        PoolStats get_stats() const {
+            PoolStats s;
+            s.allocs = _allocs.load(std::memory_order_relaxed);
+            s.reuse_hits = _reuse_hits.load(std::memory_order_relaxed);
+            s.system_allocs = _system_allocs.load(std::memory_order_relaxed);
+            s.bytes_reserved = _bytes_reserved.load(std::memory_order_relaxed);
+            s.bytes_in_use = _bytes_in_use.load(std::memory_order_relaxed);
+            s.peak_bytes_in_use = _peak_bytes_in_use.load(std::memory_order_relaxed);
+            return s;
+        }
+
+        // -------------------------------
+        /// @Brief  the size class of a block of `bytes` bytes, header included
+        // ---------------------------------
+        static inline size_t size_class(size_t bytes) {
+            size_t c = 0;
+            while ((size_t(1) << (c + kMinShift)) < bytes) {
+                ++c;
+            }
+            return c;
+        }
+
+        static inline size_t block_bytes(size_t c) {
+            return size_t(1) << (c + kMinShift);
+        }
+
+    private:
+        static const uint32_t kMagic = 0x9001ab1e;
+
+        struct Block {
+            uint32_t magic;
+            uint32_t size_class;
+            Block * next;
+        };
+
+        struct ThreadCache {
+            uint64_t pool_id;
+            Block * head[kNumSlabClasses];
+            size_t count[kNumSlabClasses];
+        };
+
+        // -------------------------------
+        /// @Brief  the thread caches of one thread, the blocks go back to
+        ///         their pool when the thread exits
+        // ---------------------------------
+        struct ThreadCacheTable {
+            ThreadCache caches[kMaxThreadCaches];
+
+            ThreadCacheTable() {
+                for (size_t i = 0; i < kMaxThreadCaches; ++i) {
+                    reset(caches[i], 0);
+                }
+            }
+
+            ~ThreadCacheTable() {
+                std::lock_guard<std::mutex> lock(registry_mutex());
+                for (size_t i = 0; i < kMaxThreadCaches; ++i) {
+                    std::map<uint64_t, PoolAllocator *>::iterator it =
+                        registry().find(caches[i].pool_id);
+                    if (it != registry().end()) {
+                        it->second->flush(caches[i]);
+                    }
+                }
+            }
+        };
+
+        static inline void reset(ThreadCache & tc, uint64_t id) {
+            tc.pool_id = id;
+            for (size_t c = 0; c < kNumSlabClasses; ++c) {
+                tc.head[c] = nullptr;
+                tc.count[c] = 0;
+            }
+        }
+
+        static inline uint64_t next_id() {
+            static std::atomic<uint64_t> id(0);
+            return ++id;
+        }
+
+        static inline std::mutex & registry_mutex() {
+            static std::mutex * m = new std::mutex;
+            return *m;
+        }
+
+        static inline std::map<uint64_t, PoolAllocator *> & registry() {
+            static std::map<uint64_t, PoolAllocator *> * r =
+                new std::map<uint64_t, PoolAllocator *>;
+            return *r;
+        }
+
+        // -------------------------------
+        /// @Brief  the cache of this pool for the calling thread, nullptr if
+        ///         the thread already caches for kMaxThreadCaches live pools
+        // ---------------------------------
+        ThreadCache * thread_cache() {
+            static thread_local ThreadCacheTable table;
+            for (size_t i = 0; i < kMaxThreadCaches; ++i) {
+                if (table.caches[i].pool_id == _id) {
+                    return &table.caches[i];
+                }
+            }
+            //the ids are never reused, a slot of a destroyed pool is free
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            for (size_t i = 0; i < kMaxThreadCaches; ++i) {
+                if (registry().count(table.caches[i].pool_id) == 0) {
+                    reset(table.caches[i], _id);
+                    return &table.caches[i];
+                }
+            }
+            return nullptr;
+        }
+
+        void flush(ThreadCache & tc) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (size_t c = 0; c < kNumSlabClasses; ++c) {
+                while (tc.head[c] != nullptr) {
+                    Block * b = tc.head[c];
+                    tc.head[c] = b->next;
+                    b->next = _free[c];
+                    _free[c] = b;
+                }
+                tc.count[c] = 0;
+            }
+        }
+
+        // -------------------------------
+        /// @Brief  map `bytes` bytes aligned to a slab, advised to use huge pages
+        // ---------------------------------
+        char * map_region(size_t bytes) {
+            const size_t len = bytes + kSlabBytes;
+            void * p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                LOG_FATAL << "PoolAllocator: mmap of " << bytes << " bytes failed";
+            }
+            char * begin = static_cast<char *>(p);
+            char * aligned = reinterpret_cast<char *>(
+                    (reinterpret_cast<uintptr_t>(begin) + kSlabBytes - 1) & ~(kSlabBytes - 1));
+            if (aligned != begin) {
+                munmap(begin, aligned - begin);
+            }
+            const size_t tail = (begin + len) - (aligned + bytes);
+            if (tail > 0) {
+                munmap(aligned + bytes, tail);
+            }
+#ifdef MADV_HUGEPAGE
+            madvise(aligned, bytes, MADV_HUGEPAGE);
+#endif
+            _regions.push_back(std::make_pair(static_cast<void *>(aligned), bytes));
+            _system_allocs.fetch_add(1, std::memory_order_relaxed);
+            _bytes_reserved.fetch_add(bytes, std::memory_order_relaxed);
+            return aligned;
+        }
+
+        // -------------------------------
+        /// @Brief  a new block of class `c`, called with _mutex held
+        // ---------------------------------
+        Block * carve(size_t c) {
+            const size_t bytes = block_bytes(c);
+            if (c >= kNumSlabClasses) {
+                return reinterpret_cast<Block *>(map_region(bytes));
+            }
+            if (static_cast<size_t>(_slab_end - _slab_cur) < bytes) {
+                //hand the tail of the old slab to the smaller classes
+                while (static_cast<size_t>(_slab_end - _slab_cur) >= block_bytes(0)) {
+                    size_t t = size_class(_slab_end - _slab_cur);
+                    if (block_bytes(t) > static_cast<size_t>(_slab_end - _slab_cur)) {
+                        --t;
+                    }
+                    Block * b = reinterpret_cast<Block *>(_slab_cur);
+                    b->next = _free[t];
+                    _free[t] = b;
+                    _slab_cur += block_bytes(t);
+                }
+                _slab_cur = map_region(kSlabBytes);
+                _slab_end = _slab_cur + kSlabBytes;
+            }
+            Block * b = reinterpret_cast<Block *>(_slab_cur);
+            _slab_cur += bytes;
+            return b;
+        }
+
+    private:
+        const uint64_t _id;
+        std::mutex _mutex;
+        Block * _free[kNumClasses];
+        char * _slab_cur;
+        char * _slab_end;
+        std::vector<std::pair<void *, size_t> > _regions;
+
+        std::atomic<uint64_t> _allocs;
+        std::atomic<uint64_t> _reuse_hits;
+        std::atomic<uint64_t> _system_allocs;
+        std::atomic<uint64_t> _bytes_reserved;
+        std::atomic<uint64_t> _bytes_in_use;
+        std::atomic<uint64_t> _peak_bytes_in_use;
+
+        DISALLOW_COPY_AND_ASSIGN(PoolAllocator)
+};
+
+}
+}
+
+#endif
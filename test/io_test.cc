@@ -1,8 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <fstream>
+#include <iterator>
 #include <gtest/gtest.h> 
 #include "../proto/snoopy.pb.h"
 #include "../io/get_conf.h"
+#include "../io/slot_parser.h"
+#include "../io/record_file.h"
 
 using namespace snoopy::io;
 using namespace snoopy;
@@ -18,3 +22,163 @@ TEST(read_net_proto, get_data) {
     int status = read_net_proto_from_text_file("./net_demo.proto.txt", net_p);
     EXPECT_EQ(status, snoopy::SUCCESS);
 }
+
+TEST(SlotParser, parse) {
+    //a line longer than a SIMD block, empty slots and ids, a '\r', an
+    //empty line, a line with more slots and ids than kept, no final '\n'
+    std::string text;
+    for (int i = 0; i < 40; ++i) {
+        text += std::to_string(i * 1000) + " ";
+    }
+    text += ";7\n";
+    text += "  1  -2 ;;3\r\n";
+    text += "\n";
+    text += "4 5 6 7 8;9;10;11\n";
+    text += " ;12";
+
+    SlotParser parser(2, 3);
+    SlotRecords records(2);
+    const char * end = parser.parse(text.data(), text.data() + text.size(), records);
+    EXPECT_EQ(end, text.data() + text.size());
+    EXPECT_EQ(parser.lines(), 5);
+    ASSERT_EQ(records.size(), 4);
+
+    std::vector<std::vector<std::vector<int> > > expect = {
+        {{0, 1000, 2000}, {7}},
+        {{1, -2}, {3}},
+        {{4, 5, 6}, {9}},
+        {{}, {12}}};
+    for (size_t r = 0; r < records.size(); ++r) {
+        for (size_t j = 0; j < 2; ++j) {
+            std::vector<int> ids(records.slot_begin(r, j),
+                                 records.slot_begin(r, j) + records.slot_length(r, j));
+            EXPECT_EQ(ids, expect[r][j]);
+        }
+    }
+
+    //a line with an id out of the range of an int is dropped
+    text = "1;2147483647\n3;2147483648\n4 -2147483648;5\n-2147483649;6\n"
+           "99999999999999999999999;7\n8;9";
+    SlotParser range_parser(2, 3);
+    records.clear();
+    range_parser.parse(text.data(), text.data() + text.size(), records);
+    EXPECT_EQ(range_parser.lines(), 6);
+    EXPECT_EQ(range_parser.bad_lines(), 3);
+    ASSERT_EQ(records.size(), 3);
+    expect = {
+        {{1}, {2147483647}},
+        {{4, -2147483648}, {5}},
+        {{8}, {9}}};
+    for (size_t r = 0; r < records.size(); ++r) {
+        for (size_t j = 0; j < 2; ++j) {
+            std::vector<int> ids(records.slot_begin(r, j),
+                                 records.slot_begin(r, j) + records.slot_length(r, j));
+            EXPECT_EQ(ids, expect[r][j]);
+        }
+    }
+}
+
+TEST(SlotParser, shard_and_resume) {
+    std::string text;
+    for (int i = 0; i < 10; ++i) {
+        text += std::to_string(i) + ";" + std::to_string(100 + i) + "\n";
+    }
+    //shard 1 of 3 is the lines 1, 4, 7, two samples at a time
+    SlotParser parser(2, 4, 1, 3, 9);
+    SlotRecords records(2);
+    const char * p = parser.parse(text.data(), text.data() + text.size(), records, 2);
+    ASSERT_EQ(records.size(), 2);
+    EXPECT_EQ(*records.slot_begin(0, 0), 1);
+    EXPECT_EQ(*records.slot_begin(1, 1), 104);
+    records.clear();
+    p = parser.parse(p, text.data() + text.size(), records, 2);
+    ASSERT_EQ(records.size(), 1);
+    EXPECT_EQ(*records.slot_begin(0, 0), 7);
+    //max_line stops before line 9
+    EXPECT_TRUE(parser.is_full());
+    EXPECT_EQ(parser.lines(), 9);
+}
+
+TEST(RecordFile, write_read) {
+    std::string text = "1 2 3;-4\n;5 6\n100000 99999 7;\n8;9 10 11 12\n-7 -8\n";
+    SlotParser parser(2, 8);
+    SlotRecords records(2);
+    parser.parse(text.data(), text.data() + text.size(), records);
+    ASSERT_EQ(records.size(), 5);
+
+    //two samples a block, with labels and weights
+    RecordWriter writer(2, kRecordHasLabel | kRecordHasWeight, 2);
+    ASSERT_EQ(writer.open("test_records.bin"), snoopy::SUCCESS);
+    for (size_t r = 0; r < records.size(); ++r) {
+        writer.add(records, r, r * 1.f, 0.5f);
+    }
+    ASSERT_EQ(writer.close(), snoopy::SUCCESS);
+
+    RecordReader reader;
+    ASSERT_EQ(reader.open("test_records.bin"), snoopy::SUCCESS);
+    EXPECT_EQ(reader.size(), 5);
+    EXPECT_EQ(reader.slot_size(), 2);
+    ASSERT_EQ(reader.num_blocks(), 3);
+    EXPECT_EQ(reader.block_info(1).first_record, 2);
+
+    SlotRecords decoded(2);
+    std::vector<float> labels;
+    std::vector<float> weights;
+    for (size_t b = 0; b < reader.num_blocks(); ++b) {
+        ASSERT_EQ(reader.read_block(b, decoded, 8, &labels, &weights), snoopy::SUCCESS);
+    }
+    EXPECT_EQ(decoded.offsets, records.offsets);
+    EXPECT_EQ(decoded.ids, records.ids);
+    EXPECT_EQ(labels, std::vector<float>({0, 1, 2, 3, 4}));
+    EXPECT_EQ(weights, std::vector<float>(5, 0.5f));
+
+    //the ids past slot_capicity are skipped
+    decoded.clear();
+    ASSERT_EQ(reader.read_block(1, decoded, 2), snoopy::SUCCESS);
+    EXPECT_EQ(decoded.ids, std::vector<int>({100000, 99999, 8, 9, 10}));
+
+    //the reader opens the file again for each epoch, and forgets it on a
+    //file that is not a record one
+    ASSERT_EQ(reader.open("test_records.bin"), snoopy::SUCCESS);
+    EXPECT_EQ(reader.num_blocks(), 3);
+    std::ofstream("test_not_records.txt") << text;
+    EXPECT_EQ(reader.open("test_not_records.txt"), snoopy::FAILURE);
+    EXPECT_EQ(reader.num_blocks(), 0);
+    EXPECT_EQ(reader.size(), 0);
+}
+
+TEST(RecordFile, bad_block) {
+    std::string text = "1 2;3\n4;2147483647\n";
+    SlotParser parser(2, 8);
+    SlotRecords records(2);
+    parser.parse(text.data(), text.data() + text.size(), records);
+    RecordWriter writer(2, kRecordHasLabel, 1);
+    ASSERT_EQ(writer.open("test_bad_records.bin"), snoopy::SUCCESS);
+    writer.add(records, 0, 0);
+    writer.add(records, 1, 1);
+    ASSERT_EQ(writer.close(), snoopy::SUCCESS);
+
+    //the delta of 2147483647 from 0 is the varint fe ff ff ff 0f, make the
+    //id 2^32 + 2147483647
+    std::fstream file("test_bad_records.bin", std::ios::in | std::ios::out | std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const size_t pos = bytes.find("\xfe\xff\xff\xff\x0f");
+    ASSERT_NE(pos, std::string::npos);
+    file.seekp(pos + 4);
+    file.put('\x1f');
+    file.close();
+
+    RecordReader reader;
+    ASSERT_EQ(reader.open("test_bad_records.bin"), snoopy::SUCCESS);
+    ASSERT_EQ(reader.num_blocks(), 2);
+    SlotRecords decoded(2);
+    std::vector<float> labels;
+    ASSERT_EQ(reader.read_block(0, decoded, 8, &labels), snoopy::SUCCESS);
+    const std::vector<size_t> offsets = decoded.offsets;
+    const std::vector<int> ids = decoded.ids;
+    //the id does not fit, and the slot decoded before it is dropped
+    EXPECT_EQ(reader.read_block(1, decoded, 8, &labels), snoopy::FAILURE);
+    EXPECT_EQ(decoded.offsets, offsets);
+    EXPECT_EQ(decoded.ids, ids);
+    EXPECT_EQ(labels, std::vector<float>(1, 0));
+}
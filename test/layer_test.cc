@@ -1,5 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <cmath>
+#include <fstream>
+#include <iterator>
 #include <gtest/gtest.h> 
 #include "../proto/snoopy.pb.h"
 #include "../ml/full_connected_layer.h"
@@ -8,6 +12,7 @@
 #include "../ml/vsum_layer.h"
 #include "../ml/softmax_with_loss_layer.h"
 #include "../ml/text_data_layer.h"
+#include "../ml/binary_data_layer.h"
 #include "../ml/nn.h"
 #include "../io/get_conf.h"
 #include "../ml/sgd_solver.h"
@@ -78,6 +83,283 @@ TEST(DataFeedLayer, get_data) {
      EXPECT_EQ(out3, exp_out3);
 }
 
+TEST(DataFeedLayer, shard) {
+    std::ofstream data("test_shard_data.txt");
+    for (int i = 0; i < 8; ++i) {
+        data << i << " " << i << ";" << i + 10 << "\n";
+    }
+    data.close();
+
+    LayerParameter lp;
+    lp.set_name("data1");
+    lp.set_type("TextDataFeed");
+    lp.set_phrase(TRAIN);
+    DataFeedParameter *dp = new DataFeedParameter;
+    dp->set_filepath("test_shard_data.txt");
+    dp->set_slot_capicity(2);
+    dp->set_slot_size(2);
+    dp->set_batch_size(2);
+    dp->set_max_line(1024);
+    lp.set_allocated_data_param(dp);
+    lp.add_t_blob_name("slot1");
+    lp.add_t_blob_name("slot2");
+
+    BlobShape out_blob_shape {2, 2};
+    vector<shared_ptr<Blob<float> > > blobs;
+    vector<Blob<float> *> input_blob_vec;
+    vector<Blob<float> *> output_blob_vec;
+    for (int i = 0; i < 2; ++i) {
+        blobs.push_back(create_blob_object<float>(out_blob_shape, false));
+        output_blob_vec.push_back(blobs[i].get());
+    }
+
+    //3 shards of 8 lines: the lines of shard 1 are 1, 4, 7
+    TextDataFeedLayer<float> feed(lp);
+    feed.init(input_blob_vec, output_blob_vec);
+    feed.set_shard(1, 3);
+    EXPECT_EQ(feed.read_file(), snoopy::SUCCESS);
+    feed.get_data(output_blob_vec);
+    EXPECT_FALSE(feed.is_end());
+    Matrix<float, 2> exp_out1 {{1, 1}, {4, 4}};
+    Matrix<float, 2> exp_out2 {{11, -1}, {14, -1}};
+    Matrix<float, 2> out1 = output_blob_vec[0]->get_data()->flatten_2d_matrix();
+    Matrix<float, 2> out2 = output_blob_vec[1]->get_data()->flatten_2d_matrix();
+    EXPECT_EQ(out1, exp_out1);
+    EXPECT_EQ(out2, exp_out2);
+    //a single line is left, less than a batch
+    feed.get_data(output_blob_vec);
+    EXPECT_TRUE(feed.is_end());
+}
+
+TEST(DataFeedLayer, streaming) {
+    std::ofstream data("test_stream_data.txt");
+    for (int i = 0; i < 7; ++i) {
+        data << i << " " << i + 1 << ";" << i + 10 << "\n";
+    }
+    data.close();
+
+    LayerParameter lp;
+    lp.set_name("data1");
+    lp.set_type("TextDataFeed");
+    lp.set_phrase(TRAIN);
+    DataFeedParameter *dp = new DataFeedParameter;
+    dp->set_filepath("test_stream_data.txt");
+    dp->set_slot_capicity(3);
+    dp->set_slot_size(2);
+    dp->set_batch_size(2);
+    dp->set_max_line(1024);
+    dp->set_streaming(true);
+    dp->set_prefetch_batches(1);
+    lp.set_allocated_data_param(dp);
+    lp.add_t_blob_name("slot1");
+    lp.add_t_blob_name("slot2");
+
+    BlobShape out_blob_shape {2, 3};
+    vector<shared_ptr<Blob<float> > > blobs;
+    vector<Blob<float> *> input_blob_vec;
+    vector<Blob<float> *> output_blob_vec;
+    for (int i = 0; i < 2; ++i) {
+        blobs.push_back(create_blob_object<float>(out_blob_shape, false));
+        output_blob_vec.push_back(blobs[i].get());
+    }
+
+    TextDataFeedLayer<float> feed(lp);
+    feed.init(input_blob_vec, output_blob_vec);
+    EXPECT_EQ(feed.read_file(), snoopy::SUCCESS);
+    //two epochs, 3 full batches each, the last line is dropped
+    for (int epoch = 0; epoch < 2; ++epoch) {
+        for (int batch = 0; batch < 3; ++batch) {
+            feed.get_data(output_blob_vec);
+            ASSERT_FALSE(feed.is_end());
+            const float l = 2 * batch;
+            Matrix<float, 2> exp_out1 {{l, l + 1, -1}, {l + 1, l + 2, -1}};
+            Matrix<float, 2> exp_out2 {{l + 10, -1, -1}, {l + 11, -1, -1}};
+            Matrix<float, 2> out1 = output_blob_vec[0]->get_data()->flatten_2d_matrix();
+            Matrix<float, 2> out2 = output_blob_vec[1]->get_data()->flatten_2d_matrix();
+            EXPECT_EQ(out1, exp_out1);
+            EXPECT_EQ(out2, exp_out2);
+        }
+        feed.get_data(output_blob_vec);
+        EXPECT_TRUE(feed.is_end());
+        feed.clear();
+    }
+}
+
+TEST(DataFeedLayer, binary) {
+    std::string text;
+    for (int i = 0; i < 7; ++i) {
+        text += std::to_string(i) + " " + std::to_string(i + 1) + ";" + std::to_string(i + 10) + "\n";
+    }
+    snoopy::io::SlotParser parser(2, 3);
+    snoopy::io::SlotRecords records(2);
+    parser.parse(text.data(), text.data() + text.size(), records);
+    //blocks of 3 samples, a batch spans two blocks
+    snoopy::io::RecordWriter writer(2, 0, 3);
+    ASSERT_EQ(writer.open("test_feed_records.bin"), snoopy::SUCCESS);
+    for (size_t r = 0; r < records.size(); ++r) {
+        writer.add(records, r);
+    }
+    ASSERT_EQ(writer.close(), snoopy::SUCCESS);
+
+    LayerParameter lp;
+    lp.set_name("data1");
+    lp.set_type("BinaryDataFeed");
+    lp.set_phrase(TRAIN);
+    DataFeedParameter *dp = new DataFeedParameter;
+    dp->set_filepath("test_feed_records.bin");
+    dp->set_slot_capicity(3);
+    dp->set_slot_size(2);
+    dp->set_batch_size(2);
+    dp->set_max_line(1024);
+    lp.set_allocated_data_param(dp);
+    lp.add_t_blob_name("slot1");
+    lp.add_t_blob_name("slot2");
+
+    BlobShape out_blob_shape {2, 3};
+    vector<shared_ptr<Blob<float> > > blobs;
+    vector<Blob<float> *> input_blob_vec;
+    vector<Blob<float> *> output_blob_vec;
+    for (int i = 0; i < 2; ++i) {
+        blobs.push_back(create_blob_object<float>(out_blob_shape, false));
+        output_blob_vec.push_back(blobs[i].get());
+    }
+
+    BinaryDataFeedLayer<float> feed(lp);
+    feed.init(input_blob_vec, output_blob_vec);
+    ASSERT_EQ(feed.read_file(), snoopy::SUCCESS);
+    for (int epoch = 0; epoch < 2; ++epoch) {
+        for (int batch = 0; batch < 3; ++batch) {
+            feed.get_data(output_blob_vec);
+            ASSERT_FALSE(feed.is_end());
+            const float l = 2 * batch;
+            Matrix<float, 2> exp_out1 {{l, l + 1, -1}, {l + 1, l + 2, -1}};
+            Matrix<float, 2> exp_out2 {{l + 10, -1, -1}, {l + 11, -1, -1}};
+            Matrix<float, 2> out1 = output_blob_vec[0]->get_data()->flatten_2d_matrix();
+            Matrix<float, 2> out2 = output_blob_vec[1]->get_data()->flatten_2d_matrix();
+            EXPECT_EQ(out1, exp_out1);
+            EXPECT_EQ(out2, exp_out2);
+        }
+        feed.get_data(output_blob_vec);
+        EXPECT_TRUE(feed.is_end());
+        feed.clear();
+    }
+}
+
+TEST(DataFeedLayer, binary_shard) {
+    std::string text;
+    for (int i = 0; i < 7; ++i) {
+        text += std::to_string(i) + ";" + std::to_string(i + 10) + "\n";
+    }
+    snoopy::io::SlotParser parser(2, 1);
+    snoopy::io::SlotRecords records(2);
+    parser.parse(text.data(), text.data() + text.size(), records);
+    snoopy::io::RecordWriter writer(2, 0, 3);
+    ASSERT_EQ(writer.open("test_shard_records.bin"), snoopy::SUCCESS);
+    for (size_t r = 0; r < records.size(); ++r) {
+        writer.add(records, r);
+    }
+    ASSERT_EQ(writer.close(), snoopy::SUCCESS);
+
+    LayerParameter lp;
+    lp.set_name("data1");
+    lp.set_type("BinaryDataFeed");
+    lp.set_phrase(TRAIN);
+    DataFeedParameter *dp = lp.mutable_data_param();
+    dp->set_filepath("test_shard_records.bin");
+    dp->set_slot_capicity(1);
+    dp->set_slot_size(2);
+    dp->set_batch_size(1);
+    //the first 5 samples of the file, whatever the shards
+    dp->set_max_line(5);
+    lp.add_t_blob_name("slot1");
+    lp.add_t_blob_name("slot2");
+
+    BlobShape out_blob_shape {1, 1};
+    vector<shared_ptr<Blob<float> > > blobs;
+    vector<Blob<float> *> input_blob_vec;
+    vector<Blob<float> *> output_blob_vec;
+    for (int i = 0; i < 2; ++i) {
+        blobs.push_back(create_blob_object<float>(out_blob_shape, false));
+        output_blob_vec.push_back(blobs[i].get());
+    }
+
+    //the blocks are 0-2, 3-5 and 6, shard 0 has blocks 0 and 2
+    vector<vector<float> > exp_samples {{0, 1, 2}, {3, 4}};
+    for (int shard = 0; shard < 2; ++shard) {
+        BinaryDataFeedLayer<float> feed(lp);
+        feed.init(input_blob_vec, output_blob_vec);
+        feed.set_shard(shard, 2);
+        ASSERT_EQ(feed.read_file(), snoopy::SUCCESS);
+        vector<float> samples;
+        for (feed.get_data(output_blob_vec); !feed.is_end(); feed.get_data(output_blob_vec)) {
+            samples.push_back(output_blob_vec[0]->get_data_at(0));
+        }
+        EXPECT_EQ(samples, exp_samples[shard]);
+    }
+}
+
+TEST(DataFeedLayer, binary_bad_block) {
+    //the file of RecordFile.bad_block, a sample a block, with a good block
+    //after the bad one
+    std::string text = "1 2;3\n4;2147483647\n";
+    snoopy::io::SlotParser parser(2, 8);
+    snoopy::io::SlotRecords records(2);
+    parser.parse(text.data(), text.data() + text.size(), records);
+    snoopy::io::RecordWriter writer(2, snoopy::io::kRecordHasLabel, 1);
+    ASSERT_EQ(writer.open("test_bad_records.bin"), snoopy::SUCCESS);
+    writer.add(records, 0, 0);
+    writer.add(records, 1, 1);
+    writer.add(records, 0, 0);
+    ASSERT_EQ(writer.close(), snoopy::SUCCESS);
+    std::fstream file("test_bad_records.bin", std::ios::in | std::ios::out | std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const size_t pos = bytes.find("\xfe\xff\xff\xff\x0f");
+    ASSERT_NE(pos, std::string::npos);
+    file.seekp(pos + 4);
+    file.put('\x1f');
+    file.close();
+
+    LayerParameter lp;
+    lp.set_name("data1");
+    lp.set_type("BinaryDataFeed");
+    lp.set_phrase(TRAIN);
+    DataFeedParameter *dp = lp.mutable_data_param();
+    dp->set_filepath("test_bad_records.bin");
+    dp->set_slot_capicity(2);
+    dp->set_slot_size(2);
+    dp->set_batch_size(1);
+    dp->set_max_line(1024);
+    lp.add_t_blob_name("slot1");
+    lp.add_t_blob_name("slot2");
+
+    BlobShape out_blob_shape {1, 2};
+    vector<shared_ptr<Blob<float> > > blobs;
+    vector<Blob<float> *> input_blob_vec;
+    vector<Blob<float> *> output_blob_vec;
+    for (int i = 0; i < 2; ++i) {
+        blobs.push_back(create_blob_object<float>(out_blob_shape, false));
+        output_blob_vec.push_back(blobs[i].get());
+    }
+
+    BinaryDataFeedLayer<float> feed(lp);
+    feed.init(input_blob_vec, output_blob_vec);
+    ASSERT_EQ(feed.read_file(), snoopy::SUCCESS);
+    //the bad block is skipped and the one after it still read
+    Matrix<float, 2> exp_out1 {{1, 2}};
+    Matrix<float, 2> exp_out2 {{3, -1}};
+    for (int batch = 0; batch < 2; ++batch) {
+        EXPECT_EQ(feed.get_data(output_blob_vec), snoopy::SUCCESS);
+        ASSERT_FALSE(feed.is_end());
+        Matrix<float, 2> out1 = output_blob_vec[0]->get_data()->flatten_2d_matrix();
+        Matrix<float, 2> out2 = output_blob_vec[1]->get_data()->flatten_2d_matrix();
+        EXPECT_EQ(out1, exp_out1);
+        EXPECT_EQ(out2, exp_out2);
+    }
+    EXPECT_EQ(feed.skipped_blocks(), 1);
+    feed.get_data(output_blob_vec);
+    EXPECT_TRUE(feed.is_end());
+}
+
 TEST(FCLayer, forward_backward) {
   Matrix<float, 2> m1 { { 1, 2, 3 }, { 2, 3, 4 } };
   Matrix<float, 2> m2 { { 2, 3 }, { 2, 3 }, {2, 3} };
@@ -172,6 +454,88 @@ TEST(FCLayer, forward_backward) {
 }
 
 
+TEST(FCLayer, fused_bias_activation) {
+  LayerParameter lp;
+  lp.set_name("fc1");
+  lp.set_type("FC");
+  lp.set_phrase(TRAIN);
+
+  BlobParameter * blob_param = lp.add_blob();
+  BlobShapeProto *bsp = new BlobShapeProto; 
+  bsp->add_dim(3);
+  bsp->add_dim(2);
+  blob_param->set_allocated_shape(bsp);
+
+  FCLayerParameter * fc = new FCLayerParameter;
+  fc->set_in_nodes_dim(3);
+  fc->set_out_nodes_dim(2);
+  fc->set_bias_term(true);
+  fc->set_activation(RELU);
+  lp.set_allocated_fc_param(fc);
+
+  Layer<float> * fc_layer = new FCLayer<float>(lp);
+  BlobShape in_blob_shape {2, 3};
+  BlobShape out_blob_shape {2, 2};
+  shared_ptr<Blob<float> > in_blob = create_blob_object<float>(in_blob_shape, true);
+  shared_ptr<Blob<float> > out_blob = create_blob_object<float>(out_blob_shape, true);
+  Matrix<float, 2>  in_data_matrix = in_blob->get_data()->flatten_2d_matrix();
+  Matrix<float, 2> tmp_in_data_matrix = {{1, 2, 3}, 
+                                         {1, -3, 4}};
+  in_data_matrix.copy_from(tmp_in_data_matrix);
+  Matrix<float, 2>  out_diff_matrix = out_blob->get_diff()->flatten_2d_matrix();
+  Matrix<float, 2> tmp_out_diff_matrix = {{1, 2}, 
+                                          {3, 4}};
+  out_diff_matrix.copy_from(tmp_out_diff_matrix);
+
+  vector<Blob<float> *>  input_blob_vec;
+  vector<Blob<float> *>  output_blob_vec;
+  vector<bool> need_bp;
+  input_blob_vec.push_back(in_blob.get());
+  output_blob_vec.push_back(out_blob.get());
+  need_bp.push_back(true);
+
+  fc_layer->init(input_blob_vec, output_blob_vec);
+  EXPECT_EQ(fc_layer->get_param_blob().size(), 2);
+
+  Matrix<float, 2> para_matrix = fc_layer->get_param_blob()[0]->get_data()->flatten_2d_matrix();
+  Matrix<float, 2> tmp_learn_param = {{1, -1}, 
+                                      {1, 1}, 
+                                      {1, -1}};
+  para_matrix.copy_from(tmp_learn_param);
+  Matrix<float, 2> bias_matrix = fc_layer->get_param_blob()[1]->get_data()->flatten_2d_matrix();
+  Matrix<float, 2> tmp_bias = {{1, -2}};
+  bias_matrix.copy_from(tmp_bias);
+  fc_layer->forward(input_blob_vec, output_blob_vec);
+
+  //pre-activation: {{7, -4}, {3, -10}}
+  Matrix<float, 2> exp_out {{7, 0},
+                            {3, 0}};
+  Matrix<float, 2> new_out_mat = out_blob->get_data()->flatten_2d_matrix();
+  EXPECT_EQ(exp_out, new_out_mat);
+
+  //the activation gradient is scratch memory of the step
+  storage::ArenaAllocator arena;
+  fc_layer->set_scratch_arena(&arena);
+  fc_layer->backward(input_blob_vec, need_bp, output_blob_vec);
+  EXPECT_EQ(arena.bytes_used(), 4 * sizeof(float));
+  //gradient w.r.t pre-activation: {{1, 0}, {3, 0}}
+  Matrix<float, 2> exp_diff {{1, 1, 1}, 
+                             {3, 3, 3}};
+  Matrix<float, 2> new_in_diff = in_blob->get_diff()->flatten_2d_matrix();
+  EXPECT_EQ(new_in_diff, exp_diff);
+
+  Matrix<float, 2> exp_para_diff {{4, 0},
+                                  {-7, 0},
+                                  {15, 0}};
+  Matrix<float, 2> param_diff = fc_layer->get_param_blob()[0]->get_diff()->flatten_2d_matrix();
+  EXPECT_EQ(param_diff, exp_para_diff);
+
+  Matrix<float, 2> exp_bias_diff {{4, 0}};
+  Matrix<float, 2> bias_diff = fc_layer->get_param_blob()[1]->get_diff()->flatten_2d_matrix();
+  EXPECT_EQ(bias_diff, exp_bias_diff);
+}
+
+
 TEST(SigmoidLayer, forward_backward) {
   Matrix<float, 2> m1 { { 1, 2, 3 }, { 2, 3, 4 } };
   Matrix<float, 2> m2 { { 2, 3 }, { 2, 3 }, {2, 3} };
@@ -380,6 +744,39 @@ TEST(EmbeddingLayer, forward_backward) {
 
   Matrix<float, 2> new_in_diff1 = in_blob1->get_diff()->flatten_2d_matrix();
   EXPECT_EQ(new_in_diff1, exp_diff1);
+
+  //the embedding gradient has one coalesced row per id in the batch
+  Matrix<float, 2> out_diff_matrix = out_blob->get_diff()->flatten_2d_matrix();
+  out_diff_matrix.copy_from(new_in_diff1);
+  emb_layer->backward(input_blob_vec, need_bp, output_blob_vec);
+  SparseRows<float> & grad = *emb_layer->get_param_blob()[0]->get_sparse_diff();
+  ASSERT_EQ(grad.size(), 5);
+  Matrix<float, 2> exp_grad {{6, 11, 11},
+                             {2, 4, 5},
+                             {2, 5, 8},
+                             {2, 6, 10},
+                             {8, 12, 12}};
+  for (size_t k = 0; k < grad.size(); ++k) {
+    EXPECT_EQ(grad.rows_[k], k);
+    for (size_t j = 0; j < 3; ++j) {
+      EXPECT_FLOAT_EQ(grad.values_[k][j], exp_grad[k][j]);
+    }
+  }
+
+  //the sgd step only touches the rows of the gradient
+  Matrix<float, 2> history(MatrixShape<2> {5, 3});
+  history.clear_data();
+  SparseRows<float> one_row(4, 3);
+  one_row.rows_.push_back(3);
+  one_row.values_[0] = grad.values_[3];
+  sparse_momentum_update(para_matrix, history, one_row, 0.5f, 0.9f);
+  sparse_momentum_update(para_matrix, history, one_row, 0.5f, 0.9f);
+  //v1 = -0.5 g, v2 = 0.9 v1 - 0.5 g = -0.95 g, w = 4 - 1.45 g
+  EXPECT_FLOAT_EQ(para_matrix[3][0], 4 - 1.45f * 2);
+  EXPECT_FLOAT_EQ(para_matrix[3][2], 4 - 1.45f * 10);
+  EXPECT_FLOAT_EQ(history[3][1], -0.95f * 6);
+  EXPECT_FLOAT_EQ(para_matrix[2][1], 3);
+  EXPECT_FLOAT_EQ(para_matrix[4][0], 5);
 }
 
 
@@ -417,7 +814,9 @@ TEST(SoftmaxLayer, forward_backward) {
   need_bp.push_back(true);
 
   softmax_with_loss_layer->init(input_blob_vec, output_blob_vec);
-  softmax_with_loss_layer->forward(input_blob_vec, output_blob_vec);
+  //the cross entropy summed over the batch
+  float loss = softmax_with_loss_layer->forward(input_blob_vec, output_blob_vec);
+  EXPECT_NEAR(loss, 7.274527f, 1e-5);
 
   Matrix<float, 2> exp_out 
       {{ 0.09003057,  0.24472847,  0.66524096},
@@ -438,6 +837,64 @@ TEST(SoftmaxLayer, forward_backward) {
 
 }
 
+TEST(ModelFile, save_load_mmap) {
+  BlobShape shape1 {2, 3};
+  BlobShape shape2 {1, 4};
+  vector<shared_ptr<Blob<float> > > blobs;
+  blobs.push_back(create_blob_object<float>(shape1, false));
+  blobs.push_back(create_blob_object<float>(shape2, false));
+  for (size_t i = 0; i < 6; ++i) {
+    blobs[0]->set_data_at(i, i + 0.5f);
+  }
+  for (size_t i = 0; i < 4; ++i) {
+    blobs[1]->set_data_at(i, -1.f * i);
+  }
+  vector<string> names {"fc1/0", "fc1/1"};
+  EXPECT_EQ(snoopy::io::write_model_to_binary_file("test_model_v1.bin", blobs, names),
+            snoopy::SUCCESS);
+
+  //the blobs are found by name whatever their order
+  vector<shared_ptr<Blob<float> > > loaded;
+  loaded.push_back(create_blob_object<float>(shape2, false));
+  loaded.push_back(create_blob_object<float>(shape1, false));
+  vector<string> loaded_names {"fc1/1", "fc1/0"};
+  EXPECT_EQ(snoopy::io::load_model_from_binary_file("test_model_v1.bin", loaded, loaded_names),
+            snoopy::SUCCESS);
+  EXPECT_FLOAT_EQ(loaded[1]->get_data_at(5), 5.5f);
+  EXPECT_FLOAT_EQ(loaded[0]->get_data_at(3), -3.f);
+
+  //mapped blobs point into the file, aligned
+  vector<shared_ptr<Blob<float> > > mapped;
+  mapped.push_back(create_blob_object<float>(shape1, false));
+  mapped.push_back(create_blob_object<float>(shape2, false));
+  EXPECT_EQ(snoopy::io::map_model_from_binary_file("test_model_v1.bin", mapped, names),
+            snoopy::SUCCESS);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(mapped[0]->get_raw_data()) % 64, 0u);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(mapped[1]->get_raw_data()) % 64, 0u);
+  Matrix<float, 2> m = mapped[0]->get_data()->flatten_2d_matrix();
+  EXPECT_FLOAT_EQ(m[1][2], 5.5f);
+  EXPECT_FLOAT_EQ(mapped[1]->get_data_at(2), -2.f);
+
+  //a shape that does not match the file is refused
+  vector<shared_ptr<Blob<float> > > wrong;
+  wrong.push_back(create_blob_object<float>(shape2, false));
+  EXPECT_EQ(snoopy::io::map_model_from_binary_file("test_model_v1.bin", wrong),
+            snoopy::FAILURE);
+
+  //files of the raw blobs back to back are still loaded
+  std::ofstream legacy("test_model_legacy.bin", std::ios::out | std::ios::binary);
+  legacy.write(static_cast<char *>(blobs[0]->get_raw_data()), 6 * sizeof(float));
+  legacy.write(static_cast<char *>(blobs[1]->get_raw_data()), 4 * sizeof(float));
+  legacy.close();
+  vector<shared_ptr<Blob<float> > > old;
+  old.push_back(create_blob_object<float>(shape1, false));
+  old.push_back(create_blob_object<float>(shape2, false));
+  EXPECT_EQ(snoopy::io::load_model_from_binary_file("test_model_legacy.bin", old),
+            snoopy::SUCCESS);
+  EXPECT_FLOAT_EQ(old[0]->get_data_at(1), 1.5f);
+  EXPECT_FLOAT_EQ(old[1]->get_data_at(3), -3.f);
+}
+
 TEST(NeuralNet, forward_backward) {
     NeuralNet<float> nn;
     NetParameter net_p;
@@ -452,6 +909,430 @@ TEST(NeuralNet, forward_backward) {
     //EXPECT_EQ(status, snoopy::SUCCESS);
 }
 
+//layers out of order, "aux" is read by no one
+static const char * kScheduleNet =
+    "name: 'schedule' "
+    "layer_param { name: 'data' type: 'TextDataFeed' "
+    "  data_param { filepath: 'test_net_data.txt' slot_capicity: 3 slot_size: 2 batch_size: 2 max_line: 1024 } "
+    "  t_blob_name: 'ids' t_blob_name: 'label' } "
+    "layer_param { name: 'loss' type: 'SoftmaxWithLoss' "
+    "  b_blob_name: 'o' b_blob_name: 'label' t_blob_name: 'prob' t_blob_shape { dim: 2 dim: 2 } } "
+    "layer_param { name: 'fc' type: 'FC' blob { shape { dim: 4 dim: 2 } } "
+    "  fc_param { in_nodes_dim: 4 out_nodes_dim: 2 } "
+    "  b_blob_name: 's' t_blob_name: 'o' t_blob_shape { dim: 2 dim: 2 } } "
+    "layer_param { name: 'aux' type: 'FC' blob { shape { dim: 4 dim: 3 } } "
+    "  fc_param { in_nodes_dim: 4 out_nodes_dim: 3 } "
+    "  b_blob_name: 's' t_blob_name: 'a' t_blob_shape { dim: 2 dim: 3 } } "
+    "layer_param { name: 'vsum' type: 'Vsum' "
+    "  b_blob_name: 'e' t_blob_name: 's' t_blob_shape { dim: 2 dim: 4 } } "
+    "layer_param { name: 'emb' type: 'Embedding' blob { shape { dim: 10 dim: 4 } } "
+    "  emb_param { slot_capicity: 3 } "
+    "  b_blob_name: 'ids' t_blob_name: 'e' t_blob_shape { dim: 6 dim: 4 } } ";
+
+static float cross_entropy(Blob<float> * prob, Blob<float> * label) {
+    Matrix<float, 2> prob_matrix = prob->get_data()->flatten_2d_matrix();
+    Matrix<float, 2> label_matrix = label->get_data()->flatten_2d_matrix();
+    float loss = 0;
+    for (size_t i = 0; i < prob_matrix.get_row(); ++i) {
+        loss -= std::log(prob_matrix[i][static_cast<int>(label_matrix[i][0])]);
+    }
+    return loss;
+}
+
+TEST(NeuralNet, schedule_and_loss) {
+    std::ofstream data("test_net_data.txt");
+    data << "1 2 3;0\n4 5;1\n";
+    data.close();
+
+    NetParameter net_p;
+    ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kScheduleNet, &net_p));
+    net_p.mutable_state()->set_netphrase(TRAIN);
+    net_p.add_output_blob_name("prob");
+    //the layer indices are the ones of the configure
+    net_p.set_fuse_layers(false);
+    NeuralNet<float> train_net;
+    ASSERT_EQ(train_net.init(net_p), snoopy::SUCCESS);
+    //each layer after the writers of its bottoms
+    vector<int> exp_schedule {0, 5, 4, 2, 1, 3};
+    EXPECT_EQ(train_net.get_schedule(), exp_schedule);
+
+    DataFeedLayer<float> * feed = static_cast<DataFeedLayer<float> *>(train_net.get_input_feed().get());
+    ASSERT_EQ(feed->read_file(), snoopy::SUCCESS);
+    feed->get_data(train_net.get_input_blobs());
+    //emb/0 is the last parameter
+    Blob<float> * table = train_net.get_para_blobs().back().get();
+    for (size_t i = 0; i < table->get_count(); ++i) {
+        table->set_data_at(i, 0.1f * (i % 7) - 0.3f);
+    }
+    float loss = 0;
+    train_net.forward(&loss);
+    Blob<float> * prob = train_net.get_output_blobs()[0];
+    EXPECT_GT(loss, 0);
+    EXPECT_NEAR(loss, cross_entropy(prob, train_net.get_input_blobs()[1]), 1e-5);
+
+    //a test net only runs what its outputs need, the loss is weighted
+    net_p.mutable_state()->set_netphrase(TEST);
+    net_p.mutable_layer_param(1)->set_loss_weight(2);
+    NeuralNet<float> test_net;
+    ASSERT_EQ(test_net.init(net_p), snoopy::SUCCESS);
+    exp_schedule = {0, 5, 4, 2, 1};
+    EXPECT_EQ(test_net.get_schedule(), exp_schedule);
+    ASSERT_EQ(test_net.share_para_blobs(train_net), snoopy::SUCCESS);
+
+    feed = static_cast<DataFeedLayer<float> *>(test_net.get_input_feed().get());
+    ASSERT_EQ(feed->read_file(), snoopy::SUCCESS);
+    feed->get_data(test_net.get_input_blobs());
+    test_net.forward(&loss);
+    prob = test_net.get_output_blobs()[0];
+    EXPECT_NEAR(loss, 2 * cross_entropy(prob, test_net.get_input_blobs()[1]), 1e-5);
+}
+
+TEST(NeuralNet, need_bp) {
+    std::ofstream data("test_net_data.txt");
+    data << "1 2 3;0\n4 5;1\n";
+    data.close();
+
+    NetParameter net_p;
+    ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kScheduleNet, &net_p));
+    net_p.mutable_state()->set_netphrase(TRAIN);
+    net_p.add_output_blob_name("prob");
+    //the layer indices are the ones of the configure
+    net_p.set_fuse_layers(false);
+    for (int i = 2; i < net_p.layer_param_size(); ++i) {
+        net_p.mutable_layer_param(i)->mutable_lr()->set_lr_multi(1);
+    }
+    NeuralNet<float> net;
+    ASSERT_EQ(net.init(net_p), snoopy::SUCCESS);
+    //no loss above aux, nothing learnable below the data
+    vector<int> exp_bp_schedule {1, 2, 4, 5};
+    EXPECT_EQ(net.get_bp_schedule(), exp_bp_schedule);
+    vector<bool> exp_need_bp {true, false};
+    EXPECT_EQ(net.get_bottom_need_bp(1), exp_need_bp);
+    EXPECT_EQ(net.get_bottom_need_bp(5), vector<bool>(1, false));
+    ASSERT_EQ(net.get_learnable_para_blobs().size(), 2u);
+    EXPECT_EQ(net.get_learnable_para_ids(), vector<int>({0, 2}));
+
+    //a frozen embedding has no backward and neither has the layers on it
+    net_p.mutable_layer_param(5)->mutable_lr()->set_lr_multi(0);
+    NeuralNet<float> frozen_net;
+    ASSERT_EQ(frozen_net.init(net_p), snoopy::SUCCESS);
+    exp_bp_schedule = {1, 2};
+    EXPECT_EQ(frozen_net.get_bp_schedule(), exp_bp_schedule);
+    EXPECT_EQ(frozen_net.get_bottom_need_bp(2), vector<bool>(1, false));
+    ASSERT_EQ(frozen_net.get_learnable_para_blobs().size(), 1u);
+
+    //emb/0 is the last parameter, the gradient of fc is 0 on a zero table
+    Blob<float> * table = frozen_net.get_para_blobs().back().get();
+    for (size_t i = 0; i < table->get_count(); ++i) {
+        table->set_data_at(i, 0.1f * (i % 7) - 0.3f);
+    }
+    DataFeedLayer<float> * feed = static_cast<DataFeedLayer<float> *>(frozen_net.get_input_feed().get());
+    ASSERT_EQ(feed->read_file(), snoopy::SUCCESS);
+    feed->get_data(frozen_net.get_input_blobs());
+    float loss = 0;
+    frozen_net.forward(&loss);
+    frozen_net.backprop();
+    //the gradient of fc is X^T * (prob - onehot), the rows of prob - onehot
+    //sum to 0 and so do the rows of the gradient
+    Blob<float> * fc_weight = frozen_net.get_learnable_para_blobs()[0];
+    EXPECT_EQ(fc_weight, frozen_net.get_para_blobs()[0].get());
+    Matrix<float, 2> fc_diff = fc_weight->get_diff()->flatten_2d_matrix();
+    float abs_sum = 0;
+    for (size_t i = 0; i < fc_diff.get_row(); ++i) {
+        EXPECT_NEAR(fc_diff[i][0] + fc_diff[i][1], 0, 1e-5);
+        abs_sum += std::fabs(fc_diff[i][0]);
+    }
+    EXPECT_GT(abs_sum, 0);
+}
+
+TEST(NeuralNet, shared_blob_gradient) {
+    std::ofstream data("test_net_data.txt");
+    data << "1 2 3;0\n4 5;1\n";
+    data.close();
+
+    //fc and aux both read s and both have a loss
+    NetParameter net_p;
+    ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kScheduleNet, &net_p));
+    net_p.mutable_state()->set_netphrase(TRAIN);
+    net_p.set_fuse_layers(false);
+    for (int i = 2; i < net_p.layer_param_size(); ++i) {
+        net_p.mutable_layer_param(i)->mutable_lr()->set_lr_multi(1);
+    }
+    LayerParameter * aux_loss = net_p.add_layer_param();
+    aux_loss->CopyFrom(net_p.layer_param(1));
+    aux_loss->set_name("aux_loss");
+    aux_loss->set_b_blob_name(0, "a");
+    aux_loss->set_t_blob_name(0, "aux_prob");
+    aux_loss->mutable_t_blob_shape(0)->set_dim(1, 3);
+    NeuralNet<float> both_net;
+    ASSERT_EQ(both_net.init(net_p), snoopy::SUCCESS);
+    //each path alone, the other loss has no weight
+    net_p.mutable_layer_param(6)->set_loss_weight(0);
+    NeuralNet<float> fc_net;
+    ASSERT_EQ(fc_net.init(net_p), snoopy::SUCCESS);
+    net_p.mutable_layer_param(6)->clear_loss_weight();
+    net_p.mutable_layer_param(1)->set_loss_weight(0);
+    NeuralNet<float> aux_net;
+    ASSERT_EQ(aux_net.init(net_p), snoopy::SUCCESS);
+    ASSERT_EQ(fc_net.share_para_blobs(both_net), snoopy::SUCCESS);
+    ASSERT_EQ(aux_net.share_para_blobs(both_net), snoopy::SUCCESS);
+    //emb/0 is the last parameter
+    Blob<float> * table = both_net.get_para_blobs().back().get();
+    for (size_t i = 0; i < table->get_count(); ++i) {
+        table->set_data_at(i, 0.1f * (i % 7) - 0.3f);
+    }
+
+    NeuralNet<float> * nets[3] = {&both_net, &fc_net, &aux_net};
+    for (int n = 0; n < 3; ++n) {
+        DataFeedLayer<float> * feed = static_cast<DataFeedLayer<float> *>(nets[n]->get_input_feed().get());
+        ASSERT_EQ(feed->read_file(), snoopy::SUCCESS);
+        feed->get_data(nets[n]->get_input_blobs());
+        float loss = 0;
+        nets[n]->forward(&loss);
+        nets[n]->backprop();
+    }
+    //the gradient of the table is the sum of the ones of the two paths
+    SparseRows<float> & both = *both_net.get_learnable_para_blobs().back()->get_sparse_diff();
+    SparseRows<float> & by_fc = *fc_net.get_learnable_para_blobs().back()->get_sparse_diff();
+    SparseRows<float> & by_aux = *aux_net.get_learnable_para_blobs().back()->get_sparse_diff();
+    ASSERT_EQ(both.rows_, by_fc.rows_);
+    ASSERT_EQ(both.rows_, by_aux.rows_);
+    float abs_sum = 0;
+    for (size_t r = 0; r < both.size(); ++r) {
+        for (size_t j = 0; j < both.values_.get_column(); ++j) {
+            EXPECT_NEAR(both.values_[r][j], by_fc.values_[r][j] + by_aux.values_[r][j], 1e-5);
+            abs_sum += std::fabs(by_fc.values_[r][j]) + std::fabs(by_aux.values_[r][j]);
+        }
+    }
+    EXPECT_GT(abs_sum, 0);
+}
+
+//a tower per slot, each with its loss
+static const char * kTowerNet =
+    "name: 'towers' "
+    "layer_param { name: 'data' type: 'TextDataFeed' "
+    "  data_param { filepath: 'test_tower_data.txt' slot_capicity: 3 slot_size: 4 batch_size: 2 max_line: 1024 } "
+    "  t_blob_name: 'ids1' t_blob_name: 'ids2' t_blob_name: 'label1' t_blob_name: 'label2' } "
+    "layer_param { name: 'emb1' type: 'Embedding' blob { shape { dim: 10 dim: 4 } } lr { lr_multi: 1 } "
+    "  emb_param { slot_capicity: 3 } b_blob_name: 'ids1' t_blob_name: 'e1' t_blob_shape { dim: 6 dim: 4 } } "
+    "layer_param { name: 'emb2' type: 'Embedding' blob { shape { dim: 10 dim: 4 } } lr { lr_multi: 1 } "
+    "  emb_param { slot_capicity: 3 } b_blob_name: 'ids2' t_blob_name: 'e2' t_blob_shape { dim: 6 dim: 4 } } "
+    "layer_param { name: 'vsum1' type: 'Vsum' b_blob_name: 'e1' t_blob_name: 's1' t_blob_shape { dim: 2 dim: 4 } } "
+    "layer_param { name: 'vsum2' type: 'Vsum' b_blob_name: 'e2' t_blob_name: 's2' t_blob_shape { dim: 2 dim: 4 } } "
+    "layer_param { name: 'fc1' type: 'FC' blob { shape { dim: 4 dim: 2 } } lr { lr_multi: 1 } "
+    "  fc_param { in_nodes_dim: 4 out_nodes_dim: 2 } b_blob_name: 's1' t_blob_name: 'o1' t_blob_shape { dim: 2 dim: 2 } } "
+    "layer_param { name: 'fc2' type: 'FC' blob { shape { dim: 4 dim: 2 } } lr { lr_multi: 1 } "
+    "  fc_param { in_nodes_dim: 4 out_nodes_dim: 2 } b_blob_name: 's2' t_blob_name: 'o2' t_blob_shape { dim: 2 dim: 2 } } "
+    "layer_param { name: 'loss1' type: 'SoftmaxWithLoss' "
+    "  b_blob_name: 'o1' b_blob_name: 'label1' t_blob_name: 'prob1' t_blob_shape { dim: 2 dim: 2 } } "
+    "layer_param { name: 'loss2' type: 'SoftmaxWithLoss' "
+    "  b_blob_name: 'o2' b_blob_name: 'label2' t_blob_name: 'prob2' t_blob_shape { dim: 2 dim: 2 } } ";
+
+//the learnable parameters of the two nets have the same gradients, the
+//embedding ones are sparse
+static void expect_same_gradients(NeuralNet<float> & net1, NeuralNet<float> & net2) {
+    vector<Blob<float> *> & paras1 = net1.get_learnable_para_blobs();
+    vector<Blob<float> *> & paras2 = net2.get_learnable_para_blobs();
+    ASSERT_EQ(paras1.size(), paras2.size());
+    for (size_t p = 0; p < paras1.size(); ++p) {
+        if (paras1[p]->get_sparse_diff() != nullptr) {
+            SparseRows<float> & a = *paras1[p]->get_sparse_diff();
+            SparseRows<float> & b = *paras2[p]->get_sparse_diff();
+            ASSERT_EQ(a.rows_, b.rows_);
+            for (size_t r = 0; r < a.size(); ++r) {
+                for (size_t j = 0; j < a.values_.get_column(); ++j) {
+                    EXPECT_NEAR(a.values_[r][j], b.values_[r][j], 1e-5);
+                }
+            }
+            continue;
+        }
+        Matrix<float, 2> a = paras1[p]->get_diff()->flatten_2d_matrix();
+        Matrix<float, 2> b = paras2[p]->get_diff()->flatten_2d_matrix();
+        for (size_t i = 0; i < a.get_row(); ++i) {
+            for (size_t j = 0; j < a.get_column(); ++j) {
+                EXPECT_NEAR(a[i][j], b[i][j], 1e-5);
+            }
+        }
+    }
+}
+
+//two towers on the sum of one embedding, each with its loss
+static const char * kSharedTowerNet =
+    "name: 'shared_towers' "
+    "layer_param { name: 'data' type: 'TextDataFeed' "
+    "  data_param { filepath: 'test_tower_data.txt' slot_capicity: 3 slot_size: 3 batch_size: 2 max_line: 1024 } "
+    "  t_blob_name: 'ids' t_blob_name: 'label1' t_blob_name: 'label2' } "
+    "layer_param { name: 'emb' type: 'Embedding' blob { shape { dim: 10 dim: 4 } } lr { lr_multi: 1 } "
+    "  emb_param { slot_capicity: 3 } b_blob_name: 'ids' t_blob_name: 'e' t_blob_shape { dim: 6 dim: 4 } } "
+    "layer_param { name: 'vsum' type: 'Vsum' b_blob_name: 'e' t_blob_name: 's' t_blob_shape { dim: 2 dim: 4 } } "
+    "layer_param { name: 'fc1' type: 'FC' blob { shape { dim: 4 dim: 4 } } lr { lr_multi: 1 } "
+    "  fc_param { in_nodes_dim: 4 out_nodes_dim: 4 } b_blob_name: 's' t_blob_name: 'h1' t_blob_shape { dim: 2 dim: 4 } } "
+    "layer_param { name: 'relu' type: 'RELU' b_blob_name: 'h1' t_blob_name: 'r1' t_blob_shape { dim: 2 dim: 4 } } "
+    "layer_param { name: 'out1' type: 'FC' blob { shape { dim: 4 dim: 2 } } lr { lr_multi: 1 } "
+    "  fc_param { in_nodes_dim: 4 out_nodes_dim: 2 } b_blob_name: 'r1' t_blob_name: 'o1' t_blob_shape { dim: 2 dim: 2 } } "
+    "layer_param { name: 'fc2' type: 'FC' blob { shape { dim: 4 dim: 4 } } lr { lr_multi: 1 } "
+    "  fc_param { in_nodes_dim: 4 out_nodes_dim: 4 } b_blob_name: 's' t_blob_name: 'h2' t_blob_shape { dim: 2 dim: 4 } } "
+    "layer_param { name: 'tanh' type: 'Tanh' b_blob_name: 'h2' t_blob_name: 'r2' t_blob_shape { dim: 2 dim: 4 } } "
+    "layer_param { name: 'out2' type: 'FC' blob { shape { dim: 4 dim: 2 } } lr { lr_multi: 1 } "
+    "  fc_param { in_nodes_dim: 4 out_nodes_dim: 2 } b_blob_name: 'r2' t_blob_name: 'o2' t_blob_shape { dim: 2 dim: 2 } } "
+    "layer_param { name: 'loss1' type: 'SoftmaxWithLoss' "
+    "  b_blob_name: 'o1' b_blob_name: 'label1' t_blob_name: 'prob1' t_blob_shape { dim: 2 dim: 2 } } "
+    "layer_param { name: 'loss2' type: 'SoftmaxWithLoss' "
+    "  b_blob_name: 'o2' b_blob_name: 'label2' t_blob_name: 'prob2' t_blob_shape { dim: 2 dim: 2 } } ";
+
+//the net of `config` run by one thread and by 4 have the same loss and
+//gradients
+static void expect_same_parallel(const char * config, size_t learnable_num) {
+    NetParameter net_p;
+    ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(config, &net_p));
+    net_p.mutable_state()->set_netphrase(TRAIN);
+    NeuralNet<float> serial_net;
+    ASSERT_EQ(serial_net.init(net_p), snoopy::SUCCESS);
+    net_p.set_layer_thread_num(4);
+    NeuralNet<float> parallel_net;
+    ASSERT_EQ(parallel_net.init(net_p), snoopy::SUCCESS);
+    ASSERT_EQ(parallel_net.share_para_blobs(serial_net), snoopy::SUCCESS);
+    vector<shared_ptr<Blob<float> > > & para_blobs = serial_net.get_para_blobs();
+    for (size_t p = 0; p < para_blobs.size(); ++p) {
+        for (size_t i = 0; i < para_blobs[p]->get_count(); ++i) {
+            para_blobs[p]->set_data_at(i, 0.1f * ((i + p) % 7) - 0.3f);
+        }
+    }
+
+    NeuralNet<float> * nets[2] = {&serial_net, &parallel_net};
+    float loss[2] = {0, 0};
+    for (int n = 0; n < 2; ++n) {
+        DataFeedLayer<float> * feed = static_cast<DataFeedLayer<float> *>(nets[n]->get_input_feed().get());
+        ASSERT_EQ(feed->read_file(), snoopy::SUCCESS);
+        for (int step = 0; step < 3; ++step) {
+            feed->clear();
+            feed->get_data(nets[n]->get_input_blobs());
+            nets[n]->forward(&loss[n]);
+            nets[n]->backprop();
+        }
+    }
+    EXPECT_GT(loss[0], 0);
+    EXPECT_NEAR(loss[0], loss[1], 1e-5);
+    ASSERT_EQ(serial_net.get_learnable_para_blobs().size(), learnable_num);
+    expect_same_gradients(serial_net, parallel_net);
+}
+
+TEST(NeuralNet, parallel_layers) {
+    std::ofstream data("test_tower_data.txt");
+    data << "1 2 3;4 5;0;1\n6;7 8 9;1;1\n";
+    data.close();
+    expect_same_parallel(kTowerNet, 4);
+
+    //the towers add their gradients to the diff of s one after the other
+    data.open("test_tower_data.txt");
+    data << "1 2 3;0;1\n4 5;1;0\n";
+    data.close();
+    expect_same_parallel(kSharedTowerNet, 5);
+}
+
+//an activation layer after each hidden layer, they can run in place
+static const char * kActivationNet =
+    "name: 'activations' "
+    "layer_param { name: 'data' type: 'TextDataFeed' "
+    "  data_param { filepath: 'test_net_data.txt' slot_capicity: 3 slot_size: 2 batch_size: 2 max_line: 1024 } "
+    "  t_blob_name: 'ids' t_blob_name: 'label' } "
+    "layer_param { name: 'emb' type: 'Embedding' blob { shape { dim: 10 dim: 4 } } lr { lr_multi: 1 } "
+    "  emb_param { slot_capicity: 3 } b_blob_name: 'ids' t_blob_name: 'e' t_blob_shape { dim: 6 dim: 4 } } "
+    "layer_param { name: 'vsum' type: 'Vsum' b_blob_name: 'e' t_blob_name: 's' t_blob_shape { dim: 2 dim: 4 } } "
+    "layer_param { name: 'fc1' type: 'FC' blob { shape { dim: 4 dim: 4 } } lr { lr_multi: 1 } "
+    "  fc_param { in_nodes_dim: 4 out_nodes_dim: 4 } b_blob_name: 's' t_blob_name: 'h1' t_blob_shape { dim: 2 dim: 4 } } "
+    "layer_param { name: 'relu' type: 'RELU' b_blob_name: 'h1' t_blob_name: 'r1' t_blob_shape { dim: 2 dim: 4 } } "
+    "layer_param { name: 'fc2' type: 'FC' blob { shape { dim: 4 dim: 4 } } lr { lr_multi: 1 } "
+    "  fc_param { in_nodes_dim: 4 out_nodes_dim: 4 } b_blob_name: 'r1' t_blob_name: 'h2' t_blob_shape { dim: 2 dim: 4 } } "
+    "layer_param { name: 'tanh' type: 'Tanh' b_blob_name: 'h2' t_blob_name: 'r2' t_blob_shape { dim: 2 dim: 4 } } "
+    "layer_param { name: 'fc3' type: 'FC' blob { shape { dim: 4 dim: 2 } } lr { lr_multi: 1 } "
+    "  fc_param { in_nodes_dim: 4 out_nodes_dim: 2 } b_blob_name: 'r2' t_blob_name: 'o' t_blob_shape { dim: 2 dim: 2 } } "
+    "layer_param { name: 'loss' type: 'SoftmaxWithLoss' "
+    "  b_blob_name: 'o' b_blob_name: 'label' t_blob_name: 'prob' t_blob_shape { dim: 2 dim: 2 } } ";
+
+TEST(NeuralNet, memory_plan) {
+    std::ofstream data("test_net_data.txt");
+    data << "1 2 3;0\n4 5;1\n";
+    data.close();
+
+    NetParameter net_p;
+    ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kActivationNet, &net_p));
+    net_p.mutable_state()->set_netphrase(TRAIN);
+    //the activation layers run in place
+    net_p.set_fuse_layers(false);
+    net_p.set_share_blob_memory(false);
+    NeuralNet<float> naive_net;
+    ASSERT_EQ(naive_net.init(net_p), snoopy::SUCCESS);
+    net_p.set_share_blob_memory(true);
+    NeuralNet<float> planned_net;
+    ASSERT_EQ(planned_net.init(net_p), snoopy::SUCCESS);
+    ASSERT_EQ(planned_net.share_para_blobs(naive_net), snoopy::SUCCESS);
+    EXPECT_EQ(naive_net.get_planned_blob_bytes(), naive_net.get_naive_blob_bytes());
+    EXPECT_EQ(planned_net.get_naive_blob_bytes(), naive_net.get_naive_blob_bytes());
+    EXPECT_LT(planned_net.get_planned_blob_bytes(), planned_net.get_naive_blob_bytes() / 2);
+    //emb/0 is the first parameter
+    Blob<float> * table = naive_net.get_para_blobs()[0].get();
+    for (size_t i = 0; i < table->get_count(); ++i) {
+        table->set_data_at(i, 0.1f * (i % 7) - 0.3f);
+    }
+
+    NeuralNet<float> * nets[2] = {&naive_net, &planned_net};
+    float loss[2] = {0, 0};
+    for (int n = 0; n < 2; ++n) {
+        DataFeedLayer<float> * feed = static_cast<DataFeedLayer<float> *>(nets[n]->get_input_feed().get());
+        ASSERT_EQ(feed->read_file(), snoopy::SUCCESS);
+        feed->get_data(nets[n]->get_input_blobs());
+        nets[n]->forward(&loss[n]);
+        nets[n]->backprop();
+    }
+    EXPECT_GT(loss[0], 0);
+    EXPECT_FLOAT_EQ(loss[0], loss[1]);
+    expect_same_gradients(naive_net, planned_net);
+}
+
+TEST(NeuralNet, fusion) {
+    std::ofstream data("test_net_data.txt");
+    data << "1 2 3;0\n4 5;1\n";
+    data.close();
+
+    NetParameter net_p;
+    ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kActivationNet, &net_p));
+    net_p.mutable_state()->set_netphrase(TRAIN);
+    net_p.set_fuse_layers(false);
+    NeuralNet<float> plain_net;
+    ASSERT_EQ(plain_net.init(net_p), snoopy::SUCCESS);
+    net_p.set_fuse_layers(true);
+    NeuralNet<float> fused_net;
+    ASSERT_EQ(fused_net.init(net_p), snoopy::SUCCESS);
+    //emb and vsum, fc1 and relu, fc2 and tanh are one layer each
+    vector<string> exp_names {"data", "emb", "fc1", "fc2", "fc3", "loss"};
+    EXPECT_EQ(fused_net.get_layer_names(), exp_names);
+    ASSERT_EQ(fused_net.share_para_blobs(plain_net), snoopy::SUCCESS);
+    Blob<float> * table = plain_net.get_para_blobs()[0].get();
+    for (size_t i = 0; i < table->get_count(); ++i) {
+        table->set_data_at(i, 0.1f * (i % 7) - 0.3f);
+    }
+
+    NeuralNet<float> * nets[2] = {&plain_net, &fused_net};
+    float loss[2] = {0, 0};
+    for (int n = 0; n < 2; ++n) {
+        DataFeedLayer<float> * feed = static_cast<DataFeedLayer<float> *>(nets[n]->get_input_feed().get());
+        ASSERT_EQ(feed->read_file(), snoopy::SUCCESS);
+        feed->get_data(nets[n]->get_input_blobs());
+        nets[n]->forward(&loss[n]);
+        nets[n]->backprop();
+    }
+    EXPECT_GT(loss[0], 0);
+    EXPECT_NEAR(loss[0], loss[1], 1e-5);
+    expect_same_gradients(plain_net, fused_net);
+
+    //a blob read after forward stays
+    net_p.add_output_blob_name("h1");
+    NeuralNet<float> output_net;
+    ASSERT_EQ(output_net.init(net_p), snoopy::SUCCESS);
+    EXPECT_EQ(output_net.get_layer_names().size(), 7u);
+}
+
 TEST(SGDSolver, update) {
     SGDSolver<float> sgd;
     SolverParameter solve_p;
@@ -466,3 +1347,143 @@ TEST(SGDSolver, update) {
     EXPECT_EQ(status, snoopy::SUCCESS);
 
 }
+
+//the label is given by the first id of a sample
+static const char * kSolverNet =
+    "name: 'solver' state { netphrase: TRAIN } "
+    "layer_param { name: 'data' type: 'TextDataFeed' "
+    "  data_param { filepath: 'test_solver_data.txt' slot_capicity: 2 slot_size: 2 batch_size: 2 max_line: 1024 } "
+    "  t_blob_name: 'ids' t_blob_name: 'label' } "
+    "layer_param { name: 'emb' type: 'Embedding' blob { shape { dim: 10 dim: 4 } } lr { lr_multi: 1 } "
+    "  emb_param { slot_capicity: 2 } b_blob_name: 'ids' t_blob_name: 'e' t_blob_shape { dim: 4 dim: 4 } } "
+    "layer_param { name: 'vsum' type: 'Vsum' b_blob_name: 'e' t_blob_name: 's' t_blob_shape { dim: 2 dim: 4 } } "
+    "layer_param { name: 'fc' type: 'FC' blob { shape { dim: 4 dim: 2 } } lr { lr_multi: 1 } "
+    "  fc_param { in_nodes_dim: 4 out_nodes_dim: 2 } b_blob_name: 's' t_blob_name: 'o' t_blob_shape { dim: 2 dim: 2 } } "
+    "layer_param { name: 'loss' type: 'SoftmaxWithLoss' "
+    "  b_blob_name: 'o' b_blob_name: 'label' t_blob_name: 'prob' t_blob_shape { dim: 2 dim: 2 } } ";
+
+//write the net, with `batch_size` samples a batch, and `sample_num`
+//samples, the solver trains the net of `solve_p`
+static void write_solver_files(SolverParameter & solve_p, int batch_size = 2, int sample_num = 16) {
+    NetParameter net_p;
+    ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kSolverNet, &net_p));
+    net_p.mutable_layer_param(0)->mutable_data_param()->set_batch_size(batch_size);
+    for (int i = 1; i < net_p.layer_param_size(); ++i) {
+        BlobShapeProto * shape = net_p.mutable_layer_param(i)->mutable_t_blob_shape(0);
+        shape->set_dim(0, shape->dim(0) / 2 * batch_size);
+    }
+    std::string net_text;
+    google::protobuf::TextFormat::PrintToString(net_p, &net_text);
+    std::ofstream net("test_solver_net.txt");
+    net << net_text;
+    net.close();
+    std::ofstream data("test_solver_data.txt");
+    for (int i = 0; i < sample_num; ++i) {
+        data << i % 10 << " " << (i * 3 + 1) % 10 << ";" << (i % 10 < 5 ? 0 : 1) << "\n";
+    }
+    data.close();
+    solve_p.set_net("test_solver_net.txt");
+    solve_p.set_base_lr(0.1);
+    solve_p.set_momentum(0.5);
+}
+
+static void fill_para_blobs(NeuralNet<float> & net) {
+    vector<shared_ptr<Blob<float> > > & para_blobs = net.get_para_blobs();
+    for (size_t p = 0; p < para_blobs.size(); ++p) {
+        for (size_t i = 0; i < para_blobs[p]->get_count(); ++i) {
+            para_blobs[p]->set_data_at(i, 0.1f * ((i + p) % 7) - 0.3f);
+        }
+    }
+}
+
+//the loss of the net over its whole data file
+static float data_loss(NeuralNet<float> & net) {
+    DataFeedLayer<float> * feed = static_cast<DataFeedLayer<float> *>(net.get_input_feed().get());
+    EXPECT_EQ(feed->read_file(), snoopy::SUCCESS);
+    feed->clear();
+    float sum = 0;
+    float loss = 0;
+    while (true) {
+        feed->get_data(net.get_input_blobs());
+        if (feed->is_end()) {
+            break;
+        }
+        net.forward(&loss);
+        sum += loss;
+    }
+    return sum;
+}
+
+TEST(SGDSolver, hogwild) {
+    SolverParameter solve_p;
+    write_solver_files(solve_p);
+    solve_p.set_epochs(4);
+    solve_p.set_thread_num(4);
+    //8 steps a thread, the last 2 are applied after the loop
+    solve_p.set_dense_reduce_interval(3);
+    SGDSolver<float> sgd;
+    ASSERT_EQ(sgd.init(solve_p), snoopy::SUCCESS);
+    fill_para_blobs(*sgd.get_net());
+    const float loss0 = data_loss(*sgd.get_net());
+
+    ASSERT_EQ(sgd.update(), snoopy::SUCCESS);
+    //each thread read the 4 samples of its shard in every epoch
+    EXPECT_EQ(sgd.get_worker_steps(), vector<int64_t>(4, 8));
+    EXPECT_LT(data_loss(*sgd.get_net()), loss0);
+}
+
+TEST(SGDSolver, sync_data_parallel) {
+    SolverParameter solve_p;
+    write_solver_files(solve_p);
+    solve_p.set_epochs(2);
+    solve_p.set_thread_num(4);
+    solve_p.set_parallel_mode(SYNC_DATA_PARALLEL);
+    //two runs end with the same parameters, bit for bit
+    SGDSolver<float> sgd[2];
+    for (int n = 0; n < 2; ++n) {
+        ASSERT_EQ(sgd[n].init(solve_p), snoopy::SUCCESS);
+        fill_para_blobs(*sgd[n].get_net());
+        ASSERT_EQ(sgd[n].update(), snoopy::SUCCESS);
+    }
+    EXPECT_EQ(sgd[0].get_phase_times().steps, 4);
+    vector<shared_ptr<Blob<float> > > & paras0 = sgd[0].get_net()->get_para_blobs();
+    vector<shared_ptr<Blob<float> > > & paras1 = sgd[1].get_net()->get_para_blobs();
+    for (size_t p = 0; p < paras0.size(); ++p) {
+        EXPECT_EQ(memcmp(paras0[p]->get_raw_data(), paras1[p]->get_raw_data(),
+                    paras0[p]->get_count() * sizeof(float)), 0);
+    }
+
+    //one step of 4 threads of 2 samples is a step of one thread on the 8
+    //samples with the mean gradient
+    SolverParameter sync_p;
+    write_solver_files(sync_p, 2, 8);
+    sync_p.set_epochs(1);
+    sync_p.set_thread_num(4);
+    sync_p.set_parallel_mode(SYNC_DATA_PARALLEL);
+    SGDSolver<float> sync_sgd;
+    ASSERT_EQ(sync_sgd.init(sync_p), snoopy::SUCCESS);
+    fill_para_blobs(*sync_sgd.get_net());
+    ASSERT_EQ(sync_sgd.update(), snoopy::SUCCESS);
+    EXPECT_EQ(sync_sgd.get_phase_times().steps, 1);
+
+    SolverParameter single_p;
+    write_solver_files(single_p, 8, 8);
+    single_p.set_epochs(1);
+    single_p.set_base_lr(0.1 / 4);
+    SGDSolver<float> single_sgd;
+    ASSERT_EQ(single_sgd.init(single_p), snoopy::SUCCESS);
+    fill_para_blobs(*single_sgd.get_net());
+    ASSERT_EQ(single_sgd.update(), snoopy::SUCCESS);
+
+    vector<shared_ptr<Blob<float> > > & sync_paras = sync_sgd.get_net()->get_para_blobs();
+    vector<shared_ptr<Blob<float> > > & single_paras = single_sgd.get_net()->get_para_blobs();
+    ASSERT_EQ(sync_paras.size(), single_paras.size());
+    float changed = 0;
+    for (size_t p = 0; p < sync_paras.size(); ++p) {
+        for (size_t i = 0; i < sync_paras[p]->get_count(); ++i) {
+            EXPECT_NEAR(sync_paras[p]->get_data_at(i), single_paras[p]->get_data_at(i), 1e-6);
+            changed += std::fabs(sync_paras[p]->get_data_at(i) - (0.1f * ((i + p) % 7) - 0.3f));
+        }
+    }
+    EXPECT_GT(changed, 0);
+}
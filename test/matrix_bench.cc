@@ -0,0 +1,98 @@
+/**
+ *  Micro-benchmark for the element access of Matrix.
+ *
+ *  It compares the cost per element of going through the virtual
+ *  TensorBuffer::at() with the cached raw pointer used by Matrix, and the
+ *  blocked transpose with a plain copy of the same size.
+ *
+ *  Usage: ./matrix_bench [row] [column] [repeat]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "../matrix/matrix.h"
+
+using namespace snoopy::matrix;
+using namespace snoopy;
+
+template<typename Func>
+double time_per_element(Func f, size_t elements, int repeat) {
+  f(); //warm up
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; ++r) {
+    f();
+  }
+  auto end = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  return ns / (static_cast<double>(elements) * repeat);
+}
+
+int main(int argc, char** argv) {
+  size_t row = argc > 1 ? atoi(argv[1]) : 256;
+  size_t column = argc > 2 ? atoi(argv[2]) : 1024;
+  int repeat = argc > 3 ? atoi(argv[3]) : 100;
+  size_t elements = row * column;
+
+  MatrixShape<2> s{row, column};
+  Matrix<float, 2> m1(s);
+  Matrix<float, 2> m2(s);
+  Matrix<float, 2> m3(s);
+  Random::uniform(m1);
+  Random::uniform(m2);
+
+  //the sub buffer is what slice holds
+  storage::TensorBuffer<float> * buffer =
+      new storage::SubBuffer<float>(m1.get_data(), 0);
+  const size_t stride = m1.get_stride();
+
+  double virtual_at = time_per_element([&]() {
+    for (size_t i = 0; i < row; ++i) {
+      for (size_t j = 0; j < column; ++j) {
+        buffer->at(i * stride + j) += 1.f;
+      }
+    }
+  }, elements, repeat);
+
+  double row_pointer = time_per_element([&]() {
+    for (size_t i = 0; i < row; ++i) {
+      float * p = m1.row_ptr(i);
+      for (size_t j = 0; j < column; ++j) {
+        p[j] += 1.f;
+      }
+    }
+  }, elements, repeat);
+
+  double view_index = time_per_element([&]() {
+    for (size_t i = 0; i < row; ++i) {
+      for (size_t j = 0; j < column; ++j) {
+        m1[i][j] += 1.f;
+      }
+    }
+  }, elements, repeat);
+
+  double scalar_op = time_per_element([&]() { m1 += 1.f; }, elements, repeat);
+  double matrix_op = time_per_element([&]() { m1 += m2; }, elements, repeat);
+  double expr_op = time_per_element([&]() { m3 = m1 + m2 * 2; }, elements,
+                                    repeat);
+  MatrixShape<2> ts{column, row};
+  Matrix<float, 2> mt(ts);
+  double transpose_op = time_per_element([&]() { transpose(mt, m1); },
+                                         elements, repeat);
+  double copy_op = time_per_element([&]() { m3.copy_from(m1); }, elements,
+                                    repeat);
+  double softmax_op = time_per_element([&]() { softmax(m3, m1); }, elements,
+                                       repeat);
+  buffer->unref();
+
+  printf("matrix %zu x %zu, %d repeats, ns per element\n", row, column, repeat);
+  printf("  TensorBuffer::at (virtual) : %.3f\n", virtual_at);
+  printf("  Matrix::row_ptr            : %.3f\n", row_pointer);
+  printf("  m[i][j] (MatrixView)       : %.3f\n", view_index);
+  printf("  Matrix += scalar           : %.3f\n", scalar_op);
+  printf("  Matrix += Matrix           : %.3f\n", matrix_op);
+  printf("  Matrix = m1 + m2 * 2       : %.3f\n", expr_op);
+  printf("  transpose(t, m)            : %.3f\n", transpose_op);
+  printf("  copy_from (memcpy bound)   : %.3f\n", copy_op);
+  printf("  softmax(t, m)              : %.3f\n", softmax_op);
+  return 0;
+}
@@ -1,7 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <gtest/gtest.h> 
+#include <thread>
 #include "../matrix/matrix.h"
+#include "../storage/pool_allocator.h"
+#include "../storage/arena_allocator.h"
 
 using namespace snoopy::matrix;
 
@@ -94,6 +97,99 @@ TEST(Matrix, dot_test) {
   EXPECT_EQ(slice1, s);
 }
 
+TEST(Matrix, dot_trans_test) {
+  Matrix<float, 2> m1 { { 1, 2, 3 }, { 2, 3, 4 } };
+  Matrix<float, 2> m2 { { 1, 2, 3 }, { 0, 1, 1 } };
+
+  //m1 * m2^T
+  Matrix<float, 2> r1 {{0, 0}, {0, 0}};
+  dot(r1, m1, CblasNoTrans, m2, CblasTrans);
+  Matrix<float, 2> e1 {{14, 5}, {20, 7}};
+  EXPECT_EQ(r1, e1);
+
+  //m1^T * m2, blas and plain loop
+  Matrix<float, 2> r2 {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+  Matrix<float, 2> r3 {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+  dot(r2, m1, CblasTrans, m2, CblasNoTrans);
+  dot(r3, m1, CblasTrans, m2, CblasNoTrans, 1.f, 0.f, false);
+  Matrix<float, 2> e2 {{1, 4, 5}, {2, 7, 9}, {3, 10, 13}};
+  EXPECT_EQ(r2, e2);
+  EXPECT_EQ(r3, e2);
+
+  //accumulate with beta = 1
+  dot(r1, m1, CblasNoTrans, m2, CblasTrans, 2.f, 1.f);
+  Matrix<float, 2> e3 {{42, 15}, {60, 21}};
+  EXPECT_EQ(r1, e3);
+}
+
+TEST(Matrix, lazy_dot_test) {
+  Matrix<float, 2> a { { 1, 2, 3 }, { 2, 3, 4 } };
+  Matrix<float, 2> b { { 2, 3 }, { 2, 3 }, {2, 3} };
+  MatrixShape<2> s{2, 2};
+  Matrix<float, 2> c(s);
+
+  c = dot(a, b);
+  Matrix<float, 2> e1 {{12, 18}, {18, 27}};
+  EXPECT_EQ(c, e1);
+
+  //beta = 1 with the scale folded into alpha
+  c += 0.5f * dot(a, b);
+  Matrix<float, 2> e2 {{18, 27}, {27, 40.5}};
+  EXPECT_EQ(c, e2);
+  c -= dot(a, b) * 0.5f;
+  EXPECT_EQ(c, e1);
+
+  //transposed operands and an element-wise expression around the product
+  Matrix<float, 2> at { { 1, 2 }, { 2, 3 }, { 3, 4 } };
+  c = dot(at, CblasTrans, b, CblasNoTrans) + c;
+  Matrix<float, 2> e3 {{24, 36}, {36, 54}};
+  EXPECT_EQ(c, e3);
+
+  //the destination is also an operand
+  Matrix<float, 2> d {{1, 2}, {3, 4}};
+  Matrix<float, 2> i2 {{0, 1}, {1, 0}};
+  d = dot(d, i2);
+  Matrix<float, 2> e4 {{2, 1}, {4, 3}};
+  EXPECT_EQ(d, e4);
+}
+
+TEST(Matrix, transpose_test) {
+  //sizes that leave partial tiles and partial register blocks
+  const size_t row = 75, column = 37;
+  MatrixShape<2> s{row, column};
+  Matrix<float, 2> m(s);
+  for (size_t i = 0; i < row; ++i) {
+    for (size_t j = 0; j < column; ++j) {
+      m.at(i, j) = i * column + j;
+    }
+  }
+  MatrixShape<2> ts{column, row};
+  Matrix<float, 2> t(ts);
+  transpose(t, m, 2.f);
+  EXPECT_EQ(t.get_row(), column);
+  EXPECT_EQ(t.get_column(), row);
+  for (size_t i = 0; i < row; ++i) {
+    for (size_t j = 0; j < column; ++j) {
+      EXPECT_EQ(t.at(j, i), 2.f * m.at(i, j));
+    }
+  }
+
+  const size_t n = 21;
+  MatrixShape<2> sq{n, n};
+  Matrix<double, 2> q(sq);
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      q.at(i, j) = i * n + j;
+    }
+  }
+  transpose_inplace(q);
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      EXPECT_EQ(q.at(i, j), j * n + i);
+    }
+  }
+}
+
 TEST(Matrix, matrix_sum_test) {
   Matrix<float, 2> m1 { { 1, 2, 3 }, { 2, 3, 4 } };
   Matrix<float, 1> m2 = sum(m1, 0);
@@ -157,6 +253,139 @@ TEST(Matrix, copy_from) {
   EXPECT_EQ(m1, m3);
 }
 
+TEST(Matrix, view_test) {
+  Matrix<float, 2> a {{1, 2, 3}, {4, 5, 6}};
+  Matrix<float, 2> b {{1, 1, 1}, {2, 2, 2}};
+  EXPECT_EQ(a[1][2], 6);
+  a[0][1] = 7;
+  EXPECT_EQ(a.at(0, 1), 7);
+
+  //the view writes through to the matrix
+  a[0] = a[1] + b[1] * 2;
+  Matrix<float, 2> e1 {{8, 9, 10}, {4, 5, 6}};
+  EXPECT_EQ(a, e1);
+  a[1].clear_data();
+  Matrix<float, 2> e2 {{8, 9, 10}, {0, 0, 0}};
+  EXPECT_EQ(a, e2);
+
+  //a view of a 3-D matrix is a 2-D leaf
+  Matrix<float, 3> c {{{1, 2}, {3, 4}}, {{5, 6}, {7, 8}}};
+  Matrix<float, 2> d {{1, 1}, {1, 1}};
+  c[1] = c[0] - d;
+  Matrix<float, 3> e3 {{{1, 2}, {3, 4}}, {{0, 1}, {2, 3}}};
+  EXPECT_EQ(c, e3);
+  EXPECT_EQ(c[1][1][0], 2);
+  EXPECT_EQ(c[1].get_row(), 2);
+}
+
+TEST(Matrix, fixed_matrix_test) {
+  FixedMatrix<float, 2, 3> f {{1, 2, 3}, {4, 5, 6}};
+  Matrix<float, 2> d {{1, 1, 1}, {2, 2, 2}};
+  EXPECT_EQ(f.get_row(), 2);
+  EXPECT_EQ(f[1][2], 6);
+
+  //fixed = fixed op dynamic
+  FixedMatrix<float, 2, 3> g(0.f);
+  g = f + d * 2.f;
+  FixedMatrix<float, 2, 3> e1 {{3, 4, 5}, {8, 9, 10}};
+  EXPECT_TRUE(g == e1);
+  g -= f;
+  FixedMatrix<float, 2, 3> e2 {{2, 2, 2}, {4, 4, 4}};
+  EXPECT_TRUE(g == e2);
+
+  //dynamic = dynamic op fixed
+  MatrixShape<2> s{2, 3};
+  Matrix<float, 2> m(s);
+  m = d - f;
+  Matrix<float, 2> e3 {{0, -1, -2}, {-2, -3, -4}};
+  EXPECT_EQ(m, e3);
+
+  //a 16 wide row fills whole packets, and views copy in and out
+  Matrix<float, 2> emb(MatrixShape<2>{3, 16});
+  emb = ScalarExp<float>(1.f);
+  FixedMatrix<float, 1, 16> row(2.f);
+  row += emb[1] * 0.5f;
+  row.copy_to(emb[2]);
+  EXPECT_EQ(emb[2][15], 2.5f);
+  EXPECT_EQ(emb[0][15], 1.f);
+
+  FixedMatrix<float, 3, 2> h {{1, 0}, {0, 1}, {1, 1}};
+  FixedMatrix<float, 2, 2> p = dot(f, h);
+  FixedMatrix<float, 2, 2> e4 {{4, 5}, {10, 11}};
+  EXPECT_TRUE(p == e4);
+}
+
+TEST(Matrix, half_precision_test) {
+  //exact bit patterns, including round to nearest even and subnormals
+  EXPECT_EQ(fp16(1.f).x, 0x3c00);
+  EXPECT_EQ(fp16(65504.f).x, 0x7bff);
+  EXPECT_EQ(fp16(1e6f).x, 0x7c00);
+  EXPECT_EQ(fp16(-2.f).x, 0xc000);
+  EXPECT_EQ(fp16(5.96046448e-8f).x, 0x0001);
+  EXPECT_EQ(float(fp16(0.333333343f)), 0.333251953f);
+  EXPECT_EQ(bf16(1.f).x, 0x3f80);
+  EXPECT_EQ(bf16(1.00390625f).x, 0x3f80);  //tie goes to even
+  EXPECT_EQ(bf16(1.01171875f).x, 0x3f82);  //tie goes to even
+  EXPECT_EQ(float(bf16(-3.5f)), -3.5f);
+
+  //the vector kernels agree with the scalar conversion
+  const size_t n = 37;
+  vector<float> f(n), back(n);
+  vector<fp16> h(n);
+  vector<bf16> b(n);
+  for (size_t i = 0; i < n; ++i) {
+    f[i] = (static_cast<float>(i) - 18.f) * 0.37f;
+  }
+  convert(h.data(), f.data(), n);
+  convert(back.data(), h.data(), n);
+  for (size_t i = 0; i < n; ++i) {
+    EXPECT_EQ(h[i].x, fp16(f[i]).x);
+    EXPECT_EQ(back[i], float(fp16(f[i])));
+  }
+  convert(b.data(), f.data(), n);
+  convert(back.data(), b.data(), n);
+  for (size_t i = 0; i < n; ++i) {
+    EXPECT_EQ(b[i].x, bf16(f[i]).x);
+    EXPECT_EQ(back[i], float(bf16(f[i])));
+  }
+
+  //4096 ones: a fp16 accumulator would stop at 2048
+  MatrixShape<2> s{2, 4096};
+  Matrix<fp16, 2> ones(s);
+  for (size_t j = 0; j < 4096; ++j) {
+    ones.at(0, j) = 1.f;
+    ones.at(1, j) = 1.f;
+  }
+  Matrix<fp16, 1> rs = sum(ones, 1);
+  EXPECT_EQ(float(rs[0]), 4096.f);
+  Matrix<fp16, 1> cs = sum(ones, 0);
+  EXPECT_EQ(float(cs[4095]), 2.f);
+
+  //float activations times bf16 weights, accumulated in float
+  Matrix<float, 2> x {{1, 2, 3}, {2, 3, 4}};
+  Matrix<float, 2> w {{0.5, -1}, {2, 0.25}, {-1.5, 1}};
+  MatrixShape<2> ws{3, 2};
+  Matrix<bf16, 2> wb(ws);
+  for (size_t i = 0; i < 3; ++i) {
+    wb[i].copy_from(w[i]);
+  }
+  MatrixShape<2> os{2, 2};
+  Matrix<float, 2> out(os);
+  dot(out, x, CblasNoTrans, wb, CblasNoTrans);
+  Matrix<float, 2> e1 = dot(x, w);
+  EXPECT_EQ(out, e1);
+  //x * wb^T^T, with the weights stored transposed
+  Matrix<bf16, 2> wt(MatrixShape<2>{2, 3});
+  for (size_t i = 0; i < 3; ++i) {
+    for (size_t j = 0; j < 2; ++j) {
+      wt.at(j, i) = w.at(i, j);
+    }
+  }
+  dot(out, x, CblasNoTrans, wt, CblasTrans, 1.f, 1.f);
+  Matrix<float, 2> e2 = 2.f * dot(x, w);
+  EXPECT_EQ(out, e2);
+}
+
 TEST(Matrix, test_softmax) {
   Matrix<float, 2> m1 {{1, 2, 3}, {1, 3, 5}, {1, 2, 2}, {2, 3, 3}};
   MatrixShape<2> s1{4, 3};
@@ -171,3 +400,227 @@ TEST(Matrix, test_softmax) {
 }
 
 
+TEST(Matrix, row_parallel_reduce_test) {
+  //wider than one column block and not a multiple of the packet size
+  const size_t row = 13, column = 1031;
+  MatrixShape<2> s{row, column};
+  Matrix<float, 2> m(s);
+  for (size_t i = 0; i < row; ++i) {
+    for (size_t j = 0; j < column; ++j) {
+      m.at(i, j) = ((i * 7 + j * 13) % 101) / 10.f - 5.f;
+    }
+  }
+
+  Matrix<float, 1> s0 = sum(m, 0);
+  Matrix<float, 1> s1 = sum(m, 1);
+  Matrix<float, 1> s2 = sum(m, 2);
+  vector<int> index(row, 0);
+  Matrix<float, 1> m1 = max(m, index, 1);
+  double total = 0;
+  for (size_t j = 0; j < column; ++j) {
+    double c = 0;
+    for (size_t i = 0; i < row; ++i) {
+      c += m.at(i, j);
+    }
+    EXPECT_NEAR(s0[j], c, 1e-4);
+  }
+  for (size_t i = 0; i < row; ++i) {
+    double r = 0;
+    size_t arg = 0;
+    for (size_t j = 0; j < column; ++j) {
+      r += m.at(i, j);
+      if (m.at(i, arg) < m.at(i, j))
+        arg = j;
+    }
+    total += r;
+    EXPECT_NEAR(s1[i], r, 1e-3);
+    EXPECT_EQ(index[i], arg);
+    EXPECT_EQ(m1[i], m.at(i, arg));
+  }
+  EXPECT_NEAR(s2[0], total, 1e-2);
+
+  Matrix<float, 2> sm = softmax(m);
+  EXPECT_FALSE(sm.raw_data() == m.raw_data());
+  for (size_t i = 0; i < row; ++i) {
+    float ma = m.at(i, index[i]);
+    double z = 0;
+    for (size_t j = 0; j < column; ++j) {
+      z += std::exp(m.at(i, j) - ma);
+    }
+    for (size_t j = 0; j < column; ++j) {
+      EXPECT_NEAR(sm.at(i, j), std::exp(m.at(i, j) - ma) / z, 1e-6);
+    }
+  }
+}
+
+TEST(Matrix, packet_expr_test) {
+  //the row length is not a multiple of any packet size
+  MatrixShape<2> s{3, 37};
+  Matrix<float, 2> m1(s);
+  Matrix<float, 2> m2(s);
+  Matrix<float, 2> m3(s);
+  for (size_t i = 0; i < 3; ++i) {
+    for (size_t j = 0; j < 37; ++j) {
+      m1.get_data()->at(i * 37 + j) = i + j;
+      m2.get_data()->at(i * 37 + j) = 1 + j % 5;
+    }
+  }
+  m3 = (m1 + m2) * 2 - m1 / m2;
+  for (size_t i = 0; i < 3; ++i) {
+    for (size_t j = 0; j < 37; ++j) {
+      float a = i + j;
+      float b = 1 + j % 5;
+      EXPECT_FLOAT_EQ(m3.eval(i, j), (a + b) * 2 - a / b);
+    }
+  }
+
+  //scalars are captured per expression
+  m3 = m1 * 3;
+  EXPECT_FLOAT_EQ(m3.eval(1, 36), 111);
+  m3 = m1 * 4;
+  EXPECT_FLOAT_EQ(m3.eval(1, 36), 148);
+
+  //operators without packet_op fall back to the scalar path
+  m3 = single_op<Square>(m2);
+  EXPECT_FLOAT_EQ(m3.eval(2, 4), 25);
+
+  //slices keep the stride of the parent matrix
+  Matrix<float, 2> s3 = m3.slice(1, 2);
+  s3 = m1.slice(2, 3) + 1;
+  EXPECT_FLOAT_EQ(m3.eval(1, 0), 3);
+  EXPECT_FLOAT_EQ(m3.eval(1, 36), 39);
+  EXPECT_FLOAT_EQ(m3.eval(2, 4), 25);
+}
+
+TEST(Matrix, pool_allocator_test) {
+  using snoopy::storage::PoolAllocator;
+  PoolAllocator pool;
+  const size_t sizes[] = {4, 100, 4000, 70000, 600000, 5 << 20};
+
+  //the first iteration maps the memory, the following ones reuse it
+  uint64_t warm_system_allocs = 0;
+  for (int iter = 0; iter < 4; ++iter) {
+    std::vector<void *> ptrs;
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k) {
+      void * p = pool.allocate_raw(32, sizes[k]);
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % 64, 0u);
+      memset(p, 1, sizes[k]);
+      ptrs.push_back(p);
+    }
+    for (size_t k = 0; k < ptrs.size(); ++k) {
+      pool.deallocate_raw(ptrs[k]);
+    }
+    if (iter == 0) {
+      warm_system_allocs = pool.get_stats().system_allocs;
+    }
+  }
+  snoopy::storage::PoolStats stats = pool.get_stats();
+  EXPECT_EQ(stats.system_allocs, warm_system_allocs);
+  EXPECT_EQ(stats.allocs, 24u);
+  EXPECT_EQ(stats.reuse_hits, 18u);
+  EXPECT_EQ(stats.bytes_in_use, 0u);
+  EXPECT_GE(stats.peak_bytes_in_use, static_cast<uint64_t>(5 << 20));
+
+  //matrices created under a scope take their memory from the pool
+  {
+    snoopy::storage::AllocatorScope scope(&pool);
+    Matrix<float, 2> m {{1, 2}, {3, 4}};
+    EXPECT_EQ(pool.get_stats().allocs, 25u);
+    EXPECT_GT(pool.get_stats().bytes_in_use, 0u);
+  }
+  EXPECT_EQ(pool.get_stats().bytes_in_use, 0u);
+  EXPECT_EQ(snoopy::storage::default_allocator(),
+            snoopy::storage::cpu_allocator());
+
+  //a block freed on another thread is cached there and returned to the
+  //pool when that thread exits
+  void * p = pool.allocate_raw(32, 1000);
+  std::thread t([&pool, p]() { pool.deallocate_raw(p); });
+  t.join();
+  EXPECT_EQ(pool.get_stats().bytes_in_use, 0u);
+  const uint64_t reused = pool.get_stats().reuse_hits;
+  void * q = pool.allocate_raw(32, 1000);
+  EXPECT_EQ(pool.get_stats().reuse_hits, reused + 1);
+  pool.deallocate_raw(q);
+}
+
+TEST(Matrix, arena_allocator_test) {
+  snoopy::storage::ArenaAllocator arena(snoopy::storage::cpu_allocator(), 1024);
+  char * p1 = static_cast<char *>(arena.allocate_raw(32, 100));
+  char * p2 = static_cast<char *>(arena.allocate_raw(32, 100));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(p2) % 32, 0u);
+  EXPECT_EQ(p2, p1 + 128);
+  EXPECT_EQ(arena.num_chunks(), 1u);
+
+  //a step bigger than the chunk grows the arena, the reset merges the chunks
+  arena.allocate_raw(32, 4000);
+  EXPECT_EQ(arena.num_chunks(), 2u);
+  const size_t capacity = arena.capacity();
+  arena.reset();
+  EXPECT_EQ(arena.bytes_used(), 0u);
+  EXPECT_EQ(arena.num_chunks(), 1u);
+  EXPECT_EQ(arena.capacity(), capacity);
+
+  //the same step again fits in the merged chunk
+  for (int step = 0; step < 3; ++step) {
+    Matrix<float, 2> m(&arena, MatrixShape<2> {10, 10});
+    m = ScalarExp<float>(1.f);
+    arena.allocate_raw(32, 4000);
+    EXPECT_FLOAT_EQ(m.at(9, 9), 1);
+    arena.reset();
+  }
+  EXPECT_EQ(arena.num_chunks(), 1u);
+  EXPECT_EQ(arena.capacity(), capacity);
+  EXPECT_EQ(arena.peak_bytes_used(), 4400u);
+}
+
+TEST(Matrix, refcount_test) {
+  snoopy::storage::PoolAllocator pool;
+  {
+    snoopy::storage::AllocatorScope scope(&pool);
+    MatrixShape<2> s {4, 8};
+    Matrix<float, 2> m1(s);
+    EXPECT_TRUE(m1.get_data()->ref_is_one());
+
+    //copies share the buffer, moves steal it
+    Matrix<float, 2> m2 = m1;
+    EXPECT_FALSE(m1.get_data()->ref_is_one());
+    Matrix<float, 2> m3(std::move(m2));
+    EXPECT_EQ(m2.get_data(), nullptr);
+    EXPECT_EQ(m3.get_data(), m1.get_data());
+    m3 = Matrix<float, 2>(s);
+    EXPECT_TRUE(m1.get_data()->ref_is_one());
+    EXPECT_TRUE(m3.get_data()->ref_is_one());
+
+    //a slice keeps its root alive
+    Matrix<float, 2> sub = Matrix<float, 2>(s).slice(1, 3);
+    sub = ScalarExp<float>(2.f);
+    m3 = sub;
+    m3 = m1;
+    m1 = {{1, 2}, {3, 4}};
+    Matrix<float, 1> v(MatrixShape<1> {8});
+    Matrix<float, 1> w = std::move(v);
+    v = std::move(w);
+  }
+  EXPECT_EQ(pool.get_stats().bytes_in_use, 0u);
+
+  //the owners drop their references concurrently, the buffer is deleted once
+  for (int round = 0; round < 20; ++round) {
+    std::vector<std::thread> threads;
+    {
+      snoopy::storage::AllocatorScope scope(&pool);
+      Matrix<float, 2> m(MatrixShape<2> {16, 16});
+      for (int t = 0; t < 8; ++t) {
+        Matrix<float, 2> copy = m;
+        threads.push_back(std::thread([copy]() mutable {
+          copy.at(0, 0) = 1.f;
+          Matrix<float, 2> drop(std::move(copy));
+        }));
+      }
+    }
+    for (size_t t = 0; t < threads.size(); ++t) {
+      threads[t].join();
+    }
+  }
+  EXPECT_EQ(pool.get_stats().bytes_in_use, 0u);
+}
@@ -0,0 +1,64 @@
+/**
+ *  \file  text_to_record.cpp
+ *  \brief convert the slot text format of TextDataFeedLayer into a record
+ *         file of io/record_file.h, read by BinaryDataFeedLayer
+ *
+ *  usage: text_to_record <text file> <record file> <slot size> [samples per block]
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <limits>
+#include "../io/record_file.h"
+#include "../io/slot_parser.h"
+#include "../storage/mmap_buffer.h"
+
+using namespace snoopy;
+
+int main(int argc, char ** argv) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <text file> <record file> <slot size> [samples per block]\n", argv[0]);
+        return 1;
+    }
+    const size_t slot_size = std::atoi(argv[3]);
+    const size_t records_per_block = argc > 4 ? std::atoi(argv[4]) : 4096;
+    if (slot_size == 0 || records_per_block == 0) {
+        fprintf(stderr, "slot size and samples per block must be positive\n");
+        return 1;
+    }
+
+    storage::MappedFile * text = new storage::MappedFile(argv[1]);
+    if (!text->is_open()) {
+        LOG_ERROR << "open file : " << argv[1] << " failed!";
+        text->unref();
+        return 1;
+    }
+    text->advise_sequential();
+    io::RecordWriter writer(slot_size, 0, records_per_block);
+    if (writer.open(argv[2]) != snoopy::SUCCESS) {
+        text->unref();
+        return 1;
+    }
+
+    //every id of a slot is kept, the feed truncates to its slot_capicity
+    io::SlotParser parser(slot_size, std::numeric_limits<size_t>::max());
+    io::SlotRecords records(slot_size);
+    const char * p = text->data();
+    const char * end = p + text->size();
+    while (p < end) {
+        records.clear();
+        p = parser.parse(p, end, records, records_per_block);
+        for (size_t r = 0; r < records.size(); ++r) {
+            writer.add(records, r);
+        }
+    }
+    const size_t lines = parser.lines();
+    const size_t samples = writer.size();
+    text->unref();
+    if (writer.close() != snoopy::SUCCESS) {
+        return 1;
+    }
+    LOG_INFO << "converted " << lines << " lines into " << samples << " samples, "
+             << parser.bad_lines() << " lines with an id out of the int range dropped";
+    return 0;
+}